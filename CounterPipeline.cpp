@@ -0,0 +1,122 @@
+#include "CounterPipeline.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+// A counter that went back is only taken as wrapped if the rate this
+// implies stays below this multiple of the interface speed.
+#define COUNTER_WRAP_MAX_SPEED_FACTOR 2
+
+namespace sflow {
+
+namespace {
+
+enum class CounterStep { ADVANCED, WRAPPED, RESET };
+
+CounterStep counterDelta(uint64_t current, uint64_t last, uint64_t& delta) {
+  if (current >= last) {
+    delta = current - last;
+    return CounterStep::ADVANCED;
+  }
+  // Agents without 64-bit counters export 32-bit ones, which wrap every
+  // 34 s at 1 Gbit/s.
+  if (last <= UINT32_MAX) {
+    delta = current + (uint64_t(1) << 32) - last;
+    return CounterStep::WRAPPED;
+  }
+  return CounterStep::RESET;
+}
+
+uint64_t bitsPerSecond(uint64_t octets, int64_t elapsedNs) {
+  return uint64_t(double(octets) * 8e9 / double(elapsedNs));
+}
+
+}  // namespace
+
+bool CounterPipeline::update(uint32_t agentId, uint32_t uptimeMs, int64_t nowNs,
+                             const CounterSample& sample, UtilizationSample& out) {
+  m_samples.fetch_add(1, memory_order_relaxed);
+  uint64_t key = (uint64_t(agentId) << 32) | sample.if_index;
+  auto it = m_ids.find(key);
+  if (it == m_ids.end()) {
+    if (m_ids.size() >= m_maxInterfaces) {
+      m_dropped.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+    uint32_t id;
+    if (!m_freeIds.empty()) {
+      id = m_freeIds.back();
+      m_freeIds.pop_back();
+    } else {
+      id = uint32_t(m_states.size());
+      m_states.emplace_back();
+    }
+    m_ids.emplace(key, id);
+    m_interfaces.store(m_ids.size(), memory_order_relaxed);
+    // The first report of an interface only sets the baseline.
+    m_states[id] = InterfaceState{ nowNs, uptimeMs, sample.in_octets, sample.out_octets };
+    return false;
+  }
+
+  InterfaceState& state = m_states[it->second];
+  bool rebooted = false;
+  int64_t elapsedNs;
+  if (uptimeMs != 0 || state.uptime_ms != 0) {
+    uint32_t elapsedMs = uptimeMs - state.uptime_ms;  // wraps after ~49.7 days
+    rebooted = elapsedMs >= (1u << 31);
+    elapsedNs = int64_t(elapsedMs) * 1000000;
+  } else {
+    elapsedNs = nowNs - state.last_ns;
+  }
+  // Exported at the same instant as the baseline (e.g. a duplicate): keep
+  // measuring from the baseline.
+  if (!rebooted && elapsedNs <= 0) return false;
+
+  uint64_t inOctets = 0;
+  uint64_t outOctets = 0;
+  CounterStep in = counterDelta(sample.in_octets, state.in_octets, inOctets);
+  CounterStep outStep = counterDelta(sample.out_octets, state.out_octets, outOctets);
+  bool reset = rebooted || in == CounterStep::RESET || outStep == CounterStep::RESET;
+  bool wrapped = !reset && (in == CounterStep::WRAPPED || outStep == CounterStep::WRAPPED);
+
+  state = InterfaceState{ nowNs, uptimeMs, sample.in_octets, sample.out_octets };
+  if (reset) {
+    m_resets.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+  uint64_t inBps = bitsPerSecond(inOctets, elapsedNs);
+  uint64_t outBps = bitsPerSecond(outOctets, elapsedNs);
+  if (wrapped) {
+    // Counters of a re-initialized interface restart near zero, which
+    // looks like a wrap of a 32-bit counter but implies a rate the
+    // interface cannot carry.
+    if (sample.if_speed > 0 &&
+        max(inBps, outBps) / COUNTER_WRAP_MAX_SPEED_FACTOR > sample.if_speed) {
+      m_resets.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+    m_wraps.fetch_add(1, memory_order_relaxed);
+  }
+
+  out.timestamp_ns = nowNs;
+  out.in_bps = inBps;
+  out.out_bps = outBps;
+  out.if_speed = sample.if_speed;
+  out.interval_ns = elapsedNs;
+  return true;
+}
+
+void CounterPipeline::expire(int64_t cutoffNs) {
+  for (auto it = m_ids.begin(); it != m_ids.end();) {
+    if (m_states[it->second].last_ns < cutoffNs) {
+      m_freeIds.push_back(it->second);
+      it = m_ids.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  m_interfaces.store(m_ids.size(), memory_order_relaxed);
+}
+
+}  // namespace sflow
@@ -0,0 +1,74 @@
+#ifndef COUNTER_PIPELINE_HPP
+#define COUNTER_PIPELINE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "LinkUtilization.hpp"
+#include "SFlowDecoder.hpp"
+
+namespace sflow {
+
+  // Turns the generic interface counters of consecutive counter samples
+  // into in/out rates. Each (agent, ifIndex) gets a dense id into a flat
+  // state array, so a sample costs one hash lookup.
+  //
+  // Intervals are measured on the agent's uptime (ms) of the datagrams
+  // carrying the samples, which is not skewed by network jitter or by
+  // receive batching; the receive time is the fallback when the uptime did
+  // not advance. Sub-second export intervals therefore give accurate
+  // rates. A counter going back is taken as a 32-bit counter wrap while
+  // its previous value fit in 32 bits and the resulting rate is plausible
+  // for the interface speed, otherwise as a reset (cleared counters or a
+  // rebooted agent), after which the next sample sets a new baseline.
+  //
+  // Owned by one receive worker and not thread-safe, except for the
+  // statistics.
+  class CounterPipeline {
+  public:
+    explicit CounterPipeline(std::size_t maxInterfaces = std::size_t(1) << 20)
+        : m_maxInterfaces(maxInterfaces) {}
+
+    // Feeds one sample; true if it completes an interval, with the rates
+    // in `out` (stamped `nowNs`, with the interval's length).
+    bool update(uint32_t agentId, uint32_t uptimeMs, int64_t nowNs,
+                const CounterSample& sample, UtilizationSample& out);
+
+    // Forgets interfaces last reported before `cutoffNs`.
+    void expire(int64_t cutoffNs);
+
+    // Statistics, readable from any thread.
+    std::size_t size() const { return m_interfaces.load(std::memory_order_relaxed); }
+    uint64_t samples() const { return m_samples.load(std::memory_order_relaxed); }
+    uint64_t wraps() const { return m_wraps.load(std::memory_order_relaxed); }
+    uint64_t resets() const { return m_resets.load(std::memory_order_relaxed); }
+    // samples of new interfaces beyond maxInterfaces
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+  private:
+    struct InterfaceState {
+      int64_t last_ns = 0;  // receive time of the baseline sample
+      uint32_t uptime_ms = 0;
+      uint64_t in_octets = 0;
+      uint64_t out_octets = 0;
+    };
+
+    std::size_t m_maxInterfaces;
+    // (agent id << 32 | ifIndex) -> index into m_states
+    std::unordered_map<uint64_t, uint32_t> m_ids;
+    std::vector<InterfaceState> m_states;
+    std::vector<uint32_t> m_freeIds;
+
+    std::atomic<std::size_t> m_interfaces{0};
+    std::atomic<uint64_t> m_samples{0};
+    std::atomic<uint64_t> m_wraps{0};
+    std::atomic<uint64_t> m_resets{0};
+    std::atomic<uint64_t> m_dropped{0};
+  };
+
+} // namespace sflow
+
+#endif // COUNTER_PIPELINE_HPP
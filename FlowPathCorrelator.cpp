@@ -0,0 +1,208 @@
+#include "FlowPathCorrelator.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace std;
+
+namespace sflow {
+
+FlowPathCorrelator::FlowPathCorrelator(function<IpAddress(uint32_t)> agentAddress)
+    : m_agentAddress(std::move(agentAddress)) {}
+
+uint64_t FlowPathCorrelator::edgeOfHop(HopId hop, const InterfaceMap& interfaces) {
+  auto [it, inserted] = m_hopEdges.try_emplace(hop, 0);
+  if (inserted) {
+    const InterfaceMap::Target* target =
+        interfaces.find(m_agentAddress(hopAgentId(hop)), hopIfIndex(hop));
+    it->second = target ? target->edge_id : 0;
+  }
+  return it->second;
+}
+
+void FlowPathCorrelator::resolve(FlowEntry& entry, const FlowRate& flow,
+                                 const InterfaceMap& interfaces) {
+  entry.hop_count = flow.hop_count;
+  FlowEdges& edges = entry.next_edges;
+  edges.count = 0;
+  for (uint8_t i = 0; i < flow.hop_count; i++) {
+    entry.hops[i] = flow.hops[i].id;
+    uint64_t edge = edgeOfHop(flow.hops[i].id, interfaces);
+    if (edge == 0) continue;
+    auto last = edges.ids.begin() + edges.count;
+    if (find(edges.ids.begin(), last, edge) != last) continue;
+    edges.ids[edges.count++] = edge;
+  }
+}
+
+void FlowPathCorrelator::attach(const FlowKey& key, FlowEntry& entry) {
+  entry.rate = entry.next_rate;
+  entry.edge_count = entry.next_edges.count;
+  for (uint8_t i = 0; i < entry.edge_count; i++) {
+    uint64_t edge = entry.next_edges.ids[i];
+    EdgeFlows& edgeFlows = m_edges[edge];
+    uint64_t& rate = edgeFlows.flows[key];
+    rate = entry.rate;
+    edgeFlows.rate += entry.rate;
+    entry.edges[i] = EdgeRef{ edge, &edgeFlows, &rate };
+  }
+  m_flowEdges[key] = entry.next_edges;
+}
+
+void FlowPathCorrelator::detach(const FlowKey& key, FlowEntry& entry) {
+  for (uint8_t i = 0; i < entry.edge_count; i++) {
+    EdgeFlows* edgeFlows = entry.edges[i].flows;
+    edgeFlows->flows.erase(key);
+    edgeFlows->rate -= entry.rate;
+    if (edgeFlows->flows.empty()) {
+      m_edges.erase(entry.edges[i].id);
+    }
+  }
+  entry.edge_count = 0;
+}
+
+void FlowPathCorrelator::update(const RateSnapshot& rates, const InterfaceMap& interfaces) {
+  // The versions are only written here, so reading them unlocked is safe.
+  bool remap = !m_applied || interfaces.topology_version != m_topologyVersion ||
+               interfaces.bindings_version != m_bindingsVersion;
+  if (m_applied && !remap && rates.version == m_ratesVersion) {
+    return;
+  }
+  m_round++;
+  if (remap) {
+    m_hopEdges.clear();
+  }
+
+  // What changes, without the lock: queries only read m_edges and
+  // m_flowEdges, which stay as they are until applied below.
+  m_moved.clear();
+  m_rated.clear();
+  m_gone.clear();
+  for (const FlowRate& flow : rates.flows) {
+    auto [it, inserted] = m_flows.try_emplace(flow.key);
+    FlowEntry& entry = it->second;
+    if (inserted) {
+      entry.order = m_order.insert(m_order.begin(), flow.key);
+    } else {
+      m_order.splice(m_order.begin(), m_order, entry.order);
+    }
+    entry.seen = m_round;
+    entry.next_rate = flow.rate;
+    bool sameHops = !inserted && entry.hop_count == flow.hop_count;
+    for (uint8_t i = 0; sameHops && i < flow.hop_count; i++) {
+      sameHops = entry.hops[i] == flow.hops[i].id;
+    }
+    if (!sameHops || remap) {
+      resolve(entry, flow, interfaces);
+      m_moved.push_back(&*it);
+    } else if (entry.rate != flow.rate) {
+      m_rated.push_back(&*it);
+    }
+  }
+  // Flows that carried no traffic in this interval no longer load a link.
+  // Every flow in the snapshot went to the front, so they are the tail.
+  for (auto it = m_order.rbegin(); it != m_order.rend(); ++it) {
+    auto flow = m_flows.find(*it);
+    if (flow->second.seen == m_round) break;
+    m_gone.push_back(&*flow);
+  }
+
+  {
+    unique_lock<shared_mutex> lock(m_mutex);
+    m_applied = true;
+    m_ratesVersion = rates.version;
+    m_topologyVersion = interfaces.topology_version;
+    m_bindingsVersion = interfaces.bindings_version;
+    for (auto* flow : m_gone) {
+      detach(flow->first, flow->second);
+      m_flowEdges.erase(flow->first);
+    }
+    for (auto* flow : m_moved) {
+      detach(flow->first, flow->second);
+      attach(flow->first, flow->second);
+    }
+    for (auto* flow : m_rated) {
+      FlowEntry& entry = flow->second;
+      for (uint8_t i = 0; i < entry.edge_count; i++) {
+        *entry.edges[i].rate = entry.next_rate;
+        entry.edges[i].flows->rate += entry.next_rate - entry.rate;
+      }
+      entry.rate = entry.next_rate;
+    }
+  }
+
+  for (auto* flow : m_gone) {
+    auto order = flow->second.order;
+    m_flows.erase(*order);
+    m_order.erase(order);
+  }
+}
+
+bool FlowPathCorrelator::flowsOnEdge(uint64_t edgeId, vector<FlowOnEdge>& out, size_t limit) const {
+  out.clear();
+  auto byRate = [](const FlowOnEdge& a, const FlowOnEdge& b) { return a.rate > b.rate; };
+  shared_lock<shared_mutex> lock(m_mutex);
+  auto it = m_edges.find(edgeId);
+  if (it == m_edges.end()) {
+    return false;
+  }
+  const auto& flows = it->second.flows;
+  if (limit == 0 || limit >= flows.size()) {
+    out.reserve(flows.size());
+    for (const auto& [key, rate] : flows) {
+      out.push_back(FlowOnEdge{ key, rate });
+    }
+    lock.unlock();
+    sort(out.begin(), out.end(), byRate);
+    return true;
+  }
+  // Top `limit` through a min-heap (by rate) of that size.
+  out.reserve(limit);
+  for (const auto& [key, rate] : flows) {
+    if (out.size() < limit) {
+      out.push_back(FlowOnEdge{ key, rate });
+      push_heap(out.begin(), out.end(), byRate);
+    } else if (rate > out.front().rate) {
+      pop_heap(out.begin(), out.end(), byRate);
+      out.back() = FlowOnEdge{ key, rate };
+      push_heap(out.begin(), out.end(), byRate);
+    }
+  }
+  lock.unlock();
+  sort_heap(out.begin(), out.end(), byRate);
+  return true;
+}
+
+EdgeLoad FlowPathCorrelator::edgeLoad(uint64_t edgeId) const {
+  shared_lock<shared_mutex> lock(m_mutex);
+  EdgeLoad load;
+  auto it = m_edges.find(edgeId);
+  if (it != m_edges.end()) {
+    load.rate = it->second.rate;
+    load.flows = uint32_t(it->second.flows.size());
+  }
+  return load;
+}
+
+bool FlowPathCorrelator::edgesOfFlow(const FlowKey& key, vector<uint64_t>& out) const {
+  out.clear();
+  shared_lock<shared_mutex> lock(m_mutex);
+  auto it = m_flowEdges.find(key);
+  if (it == m_flowEdges.end()) {
+    return false;
+  }
+  out.assign(it->second.ids.begin(), it->second.ids.begin() + it->second.count);
+  return true;
+}
+
+uint64_t FlowPathCorrelator::ratesVersion() const {
+  shared_lock<shared_mutex> lock(m_mutex);
+  return m_ratesVersion;
+}
+
+uint64_t FlowPathCorrelator::topologyVersion() const {
+  shared_lock<shared_mutex> lock(m_mutex);
+  return m_topologyVersion;
+}
+
+} // namespace sflow
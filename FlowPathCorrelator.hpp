@@ -0,0 +1,129 @@
+#ifndef FLOW_PATH_CORRELATOR_HPP
+#define FLOW_PATH_CORRELATOR_HPP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "FlowTable.hpp"
+#include "LinkUtilization.hpp"
+#include "RateSnapshot.hpp"
+
+namespace sflow {
+
+  struct FlowOnEdge {
+    FlowKey key;
+    uint64_t rate = 0;  // estimated flow sending rate, bits/s
+  };
+
+  struct EdgeLoad {
+    uint64_t rate = 0;   // sum of the rates of the flows on the edge
+    uint32_t flows = 0;
+  };
+
+  // Maps every active flow onto the topology links it was sampled on and
+  // keeps, per link, the set of flows loading it. A flow hop (agent,
+  // ifIndex) is the ingress port the packet was sampled at, which the
+  // InterfaceMap resolves to a link (edge_id).
+  //
+  // update() is incremental: flows are re-resolved only when they are new,
+  // their hops changed or the interface map changed (a new topology
+  // version or reloaded bindings); otherwise only their rates move. Flows
+  // missing from a rate snapshot (idle during the interval, or expired)
+  // leave their links; they are found at the tail of a most-recently-seen
+  // list rather than by scanning every flow. All of that is worked out
+  // without the lock, which update() only takes to apply the resulting
+  // per-link changes. Queries take a shared lock and touch only the
+  // requested link or flow.
+  class FlowPathCorrelator {
+  public:
+    // agentAddress: resolves the agent ids used in HopIds, e.g.
+    // SFlowCollector::agentAddress.
+    explicit FlowPathCorrelator(std::function<IpAddress(uint32_t)> agentAddress);
+
+    // Applies a new roll-up and/or interface map (new topology or new
+    // bindings); does nothing if all were already applied. Not thread-safe
+    // against itself.
+    void update(const RateSnapshot& rates, const InterfaceMap& interfaces);
+
+    // Flows on a link, highest rate first; at most `limit` if non-zero.
+    // Returns false if no active flow is known on the link.
+    bool flowsOnEdge(uint64_t edgeId, std::vector<FlowOnEdge>& out, size_t limit = 0) const;
+    EdgeLoad edgeLoad(uint64_t edgeId) const;
+    // Links a flow was resolved to; false if the flow is not active.
+    bool edgesOfFlow(const FlowKey& key, std::vector<uint64_t>& out) const;
+
+    uint64_t ratesVersion() const;
+    uint64_t topologyVersion() const;
+
+  private:
+    struct EdgeFlows {
+      uint64_t rate = 0;
+      std::unordered_map<FlowKey, uint64_t, FlowKeyHash> flows;
+    };
+
+    // Where a flow is recorded on one of its links. unordered_map nodes do
+    // not move, so rate-only updates go through these pointers without any
+    // lookup; an EdgeFlows is only erased once its last flow detached.
+    struct EdgeRef {
+      uint64_t id;
+      EdgeFlows* flows;
+      uint64_t* rate;  // this flow's entry in flows->flows
+    };
+
+    struct FlowEdges {
+      uint8_t count = 0;
+      std::array<uint64_t, MAX_FLOW_HOPS> ids{};
+    };
+
+    // The updater's view of a flow: what is applied to m_edges, and what
+    // the snapshot being applied changes about it.
+    struct FlowEntry {
+      uint64_t rate = 0;
+      uint64_t seen = 0;  // update round the flow was last in a snapshot
+      uint8_t hop_count = 0;
+      std::array<HopId, MAX_FLOW_HOPS> hops{};
+      uint8_t edge_count = 0;
+      std::array<EdgeRef, MAX_FLOW_HOPS> edges{};
+      uint64_t next_rate = 0;
+      FlowEdges next_edges;  // set when the flow is (re-)resolved
+      std::list<FlowKey>::iterator order;  // in m_order
+    };
+    using FlowMap = std::unordered_map<FlowKey, FlowEntry, FlowKeyHash>;
+
+    uint64_t edgeOfHop(HopId hop, const InterfaceMap& interfaces);
+    void resolve(FlowEntry& entry, const FlowRate& flow, const InterfaceMap& interfaces);
+    void attach(const FlowKey& key, FlowEntry& entry);
+    void detach(const FlowKey& key, FlowEntry& entry);
+
+    std::function<IpAddress(uint32_t)> m_agentAddress;
+
+    // Read by queries, written by update() under the exclusive lock.
+    mutable std::shared_mutex m_mutex;
+    bool m_applied = false;
+    uint64_t m_ratesVersion = 0;
+    uint64_t m_topologyVersion = 0;
+    uint64_t m_bindingsVersion = 0;
+    std::unordered_map<uint64_t, EdgeFlows> m_edges;
+    std::unordered_map<FlowKey, FlowEdges, FlowKeyHash> m_flowEdges;
+
+    // update()'s own state, never touched by queries.
+    uint64_t m_round = 0;
+    FlowMap m_flows;
+    // active flows, most recently seen first
+    std::list<FlowKey> m_order;
+    // HopId -> edge_id (0: not a known link) for the current topology
+    std::unordered_map<HopId, uint64_t> m_hopEdges;
+    // changes of the round being applied
+    std::vector<FlowMap::value_type*> m_moved;  // new or re-resolved
+    std::vector<FlowMap::value_type*> m_rated;  // same links, new rate
+    std::vector<FlowMap::value_type*> m_gone;
+  };
+
+} // namespace sflow
+
+#endif // FLOW_PATH_CORRELATOR_HPP
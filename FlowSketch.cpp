@@ -0,0 +1,224 @@
+#include "FlowSketch.hpp"
+
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace sflow {
+
+namespace {
+
+void maskPrefix(array<uint8_t, 16>& bytes, uint8_t length) {
+  for (uint8_t& byte : bytes) {
+    if (length >= 8) {
+      length -= 8;
+    } else {
+      byte &= uint8_t(0xff00 >> length);
+      length = 0;
+    }
+  }
+}
+
+uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+AggregateKey prefixKey(AggregateKind kind, uint8_t ipVersion,
+                       const array<uint8_t, 16>& address, uint8_t length) {
+  AggregateKey key;
+  key.kind = kind;
+  key.ip_version = ipVersion;
+  key.prefix_length = min<uint8_t>(length, ipVersion == 6 ? 128 : 32);
+  key.prefix = address;
+  maskPrefix(key.prefix, key.prefix_length);
+  return key;
+}
+
+}  // namespace
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth)
+    : m_width(1), m_depth(max<size_t>(1, depth)) {
+  while (m_width < width) m_width <<= 1;
+  m_counters.assign(m_width * m_depth, 0);
+}
+
+uint64_t CountMinSketch::add(uint64_t hash, uint32_t weight) {
+  // Conservative update: raise each counter only as far as the new
+  // estimate, which keeps the estimate an upper bound but adds far less
+  // noise to the keys sharing those counters.
+  uint64_t target = estimate(hash) + weight;
+  uint32_t value = uint32_t(min<uint64_t>(target, numeric_limits<uint32_t>::max()));
+  for (size_t row = 0; row < m_depth; row++) {
+    uint32_t& counter = m_counters[cell(hash, row)];
+    counter = max(counter, value);
+  }
+  return value;
+}
+
+uint64_t CountMinSketch::estimate(uint64_t hash) const {
+  uint32_t smallest = numeric_limits<uint32_t>::max();
+  for (size_t row = 0; row < m_depth; row++) {
+    smallest = min(smallest, m_counters[cell(hash, row)]);
+  }
+  return smallest;
+}
+
+void CountMinSketch::merge(const CountMinSketch& other) {
+  for (size_t i = 0; i < m_counters.size(); i++) {
+    uint64_t sum = uint64_t(m_counters[i]) + other.m_counters[i];
+    m_counters[i] = uint32_t(min<uint64_t>(sum, numeric_limits<uint32_t>::max()));
+  }
+}
+
+void CountMinSketch::clear() {
+  fill(m_counters.begin(), m_counters.end(), 0);
+}
+
+AggregateKey AggregateKey::srcPrefix(const FlowKey& flow, uint8_t length) {
+  return prefixKey(AggregateKind::SRC_PREFIX, flow.ip_version, flow.src_ip, length);
+}
+
+AggregateKey AggregateKey::dstPrefix(const FlowKey& flow, uint8_t length) {
+  return prefixKey(AggregateKind::DST_PREFIX, flow.ip_version, flow.dst_ip, length);
+}
+
+AggregateKey AggregateKey::dstPort(const FlowKey& flow) {
+  AggregateKey key;
+  key.kind = AggregateKind::DST_PORT;
+  key.port = flow.dst_port;
+  key.protocol = flow.protocol;
+  return key;
+}
+
+string AggregateKey::toString() const {
+  if (kind == AggregateKind::DST_PORT) {
+    return "dst port " + to_string(port);
+  }
+  IpAddress address;
+  address.version = ip_version;
+  address.bytes = prefix;
+  return string(kind == AggregateKind::SRC_PREFIX ? "src " : "dst ") +
+         address.toString() + "/" + to_string(prefix_length);
+}
+
+// Fully mixed, since CountMinSketch derives its row hashes from both
+// halves.
+size_t AggregateKeyHash::operator()(const AggregateKey& key) const {
+  uint64_t words[3];
+  memcpy(words, &key, sizeof(words));
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
+  for (uint64_t w : words) {
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 29;
+  }
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return size_t(h);
+}
+
+void FlowHops::add(HopId id, uint32_t count) {
+  for (uint8_t i = 0; i < hop_count; i++) {
+    if (ids[i] == id) {
+      bytes[i] += count;
+      return;
+    }
+  }
+  if (hop_count == MAX_FLOW_HOPS) return;
+  ids[hop_count] = id;
+  bytes[hop_count++] = count;
+}
+
+void FlowHops::merge(const FlowHops& other) {
+  for (uint8_t i = 0; i < other.hop_count; i++) {
+    add(other.ids[i], other.bytes[i]);
+  }
+}
+
+SketchLayout SketchLayout::forBudget(size_t budgetBytes, uint8_t ipv4Prefix,
+                                     uint8_t ipv6Prefix) {
+  SketchLayout layout;
+  layout.ipv4_prefix = ipv4Prefix;
+  layout.ipv6_prefix = ipv6Prefix;
+  layout.flows = max<size_t>(16, TrafficSummary::FlowCounter::capacityFor(budgetBytes * 3 / 8));
+  layout.aggregates = max<size_t>(
+      16, TrafficSummary::AggregateCounter::capacityFor(budgetBytes / 8 / AGGREGATE_KINDS));
+  layout.sketch_depth = 4;
+  // four sketches of the same width
+  size_t sketchBytes = budgetBytes / 2 / (AGGREGATE_KINDS + 1);
+  layout.sketch_width = 64;
+  while (layout.sketch_width * 2 * layout.sketch_depth * sizeof(uint32_t) <= sketchBytes) {
+    layout.sketch_width *= 2;
+  }
+  return layout;
+}
+
+TrafficSummary::TrafficSummary(const SketchLayout& layout)
+    : m_layout(layout),
+      m_flows(layout.flows),
+      m_flowSketch(layout.sketch_width, layout.sketch_depth) {
+  for (int kind = 0; kind < AGGREGATE_KINDS; kind++) {
+    m_aggregates.emplace_back(layout.aggregates);
+    m_sketches.emplace_back(layout.sketch_width, layout.sketch_depth);
+  }
+}
+
+void TrafficSummary::add(const FlowKey& key, HopId hop, uint32_t bytes) {
+  m_totalBytes += bytes;
+  uint64_t flowHash = mix(FlowKeyHash{}(key));
+  if (auto* entry = m_flows.add(key, bytes, m_flowSketch.add(flowHash, bytes))) {
+    entry->detail.add(hop, bytes);
+  }
+  uint8_t prefix = key.ip_version == 6 ? m_layout.ipv6_prefix : m_layout.ipv4_prefix;
+  const AggregateKey aggregates[AGGREGATE_KINDS] = {
+    AggregateKey::srcPrefix(key, prefix),
+    AggregateKey::dstPrefix(key, prefix),
+    AggregateKey::dstPort(key),
+  };
+  for (const AggregateKey& aggregate : aggregates) {
+    size_t kind = size_t(aggregate.kind);
+    uint64_t hash = AggregateKeyHash{}(aggregate);
+    m_aggregates[kind].add(aggregate, bytes, m_sketches[kind].add(hash, bytes));
+  }
+}
+
+void TrafficSummary::merge(const TrafficSummary& other) {
+  m_totalBytes += other.m_totalBytes;
+  m_flows.merge(other.m_flows);
+  m_flowSketch.merge(other.m_flowSketch);
+  for (size_t kind = 0; kind < m_sketches.size(); kind++) {
+    m_aggregates[kind].merge(other.m_aggregates[kind]);
+    m_sketches[kind].merge(other.m_sketches[kind]);
+  }
+}
+
+void TrafficSummary::clear() {
+  m_totalBytes = 0;
+  m_flows.clear();
+  m_flowSketch.clear();
+  for (size_t kind = 0; kind < m_sketches.size(); kind++) {
+    m_aggregates[kind].clear();
+    m_sketches[kind].clear();
+  }
+}
+
+// The sketch and the tracked counts both bound the true total from above;
+// whichever is tighter wins.
+uint64_t TrafficSummary::estimate(const AggregateKey& key) const {
+  size_t kind = size_t(key.kind);
+  return min(m_sketches[kind].estimate(AggregateKeyHash{}(key)),
+             m_aggregates[kind].upperBound(key));
+}
+
+size_t TrafficSummary::memoryUsage() const {
+  size_t bytes = m_flows.memoryUsage() + m_flowSketch.memoryUsage();
+  for (size_t kind = 0; kind < m_sketches.size(); kind++) {
+    bytes += m_aggregates[kind].memoryUsage() + m_sketches[kind].memoryUsage();
+  }
+  return bytes;
+}
+
+}  // namespace sflow
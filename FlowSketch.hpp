@@ -0,0 +1,463 @@
+#ifndef FLOW_SKETCH_HPP
+#define FLOW_SKETCH_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "FlowTable.hpp"
+
+namespace sflow {
+
+  // Bounded top-K counter (SpaceSaving, Metwally et al.). At most capacity()
+  // keys are tracked; an untracked key arriving while all slots are taken
+  // replaces the key with the smallest count, inheriting that count as its
+  // error. A tracked count overestimates the key's true total by at most its
+  // `error`, an untracked key's total is at most minCount(), and every key
+  // whose total exceeds (sum of weights) / capacity() is tracked.
+  //
+  // Entries, a min-heap over their counts and an open-addressing index are
+  // allocated up front, so memory does not depend on how many distinct keys
+  // are seen. `Detail` is per-key payload stored with the count; it needs
+  // clear() and merge(const Detail&), and is cleared when its slot changes
+  // key.
+  template <typename Key, typename Hash, typename Detail>
+  class SpaceSaving {
+  public:
+    struct Entry {
+      Key key;
+      uint64_t count = 0;
+      uint64_t error = 0;
+      Detail detail;
+    };
+
+    explicit SpaceSaving(std::size_t capacity);
+
+    // Adds `weight` to `key` and returns its entry. `bound` is an upper
+    // bound of the key's total including `weight`, e.g. from a
+    // CountMinSketch. While full, a key whose bound does not exceed
+    // minCount() is left alone (returns nullptr), since the guarantees
+    // above already hold for it. That filter spares the index lookup and
+    // the slot churn for the many small keys of a scan or flood.
+    Entry* add(const Key& key, uint64_t weight, uint64_t bound = UINT64_MAX);
+    const Entry* find(const Key& key) const;
+
+    // Folds in `other` (mergeable summaries, Agarwal et al.): a key tracked
+    // by only one side is charged the other side's minCount(), which it may
+    // have had there, and the capacity() largest results are kept. The
+    // guarantees above then hold for the combined stream.
+    void merge(const SpaceSaving& other);
+    void clear();
+
+    std::size_t size() const { return m_entries.size(); }
+    std::size_t capacity() const { return m_capacity; }
+    bool full() const { return m_entries.size() == m_capacity; }
+    uint64_t minCount() const { return m_heap.empty() ? 0 : m_entries[m_heap[0]].count; }
+    // Upper bound of the total of `key`, tracked or not.
+    uint64_t upperBound(const Key& key) const {
+      const Entry* entry = find(key);
+      return entry ? entry->count : full() ? minCount() : 0;
+    }
+
+    const std::vector<Entry>& entries() const { return m_entries; }
+    // The `n` largest entries, largest count first.
+    std::vector<const Entry*> top(std::size_t n) const;
+
+    std::size_t memoryUsage() const { return memoryFor(m_capacity); }
+    static std::size_t memoryFor(std::size_t capacity) {
+      return capacity * (sizeof(Entry) + 3 * sizeof(uint32_t)) +
+             indexSizeFor(capacity) * sizeof(uint32_t);
+    }
+    // Largest capacity that fits in `bytes` (at least 1).
+    static std::size_t capacityFor(std::size_t bytes);
+
+  private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    // index slots for `capacity` entries, at most half full
+    static std::size_t indexSizeFor(std::size_t capacity) {
+      std::size_t size = 16;
+      while (size < capacity * 2) size <<= 1;
+      return size;
+    }
+
+    uint32_t hashOf(const Key& key) const { return uint32_t(Hash{}(key)); }
+    std::size_t slotOf(const Key& key, uint32_t hash) const;
+    void index(uint32_t entry);
+    void unindex(uint32_t entry);
+    bool less(uint32_t a, uint32_t b) const {
+      return m_entries[m_heap[a]].count < m_entries[m_heap[b]].count;
+    }
+    void swapHeap(uint32_t a, uint32_t b);
+    void siftUp(uint32_t pos);
+    void siftDown(uint32_t pos);
+    void rebuild();
+
+    std::size_t m_capacity;
+    std::size_t m_mask;
+    std::vector<Entry> m_entries;
+    std::vector<uint32_t> m_hashes;   // per entry
+    std::vector<uint32_t> m_heap;     // entries, smallest count first
+    std::vector<uint32_t> m_heapPos;  // per entry, its position in m_heap
+    std::vector<uint32_t> m_index;    // entry per slot, EMPTY if none
+  };
+
+  // Count-Min sketch (Cormode and Muthukrishnan) with conservative update:
+  // `depth` rows of `width` counters, a key maps to one counter per row and
+  // its estimate is the smallest of them, which never underestimates.
+  // Counters saturate at UINT32_MAX. Sketches of equal dimensions merge by
+  // adding counters.
+  class CountMinSketch {
+  public:
+    // `width` is rounded up to a power of two.
+    CountMinSketch(std::size_t width, std::size_t depth);
+
+    // `hash` must be a well-mixed 64-bit hash of the key. Returns the new
+    // estimate of the key.
+    uint64_t add(uint64_t hash, uint32_t weight);
+    uint64_t estimate(uint64_t hash) const;
+    void merge(const CountMinSketch& other);
+    void clear();
+
+    std::size_t width() const { return m_width; }
+    std::size_t depth() const { return m_depth; }
+    std::size_t memoryUsage() const { return m_counters.size() * sizeof(uint32_t); }
+
+  private:
+    // Row hashes from the two halves of one hash (Kirsch and Mitzenmacher).
+    std::size_t cell(uint64_t hash, std::size_t row) const {
+      uint32_t h1 = uint32_t(hash);
+      uint32_t h2 = uint32_t(hash >> 32) | 1u;
+      return row * m_width + ((h1 + uint32_t(row) * h2) & (m_width - 1));
+    }
+
+    std::size_t m_width;
+    std::size_t m_depth;
+    std::vector<uint32_t> m_counters;
+  };
+
+  enum class AggregateKind : uint8_t {
+    SRC_PREFIX,
+    DST_PREFIX,
+    DST_PORT,
+  };
+#define AGGREGATE_KINDS 3
+
+  // Coarse traffic key: a source or destination prefix, or a destination
+  // port. Packed like FlowKey so keys compare and hash bytewise.
+  struct AggregateKey {
+    std::array<uint8_t, 16> prefix{};  // masked address, prefix kinds only
+    uint16_t port = 0;                 // DST_PORT only
+    AggregateKind kind = AggregateKind::SRC_PREFIX;
+    uint8_t ip_version = 0;            // prefix kinds only
+    uint8_t prefix_length = 0;         // prefix kinds only
+    uint8_t protocol = 0;              // DST_PORT only
+    uint8_t reserved[2]{};
+
+    bool operator==(const AggregateKey&) const = default;
+
+    static AggregateKey srcPrefix(const FlowKey& flow, uint8_t length);
+    static AggregateKey dstPrefix(const FlowKey& flow, uint8_t length);
+    static AggregateKey dstPort(const FlowKey& flow);
+
+    // "src 10.0.3.0/24", "dst port 443"; only meant for printing and export.
+    std::string toString() const;
+  };
+  static_assert(sizeof(AggregateKey) == 24, "AggregateKey must stay packed");
+
+  struct AggregateKeyHash {
+    std::size_t operator()(const AggregateKey& key) const;
+  };
+
+  // Sampled bytes per observation point of one tracked flow.
+  struct FlowHops {
+    uint8_t hop_count = 0;
+    std::array<HopId, MAX_FLOW_HOPS> ids;
+    std::array<uint32_t, MAX_FLOW_HOPS> bytes;
+
+    // Hops beyond MAX_FLOW_HOPS are not recorded, as in FlowInfo.
+    void add(HopId id, uint32_t count);
+    void merge(const FlowHops& other);
+    void clear() { hop_count = 0; }
+  };
+
+  struct NoDetail {
+    void merge(const NoDetail&) {}
+    void clear() {}
+  };
+
+  // Sizes of the parts of a TrafficSummary.
+  struct SketchLayout {
+    std::size_t flows = 0;       // tracked flows
+    std::size_t aggregates = 0;  // tracked prefixes or ports, per AggregateKind
+    std::size_t sketch_width = 0;
+    std::size_t sketch_depth = 0;
+    uint8_t ipv4_prefix = 24;
+    uint8_t ipv6_prefix = 64;
+
+    // Splits `budgetBytes` for one summary: 3/8 for the tracked flows and
+    // 1/8 for their sketch, 3/8 for the aggregate sketches and 1/8 for the
+    // tracked aggregates.
+    static SketchLayout forBudget(std::size_t budgetBytes, uint8_t ipv4Prefix,
+                                  uint8_t ipv6Prefix);
+  };
+
+  // One roll-up interval of flow samples in fixed memory. The heaviest flows
+  // are tracked with their bytes per hop (SpaceSaving). Everything is also
+  // counted per source prefix, destination prefix and destination port, each
+  // in a Count-Min sketch that answers for any key and a SpaceSaving that
+  // knows the heaviest keys, so they can be listed. Each SpaceSaving only
+  // takes in keys its sketch says may be heavy (flows have a sketch of
+  // their own for that).
+  //
+  // Counts are sampled bytes summed over every point a flow was sampled at,
+  // like the hops of a FlowInfo. Summaries with the same layout merge, so
+  // each receive worker fills its own and the roll-up adds them up.
+  class TrafficSummary {
+  public:
+    using FlowCounter = SpaceSaving<FlowKey, FlowKeyHash, FlowHops>;
+    using AggregateCounter = SpaceSaving<AggregateKey, AggregateKeyHash, NoDetail>;
+
+    explicit TrafficSummary(const SketchLayout& layout);
+
+    void add(const FlowKey& key, HopId hop, uint32_t bytes);
+    void merge(const TrafficSummary& other);
+    void clear();
+
+    // Upper bound of the sampled bytes of `key` in the interval.
+    uint64_t estimate(const AggregateKey& key) const;
+
+    const FlowCounter& flows() const { return m_flows; }
+    const AggregateCounter& aggregates(AggregateKind kind) const {
+      return m_aggregates[size_t(kind)];
+    }
+    uint64_t totalBytes() const { return m_totalBytes; }
+    const SketchLayout& layout() const { return m_layout; }
+    std::size_t memoryUsage() const;
+
+  private:
+    SketchLayout m_layout;
+    FlowCounter m_flows;
+    CountMinSketch m_flowSketch;
+    std::vector<AggregateCounter> m_aggregates;  // by AggregateKind
+    std::vector<CountMinSketch> m_sketches;      // by AggregateKind
+    uint64_t m_totalBytes = 0;
+  };
+
+  template <typename Key, typename Hash, typename Detail>
+  SpaceSaving<Key, Hash, Detail>::SpaceSaving(std::size_t capacity)
+      : m_capacity(std::max<std::size_t>(1, capacity)) {
+    std::size_t indexSize = indexSizeFor(m_capacity);
+    m_mask = indexSize - 1;
+    m_entries.reserve(m_capacity);
+    m_hashes.reserve(m_capacity);
+    m_heap.reserve(m_capacity);
+    m_heapPos.reserve(m_capacity);
+    m_index.assign(indexSize, EMPTY);
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  std::size_t SpaceSaving<Key, Hash, Detail>::capacityFor(std::size_t bytes) {
+    std::size_t capacity = std::max<std::size_t>(
+        1, bytes / (sizeof(Entry) + 3 * sizeof(uint32_t) + 2 * sizeof(uint32_t)));
+    while (capacity > 1 && memoryFor(capacity) > bytes) {
+      capacity = capacity * 3 / 4;
+    }
+    return capacity;
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  std::size_t SpaceSaving<Key, Hash, Detail>::slotOf(const Key& key, uint32_t hash) const {
+    std::size_t i = hash & m_mask;
+    while (m_index[i] != EMPTY) {
+      uint32_t entry = m_index[i];
+      if (m_hashes[entry] == hash && m_entries[entry].key == key) break;
+      i = (i + 1) & m_mask;
+    }
+    return i;
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  const typename SpaceSaving<Key, Hash, Detail>::Entry*
+  SpaceSaving<Key, Hash, Detail>::find(const Key& key) const {
+    std::size_t i = slotOf(key, hashOf(key));
+    return m_index[i] == EMPTY ? nullptr : &m_entries[m_index[i]];
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::index(uint32_t entry) {
+    std::size_t i = m_hashes[entry] & m_mask;
+    while (m_index[i] != EMPTY) i = (i + 1) & m_mask;
+    m_index[i] = entry;
+  }
+
+  // Backward-shift deletion keeps every probe chain intact without
+  // tombstones.
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::unindex(uint32_t entry) {
+    std::size_t i = m_hashes[entry] & m_mask;
+    while (m_index[i] != entry) i = (i + 1) & m_mask;
+    for (std::size_t j = (i + 1) & m_mask; m_index[j] != EMPTY; j = (j + 1) & m_mask) {
+      std::size_t home = m_hashes[m_index[j]] & m_mask;
+      // The entry at j may move into the hole unless its home lies
+      // cyclically in (i, j].
+      bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+      if (!stays) {
+        m_index[i] = m_index[j];
+        i = j;
+      }
+    }
+    m_index[i] = EMPTY;
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::swapHeap(uint32_t a, uint32_t b) {
+    std::swap(m_heap[a], m_heap[b]);
+    m_heapPos[m_heap[a]] = a;
+    m_heapPos[m_heap[b]] = b;
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::siftUp(uint32_t pos) {
+    while (pos > 0) {
+      uint32_t parent = (pos - 1) / 2;
+      if (!less(pos, parent)) break;
+      swapHeap(pos, parent);
+      pos = parent;
+    }
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::siftDown(uint32_t pos) {
+    uint32_t n = uint32_t(m_heap.size());
+    for (;;) {
+      uint32_t smallest = pos;
+      uint32_t left = 2 * pos + 1;
+      if (left < n && less(left, smallest)) smallest = left;
+      if (left + 1 < n && less(left + 1, smallest)) smallest = left + 1;
+      if (smallest == pos) break;
+      swapHeap(pos, smallest);
+      pos = smallest;
+    }
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  typename SpaceSaving<Key, Hash, Detail>::Entry*
+  SpaceSaving<Key, Hash, Detail>::add(const Key& key, uint64_t weight, uint64_t bound) {
+    if (full() && bound <= minCount()) {
+      return nullptr;
+    }
+    uint32_t hash = hashOf(key);
+    std::size_t i = slotOf(key, hash);
+    if (m_index[i] != EMPTY) {
+      uint32_t entry = m_index[i];
+      m_entries[entry].count += weight;
+      siftDown(m_heapPos[entry]);
+      return &m_entries[entry];
+    }
+    if (!full()) {
+      uint32_t entry = uint32_t(m_entries.size());
+      Entry& added = m_entries.emplace_back();
+      added.key = key;
+      added.count = weight;
+      m_hashes.push_back(hash);
+      m_index[i] = entry;
+      m_heapPos.push_back(uint32_t(m_heap.size()));
+      m_heap.push_back(entry);
+      siftUp(m_heapPos[entry]);
+      return &added;
+    }
+    // Take over the smallest count. Before this sample the key had at most
+    // that count, and at most `bound` in any case.
+    uint32_t entry = m_heap[0];
+    unindex(entry);
+    Entry& taken = m_entries[entry];
+    taken.key = key;
+    uint64_t count = std::min(taken.count + weight, std::max(bound, weight));
+    taken.error = count - weight;
+    taken.count = count;
+    taken.detail.clear();
+    m_hashes[entry] = hash;
+    index(entry);
+    siftDown(0);
+    return &taken;
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::merge(const SpaceSaving& other) {
+    uint64_t ownMin = full() ? minCount() : 0;
+    uint64_t otherMin = other.full() ? other.minCount() : 0;
+    std::vector<Entry> merged;
+    merged.reserve(m_entries.size() + other.m_entries.size());
+    for (const Entry& own : m_entries) {
+      Entry& entry = merged.emplace_back(own);
+      if (const Entry* theirs = other.find(own.key)) {
+        entry.count += theirs->count;
+        entry.error += theirs->error;
+        entry.detail.merge(theirs->detail);
+      } else {
+        entry.count += otherMin;
+        entry.error += otherMin;
+      }
+    }
+    for (const Entry& theirs : other.m_entries) {
+      if (find(theirs.key)) continue;
+      Entry& entry = merged.emplace_back(theirs);
+      entry.count += ownMin;
+      entry.error += ownMin;
+    }
+    if (merged.size() > m_capacity) {
+      std::nth_element(merged.begin(), merged.begin() + m_capacity, merged.end(),
+                       [](const Entry& a, const Entry& b) { return a.count > b.count; });
+      merged.resize(m_capacity);
+    }
+    m_entries.clear();
+    m_entries.insert(m_entries.end(), merged.begin(), merged.end());
+    rebuild();
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::rebuild() {
+    std::fill(m_index.begin(), m_index.end(), EMPTY);
+    m_hashes.clear();
+    m_heap.clear();
+    m_heapPos.clear();
+    for (uint32_t entry = 0; entry < m_entries.size(); entry++) {
+      m_hashes.push_back(hashOf(m_entries[entry].key));
+      index(entry);
+      m_heap.push_back(entry);
+      m_heapPos.push_back(entry);
+    }
+    for (uint32_t pos = uint32_t(m_heap.size() / 2); pos-- > 0;) {
+      siftDown(pos);
+    }
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  void SpaceSaving<Key, Hash, Detail>::clear() {
+    m_entries.clear();
+    m_hashes.clear();
+    m_heap.clear();
+    m_heapPos.clear();
+    std::fill(m_index.begin(), m_index.end(), EMPTY);
+  }
+
+  template <typename Key, typename Hash, typename Detail>
+  std::vector<const typename SpaceSaving<Key, Hash, Detail>::Entry*>
+  SpaceSaving<Key, Hash, Detail>::top(std::size_t n) const {
+    std::vector<const Entry*> out;
+    out.reserve(m_entries.size());
+    for (const Entry& entry : m_entries) out.push_back(&entry);
+    n = std::min(n, out.size());
+    std::partial_sort(out.begin(), out.begin() + n, out.end(),
+                      [](const Entry* a, const Entry* b) { return a->count > b->count; });
+    out.resize(n);
+    return out;
+  }
+
+} // namespace sflow
+
+#endif // FLOW_SKETCH_HPP
@@ -0,0 +1,160 @@
+#include "FlowTable.hpp"
+#include "SFlowDecoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace sflow {
+
+FlowKey FlowKey::fromSample(const FlowSample& flow) {
+  FlowKey key;
+  key.src_ip = flow.src_ip.bytes;
+  key.dst_ip = flow.dst_ip.bytes;
+  key.src_port = flow.src_port;
+  key.dst_port = flow.dst_port;
+  key.protocol = flow.ip_protocol;
+  key.ip_version = flow.src_ip.version;
+  return key;
+}
+
+IpAddress FlowKey::srcAddress() const {
+  IpAddress addr;
+  addr.version = ip_version;
+  addr.bytes = src_ip;
+  return addr;
+}
+
+IpAddress FlowKey::dstAddress() const {
+  IpAddress addr;
+  addr.version = ip_version;
+  addr.bytes = dst_ip;
+  return addr;
+}
+
+string FlowKey::toString() const {
+  return srcAddress().toString() + ":" + to_string(src_port) + " → " +
+         dstAddress().toString() + ":" + to_string(dst_port);
+}
+
+size_t FlowKeyHash::operator()(const FlowKey& key) const {
+  uint64_t words[5];
+  memcpy(words, &key, sizeof(words));
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
+  for (uint64_t w : words) {
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 29;
+  }
+  return size_t(h ^ (h >> 32));
+}
+
+FlowTable::FlowTable(size_t initialCapacity) {
+  size_t capacity = 16;
+  while (capacity < initialCapacity) capacity <<= 1;
+  m_tags.assign(capacity, 0);
+  m_entries.resize(capacity);
+  m_mask = capacity - 1;
+}
+
+size_t FlowTable::locate(const FlowKey& key, uint32_t tag, size_t hash) const {
+  size_t i = hash & m_mask;
+  while (m_tags[i]) {
+    if (m_tags[i] == tag && m_entries[i].key == key) break;
+    i = (i + 1) & m_mask;
+  }
+  return i;
+}
+
+FlowInfo* FlowTable::find(const FlowKey& key) {
+  size_t hash = FlowKeyHash{}(key);
+  size_t i = locate(key, tagOf(hash), hash);
+  return m_tags[i] ? &m_entries[i] : nullptr;
+}
+
+FlowInfo& FlowTable::findOrInsert(const FlowKey& key) {
+  size_t hash = FlowKeyHash{}(key);
+  uint32_t tag = tagOf(hash);
+  size_t i = locate(key, tag, hash);
+  if (m_tags[i]) return m_entries[i];
+
+  // Keep the load factor below 0.75 so probe sequences stay short.
+  if ((m_size + 1) * 4 > capacity() * 3) {
+    grow();
+    i = locate(key, tag, hash);
+  }
+  m_tags[i] = tag;
+  m_entries[i] = FlowInfo{};
+  m_entries[i].key = key;
+  m_size++;
+  return m_entries[i];
+}
+
+bool FlowTable::erase(const FlowKey& key) {
+  size_t hash = FlowKeyHash{}(key);
+  size_t i = locate(key, tagOf(hash), hash);
+  if (!m_tags[i]) return false;
+
+  // Backward-shift deletion: pull later entries of the probe run into the
+  // hole so lookups never need tombstones.
+  size_t hole = i;
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & m_mask;
+    if (!m_tags[j]) break;
+    size_t home = FlowKeyHash{}(m_entries[j].key) & m_mask;
+    // Move j into the hole unless its home lies cyclically in (hole, j].
+    bool stays = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+    if (stays) continue;
+    m_tags[hole] = m_tags[j];
+    m_entries[hole] = m_entries[j];
+    hole = j;
+  }
+  m_tags[hole] = 0;
+  m_size--;
+  return true;
+}
+
+void FlowTable::clear() {
+  fill(m_tags.begin(), m_tags.end(), 0);
+  m_size = 0;
+}
+
+void FlowTable::grow() {
+  vector<uint32_t> oldTags = std::move(m_tags);
+  vector<FlowInfo> oldEntries = std::move(m_entries);
+  m_tags.assign(oldTags.size() * 2, 0);
+  m_entries = vector<FlowInfo>(oldEntries.size() * 2);
+  m_mask = m_tags.size() - 1;
+
+  for (size_t i = 0; i < oldTags.size(); i++) {
+    if (!oldTags[i]) continue;
+    size_t j = FlowKeyHash{}(oldEntries[i].key) & m_mask;
+    while (m_tags[j]) j = (j + 1) & m_mask;
+    m_tags[j] = oldTags[i];
+    m_entries[j] = oldEntries[i];
+  }
+}
+
+ExpiryWheel::ExpiryWheel(size_t minSlots) {
+  size_t slots = 2;
+  while (slots < minSlots) slots <<= 1;
+  m_slots.resize(slots);
+  m_mask = slots - 1;
+}
+
+uint32_t AgentRegistry::idOf(const IpAddress& agent) {
+  lock_guard<mutex> lock(m_mutex);
+  auto [it, inserted] = m_ids.try_emplace(agent, uint32_t(m_addresses.size()));
+  if (inserted) {
+    m_addresses.push_back(agent);
+  }
+  return it->second;
+}
+
+IpAddress AgentRegistry::address(uint32_t id) {
+  lock_guard<mutex> lock(m_mutex);
+  return id < m_addresses.size() ? m_addresses[id] : IpAddress{};
+}
+
+}  // namespace sflow
@@ -0,0 +1,172 @@
+#ifndef FLOW_TABLE_HPP
+#define FLOW_TABLE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IpAddress.hpp"
+#include "RateEstimator.hpp"
+
+namespace sflow {
+
+#define MAX_FLOW_HOPS 6
+
+  struct FlowSample;
+
+  // Packed binary 5-tuple. IPv4 addresses use the first 4 bytes of each
+  // address field; the rest stays zero so keys compare and hash bytewise.
+  struct FlowKey {
+    std::array<uint8_t, 16> src_ip{};
+    std::array<uint8_t, 16> dst_ip{};
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    uint8_t protocol = 0;
+    uint8_t ip_version = 0;
+    uint8_t reserved[2]{};
+
+    bool operator==(const FlowKey&) const = default;
+
+    static FlowKey fromSample(const FlowSample& flow);
+
+    IpAddress srcAddress() const;
+    IpAddress dstAddress() const;
+    // "src:port → dst:port", only meant for printing and export.
+    std::string toString() const;
+  };
+  static_assert(sizeof(FlowKey) == 40, "FlowKey must stay packed");
+
+  struct FlowKeyHash {
+    std::size_t operator()(const FlowKey& key) const;
+  };
+
+  // Identifies one observation point of a flow: (agent id << 32) | ifIndex.
+  typedef uint64_t HopId;
+
+  inline HopId makeHopId(uint32_t agentId, uint32_t ifIndex) {
+    return (uint64_t(agentId) << 32) | ifIndex;
+  }
+  inline uint32_t hopAgentId(HopId id) { return uint32_t(id >> 32); }
+  inline uint32_t hopIfIndex(HopId id) { return uint32_t(id); }
+
+  struct FlowStats {
+    // sampled bytes seen within one roll-up interval
+    uint32_t byte_count_current = 0;
+    uint32_t byte_count_previous = 0;
+    uint64_t avg_rate = 0;
+  };
+
+  struct FlowHop {
+    HopId id = 0;
+    FlowStats stats;
+  };
+
+  struct FlowInfo {
+    FlowKey key;
+    uint64_t estimated_flow_sending_rate = 0;
+    // estimated_flow_sending_rate smoothed over time; only maintained in
+    // the collector's table, not in the per-worker deltas
+    RateEstimator rates;
+    // roll-up ticks (seconds) used for aging
+    uint32_t first_seen = 0;
+    uint32_t last_active = 0;
+    uint32_t expiry_tick = 0;  // slot this flow is scheduled in, see ExpiryWheel
+    uint8_t hop_count = 0;
+    // hops the flow was sampled at, in first-seen order
+    std::array<FlowHop, MAX_FLOW_HOPS> hops;
+
+    // Returns the stats of hop `id`, adding it if there is room left.
+    // Returns nullptr once MAX_FLOW_HOPS distinct hops have been seen.
+    FlowStats* hop(HopId id) {
+      for (uint8_t i = 0; i < hop_count; i++) {
+        if (hops[i].id == id) return &hops[i].stats;
+      }
+      if (hop_count == MAX_FLOW_HOPS) return nullptr;
+      hops[hop_count].id = id;
+      return &hops[hop_count++].stats;
+    }
+  };
+
+  // Open-addressing (linear probing) hash table of FlowInfo keyed by FlowKey.
+  // Entries live in one flat array next to a parallel array of 32-bit hash
+  // tags, so a probe touches a few contiguous tags and usually a single
+  // entry. Insertion may rehash and invalidates pointers and references.
+  class FlowTable {
+  public:
+    explicit FlowTable(std::size_t initialCapacity = 1024);
+
+    FlowInfo& findOrInsert(const FlowKey& key);
+    FlowInfo* find(const FlowKey& key);
+    bool erase(const FlowKey& key);
+    // Removes every entry but keeps the allocated capacity.
+    void clear();
+
+    std::size_t size() const { return m_size; }
+    std::size_t capacity() const { return m_entries.size(); }
+    std::size_t memoryUsage() const {
+      return capacity() * (sizeof(FlowInfo) + sizeof(uint32_t));
+    }
+
+    template <typename F>
+    void forEach(F&& f) {
+      for (std::size_t i = 0; i < m_tags.size(); i++) {
+        if (m_tags[i]) f(m_entries[i]);
+      }
+    }
+
+  private:
+    static uint32_t tagOf(std::size_t hash) { return uint32_t(hash >> 32) | 1u; }
+    std::size_t locate(const FlowKey& key, uint32_t tag, std::size_t hash) const;
+    void grow();
+
+    std::vector<uint32_t> m_tags;  // 0 marks an empty slot
+    std::vector<FlowInfo> m_entries;
+    std::size_t m_size = 0;
+    std::size_t m_mask = 0;
+  };
+
+  // Timing wheel with one slot per roll-up tick. Every flow sits in exactly
+  // one slot, the one recorded in FlowInfo::expiry_tick. Activity does not
+  // reschedule a flow; when its slot comes due the owner re-checks it and
+  // either evicts it or moves it to its new deadline. Expiry therefore costs
+  // O(due entries) per tick instead of a table scan. Deadlines must lie
+  // less than slotCount() ticks ahead.
+  class ExpiryWheel {
+  public:
+    explicit ExpiryWheel(std::size_t minSlots);
+
+    void schedule(const FlowKey& key, uint32_t tick) {
+      m_slots[tick & m_mask].push_back(key);
+    }
+    // Moves all keys scheduled at `tick` into `out` (which is cleared).
+    void take(uint32_t tick, std::vector<FlowKey>& out) {
+      out.clear();
+      out.swap(m_slots[tick & m_mask]);
+    }
+    std::size_t slotCount() const { return m_slots.size(); }
+
+  private:
+    std::vector<std::vector<FlowKey>> m_slots;
+    std::size_t m_mask;
+  };
+
+  // Assigns small numeric ids to agent addresses so hops can be stored as
+  // integers. Lookups happen once per datagram.
+  class AgentRegistry {
+  public:
+    uint32_t idOf(const IpAddress& agent);
+    IpAddress address(uint32_t id);
+
+  private:
+    std::mutex m_mutex;
+    std::unordered_map<IpAddress, uint32_t, IpAddressHash> m_ids;
+    std::vector<IpAddress> m_addresses;
+  };
+
+} // namespace sflow
+
+#endif // FLOW_TABLE_HPP
@@ -0,0 +1,326 @@
+#include "HttpClient.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t RX_CHUNK = 16384;
+
+string lower(string s) {
+  transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return char(tolower(c)); });
+  return s;
+}
+
+string trim(const string& s) {
+  size_t b = s.find_first_not_of(" \t");
+  size_t e = s.find_last_not_of(" \t");
+  return b == string::npos ? "" : s.substr(b, e - b + 1);
+}
+
+}  // namespace
+
+int connectTcp(const string& host, const string& port, int timeoutMs) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  int rc = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+  if (rc != 0) {
+    throw runtime_error("cannot resolve " + host + ": " + gai_strerror(rc));
+  }
+
+  timeval timeout{};
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_usec = (timeoutMs % 1000) * 1000;
+  int connected = -1;
+  string lastError = "no address";
+  for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+    int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) continue;
+    // SO_SNDTIMEO also bounds connect() on Linux.
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      connected = fd;
+      break;
+    }
+    lastError = strerror(errno);
+    ::close(fd);
+  }
+  ::freeaddrinfo(result);
+  if (connected < 0) {
+    throw runtime_error("cannot connect to " + host + ":" + port + ": " + lastError);
+  }
+  return connected;
+}
+
+HttpClient::HttpClient(const string& url, int timeoutMs)
+  : m_timeoutMs(timeoutMs), m_rx(RX_CHUNK)
+{
+  const string scheme = "http://";
+  if (url.compare(0, scheme.size(), scheme) != 0) {
+    throw runtime_error("unsupported URL (only http:// is supported): " + url);
+  }
+  size_t hostBegin = scheme.size();
+  size_t pathBegin = url.find('/', hostBegin);
+  string authority = url.substr(hostBegin, pathBegin == string::npos ? string::npos : pathBegin - hostBegin);
+  string path = pathBegin == string::npos ? "/" : url.substr(pathBegin);
+
+  size_t colon = authority.rfind(':');
+  if (colon != string::npos && authority.find(']') == string::npos) {
+    m_host = authority.substr(0, colon);
+    m_port = authority.substr(colon + 1);
+  } else if (colon != string::npos && authority.back() != ']') {
+    m_host = authority.substr(1, authority.find(']') - 1);  // [v6]:port
+    m_port = authority.substr(colon + 1);
+  } else {
+    m_host = authority.front() == '[' ? authority.substr(1, authority.size() - 2) : authority;
+    m_port = "80";
+  }
+  if (m_host.empty()) {
+    throw runtime_error("missing host in URL: " + url);
+  }
+
+  m_request = "GET " + path + " HTTP/1.1\r\nHost: " + authority +
+              "\r\nConnection: keep-alive\r\nAccept: application/json\r\n\r\n";
+}
+
+HttpClient::~HttpClient() { reset(); }
+
+void HttpClient::reset() {
+  disconnect();
+  m_inFlight = 0;
+}
+
+void HttpClient::disconnect() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_rxBegin = m_rxEnd = 0;
+}
+
+void HttpClient::connect() {
+  m_fd = connectTcp(m_host, m_port, m_timeoutMs);
+  m_rxBegin = m_rxEnd = 0;
+}
+
+void HttpClient::sendGet() {
+  if (m_inFlight == 0) {
+    m_reused = m_fd >= 0;
+  }
+  if (m_fd < 0) {
+    connect();
+  }
+  m_inFlight++;
+  try {
+    sendRequest();
+  } catch (...) {
+    reset();
+    throw;
+  }
+}
+
+void HttpClient::sendRequest() {
+  size_t sent = 0;
+  while (sent < m_request.size()) {
+    ssize_t n = ::send(m_fd, m_request.data() + sent, m_request.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      if (m_reused) {
+        // The server closed the idle connection; start over once, with
+        // every request still unanswered (this one included).
+        resend();
+        return;
+      }
+      throw runtime_error("send to " + m_host + " failed: " + strerror(errno));
+    }
+    sent += size_t(n);
+  }
+}
+
+// Sends all unanswered requests again on a new connection. Only done once
+// per batch: a failure on the new connection is an error.
+void HttpClient::resend() {
+  disconnect();
+  m_reused = false;
+  connect();
+  for (int i = 0; i < m_inFlight; i++) {
+    sendRequest();
+  }
+}
+
+int HttpClient::readResponse(string& body) {
+  try {
+    if (m_inFlight == 0) {
+      throw runtime_error("no request to " + m_host + " in flight");
+    }
+    if (m_fd < 0) {
+      // The previous response closed the connection, so the requests
+      // pipelined behind it were not served.
+      resend();
+    }
+    int status = readResponseOnce(body);
+    if (status < 0 && m_reused) {
+      // The server closed the idle keep-alive connection before answering.
+      resend();
+      status = readResponseOnce(body);
+    }
+    if (status < 0) {
+      throw runtime_error("connection to " + m_host + " closed before response");
+    }
+    m_inFlight--;
+    // Requests still in flight may be retried if the server drops the
+    // connection before answering them.
+    m_reused = true;
+    return status;
+  } catch (...) {
+    reset();
+    throw;
+  }
+}
+
+// Makes more bytes available in m_rx[m_rxBegin, m_rxEnd). Returns false on EOF.
+bool HttpClient::fill() {
+  if (m_rxBegin == m_rxEnd) {
+    m_rxBegin = m_rxEnd = 0;
+  } else if (m_rxEnd == m_rx.size()) {
+    if (m_rxBegin > 0) {
+      memmove(m_rx.data(), m_rx.data() + m_rxBegin, m_rxEnd - m_rxBegin);
+      m_rxEnd -= m_rxBegin;
+      m_rxBegin = 0;
+    } else {
+      m_rx.resize(m_rx.size() * 2);
+    }
+  }
+  while (true) {
+    ssize_t n = ::recv(m_fd, m_rx.data() + m_rxEnd, m_rx.size() - m_rxEnd, 0);
+    if (n > 0) {
+      m_rxEnd += size_t(n);
+      return true;
+    }
+    if (n == 0) return false;
+    if (errno == EINTR) continue;
+    throw runtime_error("recv from " + m_host + " failed: " + strerror(errno));
+  }
+}
+
+bool HttpClient::readLine(string& line) {
+  while (true) {
+    const char* begin = m_rx.data() + m_rxBegin;
+    const char* end = m_rx.data() + m_rxEnd;
+    const char* nl = static_cast<const char*>(memchr(begin, '\n', size_t(end - begin)));
+    if (nl) {
+      size_t len = size_t(nl - begin);
+      if (len > 0 && begin[len - 1] == '\r') len--;
+      line.assign(begin, len);
+      m_rxBegin += size_t(nl - begin) + 1;
+      return true;
+    }
+    if (!fill()) return false;
+  }
+}
+
+// Appends exactly `len` body bytes, receiving straight into `body`.
+void HttpClient::readExact(string& body, size_t len) {
+  size_t offset = body.size();
+  body.resize(offset + len);
+  size_t buffered = min(len, m_rxEnd - m_rxBegin);
+  memcpy(body.data() + offset, m_rx.data() + m_rxBegin, buffered);
+  m_rxBegin += buffered;
+  size_t got = buffered;
+  while (got < len) {
+    ssize_t n = ::recv(m_fd, body.data() + offset + got, len - got, 0);
+    if (n > 0) {
+      got += size_t(n);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      throw runtime_error("connection to " + m_host + " closed mid-body");
+    }
+  }
+}
+
+// Returns -1 if the peer closed the connection before sending anything.
+int HttpClient::readResponseOnce(string& body) {
+  body.clear();
+  string line;
+  if (!readLine(line)) {
+    disconnect();
+    return -1;
+  }
+  // "HTTP/1.1 200 OK"
+  size_t sp = line.find(' ');
+  if (line.compare(0, 5, "HTTP/") != 0 || sp == string::npos) {
+    throw runtime_error("malformed status line from " + m_host + ": " + line);
+  }
+  int status = atoi(line.c_str() + sp + 1);
+
+  long long contentLength = -1;
+  bool chunked = false;
+  bool close = line.compare(0, 8, "HTTP/1.0") == 0;
+  while (true) {
+    if (!readLine(line)) {
+      throw runtime_error("connection to " + m_host + " closed in headers");
+    }
+    if (line.empty()) break;
+    size_t colon = line.find(':');
+    if (colon == string::npos) continue;
+    string name = lower(line.substr(0, colon));
+    string value = trim(line.substr(colon + 1));
+    if (name == "content-length") {
+      contentLength = atoll(value.c_str());
+    } else if (name == "transfer-encoding") {
+      chunked = lower(value).find("chunked") != string::npos;
+    } else if (name == "connection") {
+      string v = lower(value);
+      if (v == "close") close = true;
+      if (v == "keep-alive") close = false;
+    }
+  }
+
+  if (chunked) {
+    while (true) {
+      if (!readLine(line)) {
+        throw runtime_error("connection to " + m_host + " closed in chunked body");
+      }
+      size_t chunkLen = strtoull(line.c_str(), nullptr, 16);
+      if (chunkLen == 0) {
+        // Skip trailers up to the terminating empty line.
+        while (readLine(line) && !line.empty()) {}
+        break;
+      }
+      readExact(body, chunkLen);
+      readLine(line);  // CRLF after the chunk
+    }
+  } else if (contentLength >= 0) {
+    readExact(body, size_t(contentLength));
+  } else if (status >= 200 && status != 204 && status != 304) {
+    // Body delimited by connection close.
+    body.append(m_rx.data() + m_rxBegin, m_rxEnd - m_rxBegin);
+    m_rxBegin = m_rxEnd = 0;
+    while (fill()) {
+      body.append(m_rx.data() + m_rxBegin, m_rxEnd - m_rxBegin);
+      m_rxBegin = m_rxEnd = 0;
+    }
+    close = true;
+  }
+
+  if (close) {
+    disconnect();
+  }
+  return status;
+}
@@ -0,0 +1,75 @@
+#ifndef HTTP_CLIENT_HPP
+#define HTTP_CLIENT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Opens a blocking TCP connection to host:port (any resolved address) with
+// send/receive timeouts of `timeoutMs`. Returns the socket; throws
+// std::runtime_error on failure.
+int connectTcp(const std::string& host, const std::string& port, int timeoutMs);
+
+// Minimal HTTP/1.1 GET client for one URL over a persistent (keep-alive)
+// TCP connection. Requests and responses are split so that several clients
+// can have their requests in flight at once:
+//
+//   for (auto& c : clients) c->sendGet();
+//   for (auto& c : clients) c->readResponse(body);
+//
+// Several requests may be pipelined before their responses are read.
+// Handles Content-Length, chunked and close-delimited bodies. A keep-alive
+// connection the server dropped while idle is reopened transparently, and
+// all requests it had not answered are sent again.
+// Errors are reported as std::runtime_error and drop the connection, so the
+// next sendGet() reconnects. Only plain http:// URLs are supported.
+class HttpClient {
+public:
+  // Throws std::runtime_error if `url` is not a valid http:// URL. Does not
+  // connect yet.
+  explicit HttpClient(const std::string& url, int timeoutMs = 2000);
+  ~HttpClient();
+
+  HttpClient(const HttpClient&) = delete;
+  HttpClient& operator=(const HttpClient&) = delete;
+
+  void sendGet();
+  // Reads the response to the preceding sendGet() into `body`, reusing its
+  // capacity. Returns the HTTP status code.
+  int readResponse(std::string& body);
+  int get(std::string& body) {
+    sendGet();
+    return readResponse(body);
+  }
+
+  // Drops the connection, any buffered data and the requests in flight,
+  // e.g. to discard a request whose response will not be read.
+  void reset();
+
+private:
+  void connect();
+  void disconnect();
+  void sendRequest();
+  void resend();
+  int readResponseOnce(std::string& body);
+  bool fill();
+  bool readLine(std::string& line);
+  void readExact(std::string& body, std::size_t len);
+
+  std::string m_host;
+  std::string m_port;
+  std::string m_request;
+  int m_timeoutMs;
+  int m_fd = -1;
+  // the connection served a response before, so it may have been closed
+  // before answering the requests in flight, which are then retried once
+  bool m_reused = false;
+  int m_inFlight = 0;  // requests sent whose response was not read yet
+
+  std::vector<char> m_rx;  // receive buffer, reused across responses
+  std::size_t m_rxBegin = 0;
+  std::size_t m_rxEnd = 0;
+};
+
+#endif // HTTP_CLIENT_HPP
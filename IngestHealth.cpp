@@ -0,0 +1,85 @@
+#include "IngestHealth.hpp"
+
+using namespace std;
+
+namespace sflow {
+
+void SequenceTracker::observe(uint32_t sequence, uint32_t uptimeMs, int64_t nowNs) {
+  m_datagrams.fetch_add(1, memory_order_relaxed);
+  m_lastSeenNs.store(nowNs, memory_order_relaxed);
+
+  lock_guard<mutex> lock(m_mutex);
+  // Serial-number arithmetic: both counters wrap (uptime after ~49.7 days).
+  int32_t delta = int32_t(sequence - m_newest);
+  uint32_t uptimeBack = m_uptimeMs - uptimeMs;
+  bool restarted = m_started &&
+                   ((uptimeBack > UPTIME_RESTART_SLACK_MS && uptimeBack < (1u << 31)) ||
+                    delta <= -SEQUENCE_WINDOW);
+  if (!m_started || restarted) {
+    if (restarted) m_restarts.fetch_add(1, memory_order_relaxed);
+    m_started = true;
+    m_newest = sequence;
+    m_seen = 1;
+    m_uptimeMs = uptimeMs;
+  } else if (delta > 0) {
+    m_lost.fetch_add(uint64_t(delta - 1), memory_order_relaxed);
+    m_seen = delta >= SEQUENCE_WINDOW ? 1 : (m_seen << delta) | 1;
+    m_newest = sequence;
+    m_uptimeMs = uptimeMs;
+  } else {
+    uint64_t bit = uint64_t(1) << -delta;
+    if (m_seen & bit) {
+      m_duplicates.fetch_add(1, memory_order_relaxed);
+    } else {
+      // counted as lost when its successor arrived
+      m_seen |= bit;
+      m_reordered.fetch_add(1, memory_order_relaxed);
+      if (m_lost.load(memory_order_relaxed) > 0) {
+        m_lost.fetch_sub(1, memory_order_relaxed);
+      }
+    }
+  }
+  m_lastSequence.store(m_newest, memory_order_relaxed);
+  m_lastUptimeMs.store(m_uptimeMs, memory_order_relaxed);
+}
+
+SubAgentHealth SequenceTracker::read() const {
+  SubAgentHealth health;
+  health.agent = m_agent;
+  health.sub_agent_id = m_subAgentId;
+  health.datagrams = m_datagrams.load(memory_order_relaxed);
+  health.lost = m_lost.load(memory_order_relaxed);
+  health.reordered = m_reordered.load(memory_order_relaxed);
+  health.duplicates = m_duplicates.load(memory_order_relaxed);
+  health.restarts = m_restarts.load(memory_order_relaxed);
+  health.last_sequence = m_lastSequence.load(memory_order_relaxed);
+  health.uptime_ms = m_lastUptimeMs.load(memory_order_relaxed);
+  health.last_seen_ns = m_lastSeenNs.load(memory_order_relaxed);
+  return health;
+}
+
+SequenceTracker& SubAgentRegistry::tracker(const IpAddress& agent, uint32_t subAgentId) {
+  lock_guard<mutex> lock(m_mutex);
+  auto& slot = m_trackers[Key{ agent, subAgentId }];
+  if (!slot) {
+    slot = make_unique<SequenceTracker>(agent, subAgentId);
+  }
+  return *slot;
+}
+
+vector<SubAgentHealth> SubAgentRegistry::read() const {
+  lock_guard<mutex> lock(m_mutex);
+  vector<SubAgentHealth> out;
+  out.reserve(m_trackers.size());
+  for (const auto& [key, tracker] : m_trackers) {
+    out.push_back(tracker->read());
+  }
+  return out;
+}
+
+size_t SubAgentRegistry::size() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_trackers.size();
+}
+
+}  // namespace sflow
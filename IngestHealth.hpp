@@ -0,0 +1,104 @@
+#ifndef INGEST_HEALTH_HPP
+#define INGEST_HEALTH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "IpAddress.hpp"
+
+// Datagrams this far behind the newest one of their sub-agent are still
+// told apart as late or duplicate.
+#define SEQUENCE_WINDOW 64
+// A sub-agent whose uptime goes back by more than this has restarted.
+#define UPTIME_RESTART_SLACK_MS 1000
+
+namespace sflow {
+
+  // Datagram accounting of one (agent, sub-agent) pair.
+  struct SubAgentHealth {
+    IpAddress agent;
+    uint32_t sub_agent_id = 0;
+    uint64_t datagrams = 0;
+    // sequence numbers skipped and not (yet) received late
+    uint64_t lost = 0;
+    uint64_t reordered = 0;   // arrived after a newer datagram
+    uint64_t duplicates = 0;  // sequence number already seen
+    uint64_t restarts = 0;    // sequence or uptime started over
+    uint32_t last_sequence = 0;
+    uint32_t uptime_ms = 0;
+    int64_t last_seen_ns = 0;
+  };
+
+  // Follows the datagram sequence numbers of one sub-agent. sFlow numbers
+  // the datagrams of each (agent, sub-agent) consecutively, so a gap is a
+  // datagram lost on the way (or still in flight), a number below the
+  // newest one a reordered or duplicated datagram, and a number far below
+  // it, or an uptime that went back, a restarted agent. A bitmap of the
+  // last SEQUENCE_WINDOW numbers tells late arrivals, which fill a gap,
+  // from duplicates.
+  //
+  // observe() is called by the receive worker the sub-agent's datagrams
+  // land on; the counters are atomics, so read() never blocks it.
+  class SequenceTracker {
+  public:
+    SequenceTracker(const IpAddress& agent, uint32_t subAgentId)
+        : m_agent(agent), m_subAgentId(subAgentId) {}
+
+    void observe(uint32_t sequence, uint32_t uptimeMs, int64_t nowNs);
+    SubAgentHealth read() const;
+
+  private:
+    const IpAddress m_agent;
+    const uint32_t m_subAgentId;
+
+    // Sequence state. Uncontended unless one sub-agent's datagrams are
+    // spread over several receive workers.
+    std::mutex m_mutex;
+    bool m_started = false;
+    uint32_t m_newest = 0;
+    uint64_t m_seen = 0;  // bit i: m_newest - i was received
+    uint32_t m_uptimeMs = 0;
+
+    std::atomic<uint64_t> m_datagrams{0};
+    std::atomic<uint64_t> m_lost{0};
+    std::atomic<uint64_t> m_reordered{0};
+    std::atomic<uint64_t> m_duplicates{0};
+    std::atomic<uint64_t> m_restarts{0};
+    std::atomic<uint32_t> m_lastSequence{0};
+    std::atomic<uint32_t> m_lastUptimeMs{0};
+    std::atomic<int64_t> m_lastSeenNs{0};
+  };
+
+  // All sub-agents seen so far. Trackers are created on first sight and
+  // live as long as the registry; receive workers cache the pointer, so the
+  // registry lock is only taken for new sub-agents and by readers.
+  class SubAgentRegistry {
+  public:
+    SequenceTracker& tracker(const IpAddress& agent, uint32_t subAgentId);
+    std::vector<SubAgentHealth> read() const;
+    std::size_t size() const;
+
+    struct Key {
+      IpAddress agent;
+      uint32_t sub_agent_id;
+      bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+      std::size_t operator()(const Key& k) const {
+        return IpAddressHash()(k.agent) ^ (std::size_t(k.sub_agent_id) * 0x9e3779b97f4a7c15ULL);
+      }
+    };
+
+  private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<Key, std::unique_ptr<SequenceTracker>, KeyHash> m_trackers;
+  };
+
+} // namespace sflow
+
+#endif // INGEST_HEALTH_HPP
@@ -0,0 +1,73 @@
+#ifndef IP_ADDRESS_HPP
+#define IP_ADDRESS_HPP
+
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+
+namespace sflow {
+
+  // IPv4 or IPv6 address held by value. IPv4 uses the first 4 bytes.
+  struct IpAddress {
+    uint8_t version = 0;  // 0 (unset), 4 or 6
+    std::array<uint8_t, 16> bytes{};
+
+    auto operator<=>(const IpAddress&) const = default;
+
+    static IpAddress fromV4(const uint8_t* src) {
+      IpAddress addr;
+      addr.version = 4;
+      std::memcpy(addr.bytes.data(), src, 4);
+      return addr;
+    }
+
+    static IpAddress fromV6(const uint8_t* src) {
+      IpAddress addr;
+      addr.version = 6;
+      std::memcpy(addr.bytes.data(), src, 16);
+      return addr;
+    }
+
+    // Parses a dotted-quad or IPv6 literal; returns false if it is neither.
+    static bool parse(const std::string& text, IpAddress& out) {
+      IpAddress addr;
+      if (inet_pton(AF_INET, text.c_str(), addr.bytes.data()) == 1) {
+        addr.version = 4;
+      } else if (inet_pton(AF_INET6, text.c_str(), addr.bytes.data()) == 1) {
+        addr.version = 6;
+      } else {
+        return false;
+      }
+      out = addr;
+      return true;
+    }
+
+    std::string toString() const {
+      char buf[INET6_ADDRSTRLEN];
+      if (version == 4) {
+        inet_ntop(AF_INET, bytes.data(), buf, sizeof(buf));
+      } else if (version == 6) {
+        inet_ntop(AF_INET6, bytes.data(), buf, sizeof(buf));
+      } else {
+        return "";
+      }
+      return std::string(buf);
+    }
+  };
+
+  struct IpAddressHash {
+    std::size_t operator()(const IpAddress& addr) const {
+      uint64_t lo, hi;
+      std::memcpy(&lo, addr.bytes.data(), 8);
+      std::memcpy(&hi, addr.bytes.data() + 8, 8);
+      uint64_t h = (lo ^ (hi * 0x9e3779b97f4a7c15ULL) ^ addr.version) * 0xff51afd7ed558ccdULL;
+      return std::size_t(h ^ (h >> 32));
+    }
+  };
+
+} // namespace sflow
+
+#endif // IP_ADDRESS_HPP
@@ -0,0 +1,116 @@
+#include "LinkUtilization.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace sflow {
+
+void UtilizationRing::push(const UtilizationSample& sample, const RateEstimatorConfig& config) {
+  uint64_t n = m_count.load(memory_order_relaxed);
+  Slot& slot = m_slots[n % m_slots.size()];
+  slot.seq.store(2 * n + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.timestamp_ns.store(sample.timestamp_ns, memory_order_relaxed);
+  slot.in_bps.store(sample.in_bps, memory_order_relaxed);
+  slot.out_bps.store(sample.out_bps, memory_order_relaxed);
+  slot.if_speed.store(sample.if_speed, memory_order_relaxed);
+  slot.interval_ns.store(sample.interval_ns, memory_order_relaxed);
+  slot.seq.store(2 * n + 2, memory_order_release);
+  m_count.store(n + 1, memory_order_release);
+
+  if (sample.interval_ns > 0) {
+    int64_t toMs = sample.timestamp_ns / 1000000;
+    int64_t fromMs = (sample.timestamp_ns - sample.interval_ns) / 1000000;
+    m_inRate.add(fromMs, toMs, double(sample.in_bps), config);
+    m_outRate.add(fromMs, toMs, double(sample.out_bps), config);
+    SmoothedRate in = m_inRate.read();
+    SmoothedRate out = m_outRate.read();
+
+    uint64_t seq = m_smoothed.seq.load(memory_order_relaxed);
+    m_smoothed.seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < SMOOTHED_VALUES; i++) {
+      bool ewma = i < RATE_EWMA_COUNT;
+      size_t j = ewma ? i : i - RATE_EWMA_COUNT;
+      m_smoothed.in[i].store(ewma ? in.ewma[j] : in.window[j], memory_order_relaxed);
+      m_smoothed.out[i].store(ewma ? out.ewma[j] : out.window[j], memory_order_relaxed);
+    }
+    m_smoothed.seq.store(seq + 2, memory_order_release);
+  }
+}
+
+void UtilizationRing::smoothed(SmoothedRate& in, SmoothedRate& out) const {
+  // Retries while push() is publishing, which takes a few stores once per
+  // counter sample.
+  while (true) {
+    uint64_t seq = m_smoothed.seq.load(memory_order_acquire);
+    if (seq & 1) continue;
+    for (size_t i = 0; i < SMOOTHED_VALUES; i++) {
+      bool ewma = i < RATE_EWMA_COUNT;
+      size_t j = ewma ? i : i - RATE_EWMA_COUNT;
+      (ewma ? in.ewma[j] : in.window[j]) = m_smoothed.in[i].load(memory_order_relaxed);
+      (ewma ? out.ewma[j] : out.window[j]) = m_smoothed.out[i].load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (m_smoothed.seq.load(memory_order_relaxed) == seq) return;
+  }
+}
+
+size_t UtilizationRing::recent(UtilizationSample* out, size_t max) const {
+  uint64_t count = m_count.load(memory_order_acquire);
+  size_t got = 0;
+  for (uint64_t i = count; i > 0 && got < max && count - i < m_slots.size(); i--) {
+    uint64_t n = i - 1;
+    const Slot& slot = m_slots[n % m_slots.size()];
+    uint64_t seq = slot.seq.load(memory_order_acquire);
+    if (seq != 2 * n + 2) break;  // being overwritten by a newer sample
+    UtilizationSample sample;
+    sample.timestamp_ns = slot.timestamp_ns.load(memory_order_relaxed);
+    sample.in_bps = slot.in_bps.load(memory_order_relaxed);
+    sample.out_bps = slot.out_bps.load(memory_order_relaxed);
+    sample.if_speed = slot.if_speed.load(memory_order_relaxed);
+    sample.interval_ns = slot.interval_ns.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.seq.load(memory_order_relaxed) != seq) break;
+    out[got++] = sample;
+  }
+  return got;
+}
+
+vector<InterfaceBinding> loadInterfaceBindings(const string& path) {
+  ifstream in(path);
+  if (!in) {
+    throw runtime_error("cannot open " + path);
+  }
+  vector<InterfaceBinding> bindings;
+  string line;
+  for (size_t lineNo = 1; getline(in, line); lineNo++) {
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == string::npos || line[first] == '#') continue;
+
+    istringstream fields(line);
+    string agent, dpid;
+    InterfaceBinding binding;
+    if (!(fields >> agent >> binding.if_index >> dpid >> binding.port_no) ||
+        !IpAddress::parse(agent, binding.agent)) {
+      throw runtime_error(path + ":" + to_string(lineNo) +
+                          ": expected <agent ip> <ifIndex> <dpid> <port_no>");
+    }
+    char* end = nullptr;
+    unsigned long long value = strtoull(dpid.c_str(), &end, 16);
+    if (dpid.empty() || *end != '\0') {
+      throw runtime_error(path + ":" + to_string(lineNo) + ": bad dpid " + dpid);
+    }
+    char formatted[17];
+    snprintf(formatted, sizeof(formatted), "%016llx", value);
+    binding.dpid = formatted;
+    bindings.push_back(std::move(binding));
+  }
+  return bindings;
+}
+
+} // namespace sflow
@@ -0,0 +1,150 @@
+#ifndef LINK_UTILIZATION_HPP
+#define LINK_UTILIZATION_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IpAddress.hpp"
+#include "RateEstimator.hpp"
+
+#define LINK_UTILIZATION_HISTORY 64
+
+namespace sflow {
+
+  // Rates derived from two consecutive counter samples of one interface.
+  struct UtilizationSample {
+    int64_t timestamp_ns = 0;
+    uint64_t in_bps = 0;   // received by the reporting interface
+    uint64_t out_bps = 0;  // sent by the reporting interface
+    uint64_t if_speed = 0; // bits/s, as reported by the agent
+    // the rates are averages over (timestamp_ns - interval_ns, timestamp_ns]
+    int64_t interval_ns = 0;
+  };
+
+  // Fixed-size ring of the most recent samples of one interface. push() is
+  // meant for a single writer (the receive worker owning the agent); readers
+  // never block it and never see a torn sample: each slot carries a sequence
+  // number that is odd while the slot is written and otherwise identifies
+  // which sample the slot holds. Each direction's rate is also smoothed by
+  // a RateEstimator owned by the writer, which publishes the smoothed
+  // values under a sequence number the same way.
+  class UtilizationRing {
+  public:
+    void push(const UtilizationSample& sample,
+              const RateEstimatorConfig& config = RateEstimatorConfig());
+
+    // Newest sample; false if none was recorded yet.
+    bool latest(UtilizationSample& out) const { return recent(&out, 1) == 1; }
+
+    // Copies up to `max` samples, newest first; returns how many.
+    size_t recent(UtilizationSample* out, size_t max) const;
+
+    // Smoothed rates as of the newest sample.
+    void smoothed(SmoothedRate& in, SmoothedRate& out) const;
+
+  private:
+    struct Slot {
+      std::atomic<uint64_t> seq{0};
+      std::atomic<int64_t> timestamp_ns{0};
+      std::atomic<uint64_t> in_bps{0};
+      std::atomic<uint64_t> out_bps{0};
+      std::atomic<uint64_t> if_speed{0};
+      std::atomic<int64_t> interval_ns{0};
+    };
+
+    std::array<Slot, LINK_UTILIZATION_HISTORY> m_slots;
+    std::atomic<uint64_t> m_count{0};
+
+    static constexpr size_t SMOOTHED_VALUES = RATE_EWMA_COUNT + RATE_WINDOW_COUNT;
+
+    struct SmoothedSlot {
+      std::atomic<uint64_t> seq{0};
+      std::array<std::atomic<uint64_t>, SMOOTHED_VALUES> in{};
+      std::array<std::atomic<uint64_t>, SMOOTHED_VALUES> out{};
+    };
+
+    // only touched by the writer
+    RateEstimator m_inRate;
+    RateEstimator m_outRate;
+    SmoothedSlot m_smoothed;
+  };
+
+  // Utilization history of one topology link. ends[0] is measured at the
+  // link's src switch port, ends[1] at its dst port (see
+  // TopologyManager::LinkKey). Shared by every topology snapshot the link
+  // is part of, so history survives topology updates.
+  struct LinkUtilization {
+    std::array<UtilizationRing, 2> ends;
+  };
+
+  // Which switch port an sFlow agent's ifIndex is. sFlow agents report
+  // ifIndex values while the topology knows OpenFlow port numbers, and the
+  // two cannot be derived from each other.
+  struct InterfaceBinding {
+    IpAddress agent;
+    uint32_t if_index = 0;
+    std::string dpid;  // formatted as Ryu does: 16 lower-case hex digits
+    uint32_t port_no = 0;
+  };
+
+  // Reads bindings from a text file, one per line:
+  //   <agent ip> <ifIndex> <dpid (hex)> <OpenFlow port_no>
+  // Blank lines and lines starting with '#' are ignored. Throws
+  // std::runtime_error naming the file and line on any error.
+  std::vector<InterfaceBinding> loadInterfaceBindings(const std::string& path);
+
+  // Resolved (agent, ifIndex) -> link end for one topology version and
+  // one set of bindings. Immutable once published.
+  struct InterfaceMap {
+    struct Key {
+      IpAddress agent;
+      uint32_t if_index;
+      bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+      size_t operator()(const Key& k) const {
+        return IpAddressHash()(k.agent) ^ (size_t(k.if_index) * 0x9e3779b97f4a7c15ULL);
+      }
+    };
+    struct Target {
+      std::shared_ptr<LinkUtilization> link;
+      uint8_t end = 0;
+      uint64_t edge_id = 0;  // TopologyManager::EdgeProperties::edge_id
+      UtilizationRing& ring() const { return link->ends[end]; }
+    };
+
+    // snapshot version the map was built from; batches that only change
+    // hosts publish no new map
+    uint64_t topology_version = 0;
+    // bumped by every TopologyManager::setInterfaceBindings(); a map with
+    // the same topology but other bindings resolves hops differently
+    uint64_t bindings_version = 0;
+    std::unordered_map<Key, Target, KeyHash> targets;
+
+    const Target* find(const IpAddress& agent, uint32_t ifIndex) const {
+      auto it = targets.find(Key{ agent, ifIndex });
+      return it == targets.end() ? nullptr : &it->second;
+    }
+  };
+
+  // Hand-off point between the topology side, which publishes a new map
+  // whenever links or bindings change, and the collector, which looks up
+  // every counter sample in the current one.
+  class LinkUtilizationIndex {
+  public:
+    std::shared_ptr<const InterfaceMap> current() const { return m_map.load(); }
+    void publish(std::shared_ptr<const InterfaceMap> map) { m_map.store(std::move(map)); }
+
+  private:
+    std::atomic<std::shared_ptr<const InterfaceMap>> m_map;
+  };
+
+} // namespace sflow
+
+#endif // LINK_UTILIZATION_HPP
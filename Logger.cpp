@@ -0,0 +1,253 @@
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+namespace {
+
+const char* levelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::DEBUG: return "debug";
+    case LogLevel::INFO: return "info";
+    case LogLevel::WARN: return "warn";
+    case LogLevel::ERROR: return "error";
+  }
+  return "";
+}
+
+void appendTimestamp(int64_t timestampNs, string& out) {
+  time_t secs = time_t(timestampNs / 1000000000);
+  tm utc;
+  gmtime_r(&secs, &utc);
+  char buf[40];
+  size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(buf + n, sizeof(buf) - n, ".%06dZ", int((timestampNs / 1000) % 1000000));
+  out += buf;
+}
+
+void appendJsonString(const char* s, size_t len, string& out) {
+  out += '"';
+  for (size_t i = 0; i < len; i++) {
+    char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+}  // namespace
+
+struct Logger::RingOwner {
+  shared_ptr<Ring> ring;
+  ~RingOwner() {
+    if (ring) ring->closed.store(true);
+  }
+};
+
+Logger& Logger::instance() {
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger() { m_thread = thread(&Logger::run, this); }
+
+Logger::~Logger() {
+  m_running.store(false);
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  lock_guard<mutex> lock(m_outputMutex);
+  if (m_file && m_file != stderr) {
+    fclose(m_file);
+  }
+}
+
+void Logger::configure(const LoggerConfig& config) {
+  lock_guard<mutex> lock(m_outputMutex);
+  if (m_file && m_file != stderr) {
+    fclose(m_file);
+  }
+  m_file = stderr;
+  if (!config.path.empty()) {
+    FILE* file = fopen(config.path.c_str(), config.format == LogFormat::BINARY ? "ab" : "a");
+    if (file) {
+      m_file = file;
+    } else {
+      perror(("fopen " + config.path).c_str());
+    }
+  }
+  m_config = config;
+  setLevel(config.level);
+}
+
+Logger::Ring& Logger::localRing() {
+  thread_local RingOwner owner;
+  if (!owner.ring) {
+    auto ring = make_shared<Ring>();
+    lock_guard<mutex> lock(m_mutex);
+    ring->thread_id = m_nextThreadId++;
+    m_rings.push_back(ring);
+    owner.ring = std::move(ring);
+  }
+  return *owner.ring;
+}
+
+void Logger::log(LogLevel level, const char* component, const char* fmt, ...) {
+  Ring& ring = localRing();
+  uint64_t head = ring.head.load(memory_order_relaxed);
+  if (head - ring.tail.load(memory_order_acquire) >= LOG_RING_CAPACITY) {
+    m_dropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+
+  Record& record = ring.records[head % LOG_RING_CAPACITY];
+  record.timestamp_ns = chrono::duration_cast<chrono::nanoseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+  record.thread_id = ring.thread_id;
+  record.level = level;
+  strncpy(record.component, component, LOG_COMPONENT_SIZE - 1);
+  record.component[LOG_COMPONENT_SIZE - 1] = '\0';
+
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(record.message, LOG_MESSAGE_SIZE, fmt, args);
+  va_end(args);
+  record.length = uint16_t(n < 0 ? 0 : min(n, LOG_MESSAGE_SIZE - 1));
+
+  ring.head.store(head + 1, memory_order_release);
+}
+
+void Logger::flush() {
+  unique_lock<mutex> lock(m_mutex);
+  // Two complete writer passes guarantee every ring has been drained past
+  // anything published before this call.
+  uint64_t target = m_passes + 2;
+  m_flushed.wait_for(lock, chrono::seconds(5), [&] { return m_passes >= target; });
+}
+
+void Logger::run() {
+  while (m_running.load()) {
+    if (!drain()) {
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+  }
+  drain();
+}
+
+bool Logger::drain() {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_draining = m_rings;
+  }
+
+  bool wrote;
+  {
+    lock_guard<mutex> lock(m_outputMutex);
+    m_buffer.clear();
+    for (auto& ring : m_draining) {
+      // Read `closed` first: once it is set no more records can follow.
+      bool closed = ring->closed.load(memory_order_acquire);
+      uint64_t tail = ring->tail.load(memory_order_relaxed);
+      uint64_t head = ring->head.load(memory_order_acquire);
+      for (; tail != head; tail++) {
+        const Record& record = ring->records[tail % LOG_RING_CAPACITY];
+        if (m_config.format == LogFormat::BINARY) {
+          writeBinary(record, m_buffer);
+        } else {
+          format(record, m_buffer);
+        }
+      }
+      ring->tail.store(tail, memory_order_release);
+      if (!closed) {
+        ring.reset();  // still in use, keep it registered
+      }
+    }
+
+    uint64_t dropped = m_dropped.load(memory_order_relaxed);
+    if (dropped != m_droppedReported) {
+      Record note{};
+      note.timestamp_ns = chrono::duration_cast<chrono::nanoseconds>(
+          chrono::system_clock::now().time_since_epoch()).count();
+      note.level = LogLevel::WARN;
+      strcpy(note.component, "logger");
+      int n = snprintf(note.message, LOG_MESSAGE_SIZE, "dropped %llu records (ring full)",
+                       static_cast<unsigned long long>(dropped - m_droppedReported));
+      note.length = uint16_t(n);
+      if (m_config.format == LogFormat::BINARY) {
+        writeBinary(note, m_buffer);
+      } else {
+        format(note, m_buffer);
+      }
+      m_droppedReported = dropped;
+    }
+
+    wrote = !m_buffer.empty();
+    if (wrote) {
+      fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+      fflush(m_file);
+    }
+  }
+
+  // What is left in m_draining are the drained rings of exited threads.
+  lock_guard<mutex> lock(m_mutex);
+  for (const auto& ring : m_draining) {
+    if (!ring) continue;
+    auto it = find(m_rings.begin(), m_rings.end(), ring);
+    *it = std::move(m_rings.back());
+    m_rings.pop_back();
+  }
+  m_draining.clear();
+  m_passes++;
+  m_flushed.notify_all();
+  return wrote;
+}
+
+void Logger::format(const Record& record, string& out) const {
+  if (m_config.format == LogFormat::JSON) {
+    out += "{\"ts\":\"";
+    appendTimestamp(record.timestamp_ns, out);
+    out += "\",\"level\":\"";
+    out += levelName(record.level);
+    out += "\",\"thread\":";
+    out += to_string(record.thread_id);
+    out += ",\"component\":";
+    appendJsonString(record.component, strlen(record.component), out);
+    out += ",\"msg\":";
+    appendJsonString(record.message, record.length, out);
+    out += "}\n";
+    return;
+  }
+  appendTimestamp(record.timestamp_ns, out);
+  char prefix[48];
+  snprintf(prefix, sizeof(prefix), " %-5s [%s] ", levelName(record.level), record.component);
+  out += prefix;
+  out.append(record.message, record.length);
+  out += '\n';
+}
+
+// Layout, native byte order: int64 timestamp_ns, uint32 thread_id,
+// uint8 level, uint8 component length, uint16 message length, component
+// bytes, message bytes. Thread id 0 is the writer's own "dropped" notice.
+void Logger::writeBinary(const Record& record, string& out) const {
+  uint8_t componentLength = uint8_t(strlen(record.component));
+  out.append(reinterpret_cast<const char*>(&record.timestamp_ns), sizeof(record.timestamp_ns));
+  out.append(reinterpret_cast<const char*>(&record.thread_id), sizeof(record.thread_id));
+  out += char(record.level);
+  out += char(componentLength);
+  out.append(reinterpret_cast<const char*>(&record.length), sizeof(record.length));
+  out.append(record.component, componentLength);
+  out.append(record.message, record.length);
+}
@@ -0,0 +1,152 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Asynchronous logger. Each thread formats a record into its own
+// single-producer ring buffer (no locks, no syscalls); a background writer
+// drains all rings in batches to stderr or a file. A full ring drops the
+// record and counts it instead of blocking the caller.
+//
+//   LOG_INFO("sflow", "listening on port %d", SFLOW_PORT);
+//
+// Records below LOG_COMPILE_LEVEL are removed at compile time, records below
+// the runtime level (Logger::setLevel) cost one atomic load.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_CAPACITY 1024
+#define LOG_MESSAGE_SIZE 224
+#define LOG_COMPONENT_SIZE 16
+
+enum class LogLevel : uint8_t { DEBUG = 0, INFO = 1, WARN = 2, ERROR = 3 };
+
+enum class LogFormat {
+  TEXT,   // "2026-01-01T00:00:00.000000Z info  [component] message"
+  JSON,   // one JSON object per line
+  BINARY  // length-prefixed packed records, see Logger::writeBinary
+};
+
+struct LoggerConfig {
+  std::string path;  // empty means stderr
+  LogFormat format = LogFormat::TEXT;
+  LogLevel level = LogLevel::INFO;
+};
+
+class Logger {
+public:
+  static Logger& instance();
+
+  // Switches sink, format and level. Records already queued are written
+  // with the new settings.
+  void configure(const LoggerConfig& config);
+  void setLevel(LogLevel level) { m_level.store(uint8_t(level), std::memory_order_relaxed); }
+  bool enabled(LogLevel level) const {
+    return uint8_t(level) >= m_level.load(std::memory_order_relaxed);
+  }
+
+  void log(LogLevel level, const char* component, const char* fmt, ...)
+      __attribute__((format(printf, 4, 5)));
+
+  // Blocks until everything logged so far has been written.
+  void flush();
+
+  uint64_t droppedRecords() const { return m_dropped.load(); }
+
+  ~Logger();
+
+private:
+  struct Record {
+    int64_t timestamp_ns;
+    uint32_t thread_id;
+    LogLevel level;
+    uint16_t length;
+    char component[LOG_COMPONENT_SIZE];
+    char message[LOG_MESSAGE_SIZE];
+  };
+
+  // Single producer (the owning thread), single consumer (the writer).
+  struct Ring {
+    std::array<Record, LOG_RING_CAPACITY> records;
+    alignas(64) std::atomic<uint64_t> head{0};  // next slot to write
+    alignas(64) std::atomic<uint64_t> tail{0};  // next slot to read
+    std::atomic<bool> closed{false};            // owning thread exited
+    uint32_t thread_id = 0;
+  };
+
+  struct RingOwner;
+
+  Logger();
+  Ring& localRing();
+  void run();
+  bool drain();
+  void format(const Record& record, std::string& out) const;
+  void writeBinary(const Record& record, std::string& out) const;
+
+  std::atomic<uint8_t> m_level{uint8_t(LogLevel::INFO)};
+  std::atomic<uint64_t> m_dropped{0};
+  uint64_t m_droppedReported = 0;
+
+  // Guards m_rings, m_nextThreadId and m_passes; held only briefly, so a
+  // thread registering its ring never waits for the writer's I/O.
+  std::mutex m_mutex;
+  std::vector<std::shared_ptr<Ring>> m_rings;
+  uint32_t m_nextThreadId = 1;
+  std::condition_variable m_flushed;
+  uint64_t m_passes = 0;
+
+  std::mutex m_outputMutex;  // guards m_config, m_file
+  LoggerConfig m_config;
+  FILE* m_file = stderr;
+
+  std::atomic<bool> m_running{true};
+  // the writer's own: rings being drained, output being built
+  std::vector<std::shared_ptr<Ring>> m_draining;
+  std::string m_buffer;
+  std::thread m_thread;
+};
+
+#define LOG_AT(level, component, ...)                          \
+  do {                                                         \
+    if (Logger::instance().enabled(level)) {                   \
+      Logger::instance().log(level, component, __VA_ARGS__);   \
+    }                                                          \
+  } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(component, ...) LOG_AT(LogLevel::DEBUG, component, __VA_ARGS__)
+#else
+#define LOG_DEBUG(component, ...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(component, ...) LOG_AT(LogLevel::INFO, component, __VA_ARGS__)
+#else
+#define LOG_INFO(component, ...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(component, ...) LOG_AT(LogLevel::WARN, component, __VA_ARGS__)
+#else
+#define LOG_WARN(component, ...) do {} while (0)
+#endif
+
+#define LOG_ERROR(component, ...) LOG_AT(LogLevel::ERROR, component, __VA_ARGS__)
+
+#endif // LOGGER_HPP
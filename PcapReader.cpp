@@ -0,0 +1,296 @@
+#include "PcapReader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace sflow {
+
+namespace {
+
+constexpr uint32_t PCAP_MAGIC_US = 0xa1b2c3d4;
+constexpr uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+constexpr uint32_t PCAPNG_SHB = 0x0a0d0d0a;
+constexpr uint32_t PCAPNG_BYTE_ORDER = 0x1a2b3c4d;
+constexpr uint32_t PCAPNG_IDB = 1;
+constexpr uint32_t PCAPNG_SPB = 3;
+constexpr uint32_t PCAPNG_EPB = 6;
+
+constexpr uint32_t LINKTYPE_NULL = 0;
+constexpr uint32_t LINKTYPE_ETHERNET = 1;
+constexpr uint32_t LINKTYPE_RAW = 101;
+constexpr uint32_t LINKTYPE_LINUX_SLL = 113;
+constexpr uint32_t LINKTYPE_IPV4 = 228;
+constexpr uint32_t LINKTYPE_IPV6 = 229;
+constexpr uint32_t LINKTYPE_LINUX_SLL2 = 276;
+
+inline uint16_t be16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+
+inline uint32_t raw32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+}  // namespace
+
+PcapReader::PcapReader(const string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("cannot open " + path + ": " + strerror(errno));
+  }
+  struct stat st;
+  if (::fstat(fd, &st) < 0 || st.st_size < 24) {
+    ::close(fd);
+    throw runtime_error("not a capture file: " + path);
+  }
+  void* map = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    throw runtime_error("cannot map " + path + ": " + strerror(errno));
+  }
+  ::madvise(map, size_t(st.st_size), MADV_SEQUENTIAL);
+  m_data = static_cast<const uint8_t*>(map);
+  m_size = size_t(st.st_size);
+
+  uint32_t magic = raw32(m_data);
+  if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+    m_swapped = false;
+  } else if (magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+             magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+    m_swapped = true;
+  } else if (magic == PCAPNG_SHB) {
+    m_ng = true;
+    return;  // the section header is parsed as the first block
+  } else {
+    ::munmap(map, m_size);
+    throw runtime_error("unknown capture format: " + path);
+  }
+  bool nanos = u32(0) == PCAP_MAGIC_NS;
+  m_classic.link_type = u32(20) & 0x0fffffff;
+  m_classic.ts_num = nanos ? 1 : 1000;
+  m_pos = 24;
+}
+
+PcapReader::~PcapReader() {
+  if (m_data) {
+    ::munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+  }
+}
+
+uint32_t PcapReader::u32(size_t off) const {
+  uint32_t v = raw32(m_data + off);
+  return m_swapped ? __builtin_bswap32(v) : v;
+}
+
+uint16_t PcapReader::u16(size_t off) const {
+  uint16_t v;
+  memcpy(&v, m_data + off, 2);
+  return m_swapped ? __builtin_bswap16(v) : v;
+}
+
+bool PcapReader::next(PcapDatagram& out, uint16_t port) {
+  return m_ng ? nextNg(out, port) : nextClassic(out, port);
+}
+
+bool PcapReader::nextClassic(PcapDatagram& out, uint16_t port) {
+  while (m_pos + 16 <= m_size) {
+    uint32_t sec = u32(m_pos);
+    uint32_t frac = u32(m_pos + 4);
+    uint32_t capLen = u32(m_pos + 8);
+    size_t frame = m_pos + 16;
+    if (capLen > m_size - frame) {
+      return false;
+    }
+    m_pos = frame + capLen;
+    out.timestamp_ns = int64_t(sec) * 1000000000 + int64_t(frac) * int64_t(m_classic.ts_num);
+    if (extractUdp(m_classic.link_type, m_data + frame, capLen, port, out)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PcapReader::nextNg(PcapDatagram& out, uint16_t port) {
+  while (m_pos + 12 <= m_size) {
+    if (raw32(m_data + m_pos) == PCAPNG_SHB) {
+      // A new section may switch byte order and resets the interfaces.
+      if (m_pos + 16 > m_size) return false;
+      uint32_t order = raw32(m_data + m_pos + 8);
+      if (order == PCAPNG_BYTE_ORDER) {
+        m_swapped = false;
+      } else if (order == __builtin_bswap32(PCAPNG_BYTE_ORDER)) {
+        m_swapped = true;
+      } else {
+        return false;
+      }
+      m_interfaces.clear();
+    }
+
+    uint32_t type = u32(m_pos);
+    uint32_t blockLen = u32(m_pos + 4);
+    if (blockLen < 12 || blockLen > m_size - m_pos) {
+      return false;
+    }
+    size_t body = m_pos + 8;
+    size_t bodyLen = blockLen - 12;
+    m_pos += (size_t(blockLen) + 3) & ~size_t(3);
+
+    if (type == PCAPNG_IDB) {
+      readInterfaceBlock(body, bodyLen);
+    } else if (type == PCAPNG_EPB && bodyLen >= 20) {
+      uint32_t ifId = u32(body);
+      uint64_t ts = (uint64_t(u32(body + 4)) << 32) | u32(body + 8);
+      uint32_t capLen = u32(body + 12);
+      if (ifId >= m_interfaces.size() || capLen > bodyLen - 20) {
+        m_skipped++;
+        continue;
+      }
+      const Interface& itf = m_interfaces[ifId];
+      m_lastTimestamp = int64_t((__int128)ts * itf.ts_num / itf.ts_den);
+      out.timestamp_ns = m_lastTimestamp;
+      if (extractUdp(itf.link_type, m_data + body + 20, capLen, port, out)) {
+        return true;
+      }
+    } else if (type == PCAPNG_SPB && bodyLen >= 4 && !m_interfaces.empty()) {
+      // Simple packets carry no timestamp; reuse the previous one.
+      size_t capLen = min<size_t>(u32(body), bodyLen - 4);
+      out.timestamp_ns = m_lastTimestamp;
+      if (extractUdp(m_interfaces[0].link_type, m_data + body + 4, capLen, port, out)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void PcapReader::readInterfaceBlock(size_t body, size_t bodyLen) {
+  Interface itf;
+  if (bodyLen < 8) {
+    m_interfaces.push_back(itf);
+    return;
+  }
+  itf.link_type = u16(body);
+  size_t off = body + 8;
+  size_t end = body + bodyLen;
+  while (off + 4 <= end) {
+    uint16_t code = u16(off);
+    uint16_t len = u16(off + 2);
+    off += 4;
+    if (code == 0 || off + len > end) break;
+    if (code == 9 && len >= 1) {  // if_tsresol
+      uint8_t v = m_data[off];
+      int n = v & 0x7f;
+      if (v & 0x80) {
+        // 2^-n seconds per unit
+        itf.ts_num = 1000000000;
+        itf.ts_den = uint64_t(1) << min(n, 63);
+      } else {
+        // 10^-n seconds per unit
+        itf.ts_num = 1;
+        itf.ts_den = 1;
+        for (int i = n; i < 9; i++) itf.ts_num *= 10;
+        for (int i = 9; i < min(n, 19); i++) itf.ts_den *= 10;
+      }
+    }
+    off += (size_t(len) + 3) & ~size_t(3);
+  }
+  m_interfaces.push_back(itf);
+}
+
+bool PcapReader::extractUdp(uint32_t linkType, const uint8_t* frame, size_t len,
+                            uint16_t port, PcapDatagram& out) {
+  size_t off = 0;
+  int ipVersion = 0;
+  switch (linkType) {
+    case LINKTYPE_ETHERNET: {
+      if (len < 14) return false;
+      uint16_t etherType = be16(frame + 12);
+      off = 14;
+      while ((etherType == 0x8100 || etherType == 0x88a8) && off + 4 <= len) {
+        etherType = be16(frame + off + 2);
+        off += 4;
+      }
+      ipVersion = etherType == 0x0800 ? 4 : etherType == 0x86dd ? 6 : 0;
+      break;
+    }
+    case LINKTYPE_LINUX_SLL:
+    case LINKTYPE_LINUX_SLL2: {
+      size_t header = linkType == LINKTYPE_LINUX_SLL ? 16 : 20;
+      if (len < header) return false;
+      uint16_t proto = be16(frame + (linkType == LINKTYPE_LINUX_SLL ? 14 : 0));
+      off = header;
+      ipVersion = proto == 0x0800 ? 4 : proto == 0x86dd ? 6 : 0;
+      break;
+    }
+    case LINKTYPE_NULL: {
+      if (len < 4) return false;
+      // Address family in the capturing host's byte order.
+      uint8_t family = frame[0] ? frame[0] : frame[3];
+      off = 4;
+      ipVersion = family == 2 ? 4 : (family == 10 || family == 24 || family == 28 || family == 30) ? 6 : 0;
+      break;
+    }
+    case LINKTYPE_RAW:
+    case 12:
+    case 14:
+      ipVersion = len > 0 ? frame[0] >> 4 : 0;
+      break;
+    case LINKTYPE_IPV4:
+      ipVersion = 4;
+      break;
+    case LINKTYPE_IPV6:
+      ipVersion = 6;
+      break;
+    default:
+      break;
+  }
+
+  const uint8_t* ip = frame + off;
+  size_t ipLen = len - off;
+  const uint8_t* udp = nullptr;
+  size_t udpLen = 0;
+  if (ipVersion == 4) {
+    if (ipLen < 20 || (ip[0] >> 4) != 4) return false;
+    size_t ihl = size_t(ip[0] & 0x0f) * 4;
+    size_t total = min<size_t>(be16(ip + 2), ipLen);
+    if (ip[9] != 17 || ihl < 20 || total < ihl) return false;
+    if (be16(ip + 6) & 0x3fff) {  // MF set or non-zero offset
+      m_skipped++;
+      return false;
+    }
+    udp = ip + ihl;
+    udpLen = total - ihl;
+  } else if (ipVersion == 6) {
+    if (ipLen < 40 || (ip[0] >> 4) != 6) return false;
+    uint8_t next = ip[6];
+    size_t total = min<size_t>(size_t(be16(ip + 4)) + 40, ipLen);
+    size_t l4 = 40;
+    while ((next == 0 || next == 43 || next == 60) && l4 + 8 <= total) {
+      next = ip[l4];
+      l4 += (size_t(ip[l4 + 1]) + 1) * 8;
+    }
+    if (next != 17 || l4 > total) return false;
+    udp = ip + l4;
+    udpLen = total - l4;
+  } else {
+    return false;
+  }
+
+  if (udpLen < 8) return false;
+  if (port != 0 && be16(udp + 2) != port) return false;
+  size_t payloadLen = min<size_t>(be16(udp + 4), udpLen);
+  if (payloadLen < 8) return false;
+  out.payload = span<const byte>(reinterpret_cast<const byte*>(udp + 8), payloadLen - 8);
+  return true;
+}
+
+}  // namespace sflow
@@ -0,0 +1,69 @@
+#ifndef PCAP_READER_HPP
+#define PCAP_READER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace sflow {
+
+  struct PcapDatagram {
+    int64_t timestamp_ns = 0;  // capture time, ns since the epoch
+    // UDP payload; points into the mapped file and stays valid for the
+    // lifetime of the reader
+    std::span<const std::byte> payload;
+  };
+
+  // Extracts UDP datagrams from a classic pcap (µs or ns resolution, either
+  // byte order) or pcapng capture. The file is memory-mapped, so payloads are
+  // not copied. Supported link types: Ethernet (with VLAN tags), raw IPv4/
+  // IPv6, Linux cooked v1/v2 and BSD loopback. Non-first IPv4 fragments are
+  // skipped since they cannot be reassembled here.
+  class PcapReader {
+  public:
+    // Throws std::runtime_error if the file cannot be opened or is neither
+    // pcap nor pcapng.
+    explicit PcapReader(const std::string& path);
+    ~PcapReader();
+
+    PcapReader(const PcapReader&) = delete;
+    PcapReader& operator=(const PcapReader&) = delete;
+
+    // Next UDP datagram with destination `port` (0 accepts any port).
+    // Returns false at the end of the capture or at a truncated record.
+    bool next(PcapDatagram& out, uint16_t port);
+
+    uint64_t skippedPackets() const { return m_skipped; }
+
+  private:
+    struct Interface {
+      uint32_t link_type = 0;
+      // ns per timestamp unit as a rational: ts * num / den
+      uint64_t ts_num = 1000;
+      uint64_t ts_den = 1;
+    };
+
+    uint32_t u32(std::size_t off) const;
+    uint16_t u16(std::size_t off) const;
+    bool nextClassic(PcapDatagram& out, uint16_t port);
+    bool nextNg(PcapDatagram& out, uint16_t port);
+    void readInterfaceBlock(std::size_t body, std::size_t bodyLen);
+    bool extractUdp(uint32_t linkType, const uint8_t* frame, std::size_t len,
+                    uint16_t port, PcapDatagram& out);
+
+    const uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_pos = 0;
+    bool m_ng = false;
+    bool m_swapped = false;  // file byte order differs from ours
+    Interface m_classic;
+    std::vector<Interface> m_interfaces;  // pcapng section interfaces
+    int64_t m_lastTimestamp = 0;
+    uint64_t m_skipped = 0;
+  };
+
+} // namespace sflow
+
+#endif // PCAP_READER_HPP
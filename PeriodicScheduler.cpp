@@ -0,0 +1,176 @@
+#include "PeriodicScheduler.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Logger.hpp"
+
+using namespace std;
+
+bool setThreadAffinity(thread& thread, const vector<int>& cpus) {
+  if (cpus.empty()) return true;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      LOG_WARN("runtime", "CPU %d out of range; thread left unpinned", cpu);
+      return false;
+    }
+    CPU_SET(cpu, &set);
+  }
+  int err = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+  if (err != 0) {
+    LOG_WARN("runtime", "pthread_setaffinity_np: %s", strerror(err));
+    return false;
+  }
+  return true;
+}
+
+vector<int> parseCpuList(const string& list) {
+  vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == string::npos) end = list.size();
+    string range = list.substr(pos, end - pos);
+    size_t dash = range.find('-');
+    size_t used = 0;
+    int first = stoi(range, &used);
+    int last = first;
+    if (dash != string::npos && used == dash) {
+      string tail = range.substr(dash + 1);
+      last = stoi(tail, &used);
+      used += dash + 1;
+    }
+    if (used != range.size() || first < 0 || last < first) {
+      throw invalid_argument("Invalid CPU list: " + list);
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+PeriodicScheduler::~PeriodicScheduler() {
+  stop();
+}
+
+void PeriodicScheduler::start(const vector<int>& cpus) {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_running) return;
+    m_running = true;
+    // Deadlines that passed while stopped are not counted as missed.
+    auto now = Clock::now();
+    for (auto& entry : m_entries) {
+      if (entry->next < now) entry->next = now + chrono::milliseconds(entry->stats.period_ms);
+    }
+  }
+  m_thread = thread(&PeriodicScheduler::run, this);
+  setThreadAffinity(m_thread, cpus);
+}
+
+void PeriodicScheduler::stop() {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_wake.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+uint64_t PeriodicScheduler::add(const string& name, uint32_t periodMs, Task task) {
+  auto entry = make_unique<Entry>();
+  periodMs = max(1u, periodMs);
+  entry->task = move(task);
+  entry->next = Clock::now() + chrono::milliseconds(periodMs);
+  entry->stats.name = name;
+  entry->stats.period_ms = periodMs;
+  uint64_t id;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    id = entry->id = m_nextId++;
+    m_entries.push_back(move(entry));
+  }
+  m_wake.notify_all();
+  return id;
+}
+
+void PeriodicScheduler::remove(uint64_t id) {
+  unique_lock<mutex> lock(m_mutex);
+  m_idle.wait(lock, [&] { return m_current != id; });
+  auto it = find_if(m_entries.begin(), m_entries.end(),
+                    [&](const unique_ptr<Entry>& entry) { return entry->id == id; });
+  if (it != m_entries.end()) {
+    m_entries.erase(it);
+  }
+  lock.unlock();
+  m_wake.notify_all();
+}
+
+vector<PeriodicTaskStats> PeriodicScheduler::stats() const {
+  lock_guard<mutex> lock(m_mutex);
+  vector<PeriodicTaskStats> out;
+  for (const auto& entry : m_entries) {
+    out.push_back(entry->stats);
+  }
+  return out;
+}
+
+void PeriodicScheduler::run() {
+  unique_lock<mutex> lock(m_mutex);
+  while (m_running) {
+    Entry* due = nullptr;
+    for (auto& entry : m_entries) {
+      if (!due || entry->next < due->next) due = entry.get();
+    }
+    if (!due) {
+      m_wake.wait(lock);
+      continue;
+    }
+    if (Clock::now() < due->next) {
+      // By value: remove() may free the entry during the wait. Waking up
+      // early (add(), remove(), stop()) just re-evaluates.
+      Clock::time_point deadline = due->next;
+      m_wake.wait_until(lock, deadline);
+      continue;
+    }
+
+    // Entries are only erased by remove(), which waits for m_current, so
+    // `due` stays valid while the lock is released.
+    m_current = due->id;
+    lock.unlock();
+    auto begin = Clock::now();
+    try {
+      due->task();
+    }
+    catch (const exception& ex) {
+      LOG_WARN("runtime", "Task %s failed: %s", due->stats.name.c_str(), ex.what());
+    }
+    auto end = Clock::now();
+    lock.lock();
+    m_current = 0;
+
+    PeriodicTaskStats& stats = due->stats;
+    stats.runs++;
+    stats.max_lag_us = max<int64_t>(stats.max_lag_us,
+        chrono::duration_cast<chrono::microseconds>(begin - due->next).count());
+    stats.max_run_us = max<int64_t>(stats.max_run_us,
+        chrono::duration_cast<chrono::microseconds>(end - begin).count());
+    auto period = chrono::milliseconds(stats.period_ms);
+    due->next += period;
+    if (due->next <= end) {
+      auto skipped = (end - due->next) / period + 1;
+      stats.missed += uint64_t(skipped);
+      due->next += skipped * period;
+    }
+    m_idle.notify_all();
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef PERIODIC_SCHEDULER_HPP
+#define PERIODIC_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pins `thread` to `cpus`; an empty list leaves it to the kernel. Logs and
+// returns false if the CPUs cannot be used (e.g. outside the cpuset).
+bool setThreadAffinity(std::thread& thread, const std::vector<int>& cpus);
+
+// Parses a CPU list such as "0-3,8". Throws std::invalid_argument if
+// malformed.
+std::vector<int> parseCpuList(const std::string& list);
+
+struct PeriodicTaskStats {
+  std::string name;
+  uint32_t period_ms = 0;
+  uint64_t runs = 0;
+  // deadlines skipped because the previous run was still busy
+  uint64_t missed = 0;
+  // longest delay of a run past its deadline, and longest run
+  int64_t max_lag_us = 0;
+  int64_t max_run_us = 0;
+};
+
+// Runs periodic tasks on one thread. Deadlines are fixed multiples of the
+// period from when a task was added, so the time a run takes does not
+// shift the next one; a run that overruns skips the deadlines it missed
+// instead of running them back to back.
+//
+// stop() and remove() wait at most for the task currently running, never
+// for a timer. Neither may be called from inside a task. The scheduler can
+// be started again after stop(); tasks stay registered.
+class PeriodicScheduler {
+public:
+  using Task = std::function<void()>;
+
+  PeriodicScheduler() = default;
+  ~PeriodicScheduler();
+
+  PeriodicScheduler(const PeriodicScheduler&) = delete;
+  PeriodicScheduler& operator=(const PeriodicScheduler&) = delete;
+
+  // `cpus`: affinity of the scheduler thread, see setThreadAffinity().
+  void start(const std::vector<int>& cpus = {});
+  void stop();
+
+  // The first run is one period from now. Returns an id for remove().
+  uint64_t add(const std::string& name, uint32_t periodMs, Task task);
+  // Returns once the task is unregistered and not running.
+  void remove(uint64_t id);
+
+  std::vector<PeriodicTaskStats> stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    uint64_t id;
+    Task task;
+    Clock::time_point next;
+    PeriodicTaskStats stats;
+  };
+
+  void run();
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;  // tasks changed or stop()
+  std::condition_variable m_idle;  // a run finished
+  std::vector<std::unique_ptr<Entry>> m_entries;
+  uint64_t m_nextId = 1;
+  uint64_t m_current = 0;  // id of the running task, 0 if none
+  bool m_running = false;
+  std::thread m_thread;
+};
+
+#endif // PERIODIC_SCHEDULER_HPP
@@ -0,0 +1,876 @@
+#include "QueryServer.hpp"
+#include "Logger.hpp"
+#include "TopologyView.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+using namespace std;
+using namespace sflow;
+
+// Flush the response body once this much is buffered.
+#define QUERY_CHUNK_BYTES (64 * 1024)
+// Requests with a larger header block are rejected.
+#define QUERY_MAX_HEADER_BYTES 8192
+// The poller wakes up at least this often to observe m_running and idle
+// timeouts.
+#define QUERY_POLL_TIMEOUT_MS 200
+// A client that stalls mid-request or stops reading is dropped after this.
+#define QUERY_SOCKET_TIMEOUT_MS 5000
+// /flows sorts at least this many flows at a time, so the first pages of
+// a roll-up share one partial sort.
+#define QUERY_MIN_RANKED 1024
+
+namespace {
+
+int64_t steadyMs() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long epochMs(chrono::system_clock::time_point t) {
+  return chrono::duration_cast<chrono::milliseconds>(t.time_since_epoch()).count();
+}
+
+const char* statusText(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+  }
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+string urlDecode(const string& text) {
+  string out;
+  out.reserve(text.size());
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '+') {
+      out += ' ';
+    } else if (text[i] == '%' && i + 2 < text.size() && hexValue(text[i + 1]) >= 0 &&
+               hexValue(text[i + 2]) >= 0) {
+      out += char(hexValue(text[i + 1]) * 16 + hexValue(text[i + 2]));
+      i += 2;
+    } else {
+      out += text[i];
+    }
+  }
+  return out;
+}
+
+void parseTarget(const string& target, QueryRequest& request) {
+  size_t query = target.find('?');
+  request.path = urlDecode(target.substr(0, query));
+  if (query == string::npos) return;
+  size_t pos = query + 1;
+  while (pos <= target.size()) {
+    size_t amp = target.find('&', pos);
+    if (amp == string::npos) amp = target.size();
+    string pair = target.substr(pos, amp - pos);
+    if (!pair.empty()) {
+      size_t eq = pair.find('=');
+      string name = urlDecode(pair.substr(0, eq));
+      request.params[name] = eq == string::npos ? "" : urlDecode(pair.substr(eq + 1));
+    }
+    pos = amp + 1;
+  }
+}
+
+bool equalsIgnoreCase(const string& a, const char* b) {
+  return strcasecmp(a.c_str(), b) == 0;
+}
+
+void setTimeouts(int fd) {
+  timeval timeout;
+  timeout.tv_sec = QUERY_SOCKET_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (QUERY_SOCKET_TIMEOUT_MS % 1000) * 1000;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+}  // namespace
+
+bool QueryRequest::number(const string& name, uint64_t fallback, uint64_t& out) const {
+  const string* text = param(name);
+  if (!text) {
+    out = fallback;
+    return true;
+  }
+  if (text->empty() || !all_of(text->begin(), text->end(), [](char c) { return c >= '0' && c <= '9'; })) return false;
+  errno = 0;
+  out = strtoull(text->c_str(), nullptr, 10);
+  return errno == 0;
+}
+
+void QueryResponse::begin(int status, const char* contentType) {
+  if (m_started) return;
+  m_started = true;
+  char head[256];
+  int len = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n%s\r\n", status,
+                     statusText(status), contentType,
+                     m_chunked ? "Transfer-Encoding: chunked\r\n" : "Connection: close\r\n");
+  sendAll(head, size_t(len));
+}
+
+void QueryResponse::write(const char* data, size_t len) {
+  if (m_failed) return;
+  m_buffer.append(data, len);
+  if (m_buffer.size() >= QUERY_CHUNK_BYTES) flush();
+}
+
+void QueryResponse::printf(const char* format, ...) {
+  char text[512];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (len < 0) return;
+  if (size_t(len) < sizeof(text)) {
+    write(text, size_t(len));
+    return;
+  }
+  string longer(size_t(len) + 1, '\0');
+  va_start(args, format);
+  vsnprintf(longer.data(), longer.size(), format, args);
+  va_end(args);
+  write(longer.data(), size_t(len));
+}
+
+void QueryResponse::jsonString(const string& text) {
+  string out = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += char(c);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += char(c);
+    }
+  }
+  out += '"';
+  write(out);
+}
+
+void QueryResponse::end() {
+  flush();
+  if (m_chunked) sendAll("0\r\n\r\n", 5);
+}
+
+void QueryResponse::error(int status, const string& message) {
+  if (m_started) {
+    // The status line is already out; the client can only notice the
+    // truncated body.
+    m_failed = true;
+    return;
+  }
+  begin(status);
+  write("{\"error\":");
+  jsonString(message);
+  write("}\n");
+  end();
+}
+
+void QueryResponse::flush() {
+  if (m_failed || m_buffer.empty()) return;
+  if (m_chunked) {
+    char size[24];
+    int len = snprintf(size, sizeof(size), "%zx\r\n", m_buffer.size());
+    m_buffer.insert(0, size, size_t(len));
+    m_buffer += "\r\n";
+  }
+  sendAll(m_buffer.data(), m_buffer.size());
+  m_buffer.clear();
+}
+
+void QueryResponse::sendAll(const char* data, size_t len) {
+  while (len > 0 && !m_failed) {
+    ssize_t sent = ::send(m_fd, data, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      m_failed = true;
+      return;
+    }
+    data += sent;
+    len -= size_t(sent);
+  }
+}
+
+QueryServer::QueryServer(const QueryServerConfig& config, SFlowCollector* collector,
+                         TopologyManager* topology)
+    : m_config(config), m_collector(collector), m_topology(topology) {
+  m_config.threads = max(1, m_config.threads);
+  m_routes["/topology"] = [this](const QueryRequest& q, QueryResponse& r) { topologyInfo(q, r); };
+  m_routes["/links"] = [this](const QueryRequest& q, QueryResponse& r) { links(q, r); };
+  m_routes["/link"] = [this](const QueryRequest& q, QueryResponse& r) { link(q, r); };
+  m_routes["/link/flows"] = [this](const QueryRequest& q, QueryResponse& r) { linkFlows(q, r); };
+  m_routes["/flows"] = [this](const QueryRequest& q, QueryResponse& r) { flows(q, r); };
+  m_routes["/flow"] = [this](const QueryRequest& q, QueryResponse& r) { flow(q, r); };
+  m_routes["/metrics"] = [this](const QueryRequest& q, QueryResponse& r) { metrics(q, r); };
+}
+
+QueryServer::~QueryServer() {
+  stop();
+}
+
+void QueryServer::addRoute(const string& path, Handler handler) {
+  m_routes[path] = move(handler);
+}
+
+void QueryServer::start() {
+  const string& listen = m_config.listen;
+  if (listen.rfind("unix:", 0) == 0) {
+    string path = listen.substr(5);
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+      throw runtime_error("Invalid query server socket path: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    m_listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    // a stale socket file of a previous run would fail the bind
+    ::unlink(path.c_str());
+    if (m_listenFd < 0 || ::bind(m_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      string reason = strerror(errno);
+      if (m_listenFd >= 0) ::close(m_listenFd);
+      m_listenFd = -1;
+      throw runtime_error("Cannot bind query server to " + path + ": " + reason);
+    }
+  } else {
+    size_t colon = listen.rfind(':');
+    if (colon == string::npos) {
+      throw runtime_error("Query server address must be host:port or unix:<path>: " + listen);
+    }
+    string host = listen.substr(0, colon);
+    string port = listen.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+      host = host.substr(1, host.size() - 2);
+    }
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* result = nullptr;
+    int rc = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (rc != 0) {
+      throw runtime_error("Cannot resolve query server address " + listen + ": " + gai_strerror(rc));
+    }
+    string reason = "no address";
+    for (addrinfo* ai = result; ai && m_listenFd < 0; ai = ai->ai_next) {
+      int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol);
+      if (fd < 0) {
+        reason = strerror(errno);
+        continue;
+      }
+      int on = 1;
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (::bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        reason = strerror(errno);
+        ::close(fd);
+        continue;
+      }
+      m_listenFd = fd;
+    }
+    ::freeaddrinfo(result);
+    if (m_listenFd < 0) {
+      throw runtime_error("Cannot bind query server to " + listen + ": " + reason);
+    }
+  }
+  if (::listen(m_listenFd, SOMAXCONN) < 0) {
+    string reason = strerror(errno);
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    throw runtime_error("Cannot listen on " + listen + ": " + reason);
+  }
+  m_wakeFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_wakeFd < 0) {
+    string reason = strerror(errno);
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    throw runtime_error("eventfd: " + reason);
+  }
+
+  m_running.store(true);
+  m_pollThread = thread(&QueryServer::poller, this);
+  for (int i = 0; i < m_config.threads; i++) {
+    m_workers.emplace_back(&QueryServer::worker, this);
+  }
+  LOG_INFO("query", "Query server listening on %s with %d worker(s)", listen.c_str(),
+           m_config.threads);
+}
+
+void QueryServer::stop() {
+  if (!m_running.exchange(false)) return;
+  // The poller wakes up within QUERY_POLL_TIMEOUT_MS; workers finish the
+  // request they are serving. Taking the lock orders the store before any
+  // worker's predicate check, so none misses the notification.
+  {
+    lock_guard<mutex> lock(m_queueMutex);
+  }
+  m_queueCv.notify_all();
+  if (m_pollThread.joinable()) m_pollThread.join();
+  for (auto& t : m_workers) {
+    if (t.joinable()) t.join();
+  }
+  m_workers.clear();
+  for (auto& conn : m_ready) closeConnection(move(conn));
+  m_ready.clear();
+  for (auto& conn : m_handedBack) closeConnection(move(conn));
+  m_handedBack.clear();
+  ::close(m_listenFd);
+  ::close(m_wakeFd);
+  m_listenFd = m_wakeFd = -1;
+  if (m_config.listen.rfind("unix:", 0) == 0) {
+    ::unlink(m_config.listen.c_str() + 5);
+  }
+}
+
+void QueryServer::poller() {
+  vector<unique_ptr<Connection>> idle;
+  vector<unique_ptr<Connection>> waiting;
+  vector<pollfd> fds;
+  while (m_running.load()) {
+    fds.clear();
+    fds.push_back(pollfd{ m_listenFd, POLLIN, 0 });
+    fds.push_back(pollfd{ m_wakeFd, POLLIN, 0 });
+    for (const auto& conn : idle) {
+      fds.push_back(pollfd{ conn->fd, POLLIN, 0 });
+    }
+    int ready = ::poll(fds.data(), fds.size(), QUERY_POLL_TIMEOUT_MS);
+    if (ready < 0) {
+      if (errno != EINTR) LOG_WARN("query", "poll: %s", strerror(errno));
+      continue;
+    }
+    int64_t now = steadyMs();
+
+    // Connections with a request (or a hang-up) waiting go to the workers.
+    waiting.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < idle.size(); i++) {
+      if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+        waiting.push_back(move(idle[i]));
+      } else if (now - idle[i]->idle_since_ms >= int64_t(m_config.idle_timeout_ms)) {
+        closeConnection(move(idle[i]));
+      } else {
+        idle[kept++] = move(idle[i]);
+      }
+    }
+    idle.resize(kept);
+    if (!waiting.empty()) {
+      {
+        lock_guard<mutex> lock(m_queueMutex);
+        for (auto& conn : waiting) m_ready.push_back(move(conn));
+      }
+      m_queueCv.notify_all();
+    }
+
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      while (::read(m_wakeFd, &count, sizeof(count)) > 0) {}
+      lock_guard<mutex> lock(m_queueMutex);
+      for (auto& conn : m_handedBack) {
+        conn->idle_since_ms = now;
+        idle.push_back(move(conn));
+      }
+      m_handedBack.clear();
+    }
+
+    if (fds[0].revents & POLLIN) {
+      for (;;) {
+        int fd = ::accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_WARN("query", "accept: %s", strerror(errno));
+          }
+          break;
+        }
+        if (m_connections.load() >= m_config.max_connections) {
+          LOG_WARN("query", "Refusing connection: %zu open", m_connections.load());
+          ::close(fd);
+          continue;
+        }
+        setTimeouts(fd);
+        int on = 1;
+        // fails harmlessly on Unix domain sockets
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        m_connections++;
+        auto conn = make_unique<Connection>();
+        conn->fd = fd;
+        conn->idle_since_ms = now;
+        idle.push_back(move(conn));
+      }
+    }
+  }
+  for (auto& conn : idle) closeConnection(move(conn));
+}
+
+void QueryServer::worker() {
+  for (;;) {
+    unique_ptr<Connection> conn;
+    {
+      unique_lock<mutex> lock(m_queueMutex);
+      m_queueCv.wait(lock, [this] { return !m_running.load() || !m_ready.empty(); });
+      if (!m_running.load()) return;
+      conn = move(m_ready.front());
+      m_ready.pop_front();
+    }
+    if (serve(*conn)) {
+      handBack(move(conn));
+    } else {
+      closeConnection(move(conn));
+    }
+  }
+}
+
+bool QueryServer::serve(Connection& conn) {
+  for (;;) {
+    size_t headerEnd = conn.buffer.find("\r\n\r\n");
+    if (headerEnd == string::npos) {
+      if (conn.buffer.size() > QUERY_MAX_HEADER_BYTES) {
+        QueryResponse(conn.fd, false).error(431, "request header too large");
+        return false;
+      }
+      char data[4096];
+      ssize_t received = ::recv(conn.fd, data, sizeof(data), 0);
+      if (received < 0 && errno == EINTR) continue;
+      if (received <= 0) return false;
+      conn.buffer.append(data, size_t(received));
+      continue;
+    }
+
+    string head = conn.buffer.substr(0, headerEnd);
+    conn.buffer.erase(0, headerEnd + 4);
+
+    size_t lineEnd = head.find("\r\n");
+    string requestLine = head.substr(0, lineEnd);
+    size_t sp1 = requestLine.find(' ');
+    size_t sp2 = requestLine.rfind(' ');
+    if (sp1 == string::npos || sp2 == sp1) {
+      QueryResponse(conn.fd, false).error(400, "malformed request line");
+      return false;
+    }
+    string method = requestLine.substr(0, sp1);
+    string target = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+    string version = requestLine.substr(sp2 + 1);
+
+    bool close = false, hasBody = false;
+    size_t pos = lineEnd;
+    while (pos != string::npos && pos < head.size()) {
+      size_t next = head.find("\r\n", pos + 2);
+      string line = head.substr(pos + 2, next == string::npos ? string::npos : next - pos - 2);
+      pos = next;
+      size_t colon = line.find(':');
+      if (colon == string::npos) continue;
+      string name = line.substr(0, colon);
+      size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+      string value = valueStart == string::npos ? "" : line.substr(valueStart);
+      if (equalsIgnoreCase(name, "Connection")) {
+        close = equalsIgnoreCase(value, "close");
+      } else if ((equalsIgnoreCase(name, "Content-Length") && value != "0") ||
+                 equalsIgnoreCase(name, "Transfer-Encoding")) {
+        hasBody = true;
+      }
+    }
+
+    // HTTP/1.0 clients get an unchunked body delimited by closing the
+    // connection.
+    bool http11 = version == "HTTP/1.1";
+    if (method != "GET") {
+      QueryResponse(conn.fd, false).error(405, "only GET is supported");
+      return false;
+    }
+    if (hasBody) {
+      QueryResponse(conn.fd, false).error(400, "request bodies are not supported");
+      return false;
+    }
+    QueryResponse response(conn.fd, http11);
+    QueryRequest request;
+    parseTarget(target, request);
+    dispatch(request, response);
+    if (!response.started()) response.error(500, "no response");
+    if (response.failed() || !http11 || close) return false;
+
+    // Pipelined requests are served right away; otherwise the connection
+    // goes back to the poller until the next one arrives.
+    if (conn.buffer.find("\r\n\r\n") == string::npos) return true;
+  }
+}
+
+void QueryServer::dispatch(const QueryRequest& request, QueryResponse& response) {
+  auto it = m_routes.find(request.path);
+  if (it == m_routes.end()) {
+    response.error(404, "unknown path " + request.path);
+    return;
+  }
+  it->second(request, response);
+  if (response.started() && !response.failed()) response.end();
+}
+
+void QueryServer::handBack(unique_ptr<Connection> conn) {
+  {
+    lock_guard<mutex> lock(m_queueMutex);
+    m_handedBack.push_back(move(conn));
+  }
+  uint64_t one = 1;
+  if (::write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    LOG_WARN("query", "eventfd write: %s", strerror(errno));
+  }
+}
+
+void QueryServer::closeConnection(unique_ptr<Connection> conn) {
+  if (!conn) return;
+  ::close(conn->fd);
+  m_connections--;
+}
+
+void QueryServer::topologyInfo(const QueryRequest&, QueryResponse& response) {
+  if (!m_topology) return response.error(503, "no topology source");
+  auto snapshot = m_topology->getSnapshot();
+  if (!snapshot) return response.error(503, "no topology yet");
+  auto interfaces = m_topology->linkUtilization().current();
+  response.begin(200);
+  response.printf("{\"version\":%llu,\"timestamp_ms\":%lld,\"switches\":%zu,\"hosts\":%zu,"
+                  "\"links\":%zu,\"bound_interfaces\":%zu}\n",
+                  (unsigned long long)snapshot->version, epochMs(snapshot->timestamp),
+                  snapshot->switches.size(), snapshot->hosts.size(), snapshot->edges.size(),
+                  interfaces ? interfaces->targets.size() : size_t(0));
+}
+
+namespace {
+
+void writeSample(QueryResponse& response, const UtilizationSample& sample) {
+  response.printf("{\"timestamp_ns\":%lld,\"in_bps\":%llu,\"out_bps\":%llu,\"if_speed\":%llu}",
+                  (long long)sample.timestamp_ns, (unsigned long long)sample.in_bps,
+                  (unsigned long long)sample.out_bps, (unsigned long long)sample.if_speed);
+}
+
+// {"ewma_5s":..,"ewma_60s":..,"window_1s":..,"window_10s":..,"window_60s":..};
+// the EWMA names follow the default half-lives.
+void writeSmoothed(QueryResponse& response, const SmoothedRate& rate) {
+  response.printf("{\"ewma_5s\":%llu,\"ewma_60s\":%llu,\"window_1s\":%llu,"
+                  "\"window_10s\":%llu,\"window_60s\":%llu}",
+                  (unsigned long long)rate.ewma[0], (unsigned long long)rate.ewma[1],
+                  (unsigned long long)rate.window[0], (unsigned long long)rate.window[1],
+                  (unsigned long long)rate.window[2]);
+}
+
+// {"edge_id":..,"ends":[{"dpid":..,"port":..,"latest"|"samples":..,
+// "smoothed_in":..,"smoothed_out":..},..]}
+void writeLink(QueryResponse& response, const TopologyView& view, uint32_t edge, bool history) {
+  response.printf("{\"edge_id\":%llu,\"ends\":[", (unsigned long long)view.edgeId(edge));
+  const auto& utilization = view.utilization(edge);
+  for (int end = 0; end < 2; end++) {
+    response.write(end ? ",{\"dpid\":" : "{\"dpid\":");
+    response.jsonString(view.dpid(view.edgeNode(edge, end)));
+    response.printf(",\"port\":%u", view.edgePort(edge, end));
+    if (history) {
+      UtilizationSample samples[LINK_UTILIZATION_HISTORY];
+      size_t count = utilization ? utilization->ends[end].recent(samples, LINK_UTILIZATION_HISTORY) : 0;
+      response.write(",\"samples\":[");
+      for (size_t i = 0; i < count; i++) {
+        if (i) response.write(",");
+        writeSample(response, samples[i]);
+      }
+      response.write("]");
+    } else {
+      UtilizationSample sample;
+      if (utilization && utilization->ends[end].latest(sample)) {
+        response.write(",\"latest\":");
+        writeSample(response, sample);
+      }
+    }
+    if (utilization) {
+      SmoothedRate in, out;
+      utilization->ends[end].smoothed(in, out);
+      response.write(",\"smoothed_in\":");
+      writeSmoothed(response, in);
+      response.write(",\"smoothed_out\":");
+      writeSmoothed(response, out);
+    }
+    response.write("}");
+  }
+  response.write("]}");
+}
+
+// Address fields and rate of one flow, without the enclosing braces.
+void writeFlowFields(QueryResponse& response, const FlowRate& flow) {
+  IpAddress src, dst;
+  src.version = dst.version = flow.key.ip_version;
+  src.bytes = flow.key.src_ip;
+  dst.bytes = flow.key.dst_ip;
+  response.printf("\"src\":\"%s\",\"dst\":\"%s\",\"src_port\":%u,\"dst_port\":%u,"
+                  "\"protocol\":%u,\"rate\":%llu",
+                  src.toString().c_str(), dst.toString().c_str(), flow.key.src_port,
+                  flow.key.dst_port, flow.key.protocol, (unsigned long long)flow.rate);
+  if (flow.rate_error) {
+    response.printf(",\"rate_error\":%llu", (unsigned long long)flow.rate_error);
+  }
+}
+
+}  // namespace
+
+void QueryServer::links(const QueryRequest& request, QueryResponse& response) {
+  if (!m_topology) return response.error(503, "no topology source");
+  auto snapshot = m_topology->getSnapshot();
+  if (!snapshot || !snapshot->view) return response.error(503, "no topology yet");
+  uint64_t offset, limit;
+  if (!request.number("offset", 0, offset) || !request.number("limit", m_config.default_limit, limit)) {
+    return response.error(400, "offset and limit must be numbers");
+  }
+  const TopologyView& view = *snapshot->view;
+  size_t total = view.linkCount();
+  size_t first = size_t(min<uint64_t>(offset, total));
+  size_t last = limit == 0 ? total : size_t(min<uint64_t>(first + limit, total));
+
+  response.begin(200);
+  response.printf("{\"version\":%llu,\"total\":%zu,\"offset\":%zu,\"links\":[",
+                  (unsigned long long)snapshot->version, total, first);
+  for (size_t edge = first; edge < last && !response.failed(); edge++) {
+    if (edge != first) response.write(",\n");
+    writeLink(response, view, uint32_t(edge), false);
+  }
+  if (last < total) {
+    response.printf("],\"next_offset\":%zu}\n", last);
+  } else {
+    response.write("],\"next_offset\":null}\n");
+  }
+}
+
+void QueryServer::link(const QueryRequest& request, QueryResponse& response) {
+  if (!m_topology) return response.error(503, "no topology source");
+  auto snapshot = m_topology->getSnapshot();
+  if (!snapshot || !snapshot->view) return response.error(503, "no topology yet");
+  uint64_t id;
+  if (!request.param("id") || !request.number("id", 0, id)) {
+    return response.error(400, "id must be an edge id");
+  }
+  uint32_t edge = snapshot->view->edgeOf(id);
+  if (edge == TopologyView::NO_EDGE) return response.error(404, "no such link");
+  response.begin(200);
+  response.printf("{\"version\":%llu,\"link\":", (unsigned long long)snapshot->version);
+  writeLink(response, *snapshot->view, edge, true);
+  response.write("}\n");
+}
+
+void QueryServer::linkFlows(const QueryRequest& request, QueryResponse& response) {
+  if (!m_correlator) return response.error(503, "no flow correlation");
+  uint64_t id, limit;
+  if (!request.param("id") || !request.number("id", 0, id)) {
+    return response.error(400, "id must be an edge id");
+  }
+  if (!request.number("limit", m_config.default_limit, limit)) {
+    return response.error(400, "limit must be a number");
+  }
+  vector<FlowOnEdge> flows;
+  m_correlator->flowsOnEdge(id, flows, size_t(limit));
+  EdgeLoad load = m_correlator->edgeLoad(id);
+  response.begin(200);
+  response.printf("{\"version\":%llu,\"edge_id\":%llu,\"rate\":%llu,\"total\":%u,\"flows\":[",
+                  (unsigned long long)m_correlator->ratesVersion(), (unsigned long long)id,
+                  (unsigned long long)load.rate, load.flows);
+  for (size_t i = 0; i < flows.size() && !response.failed(); i++) {
+    FlowRate flow;
+    flow.key = flows[i].key;
+    flow.rate = flows[i].rate;
+    response.write(i ? ",\n{" : "{");
+    writeFlowFields(response, flow);
+    response.write("}");
+  }
+  response.write("]}\n");
+}
+
+shared_ptr<const vector<uint32_t>> QueryServer::ranked(
+    const shared_ptr<const RateSnapshot>& snapshot, size_t needed) {
+  {
+    lock_guard<mutex> lock(m_rankMutex);
+    if (m_rankedSnapshot == snapshot && m_rankedPrefix >= needed) return m_ranked;
+  }
+  // Sorted outside the lock; concurrent requests for a new roll-up may sort
+  // twice, which is cheaper than making every reader wait.
+  const vector<FlowRate>& flows = snapshot->flows;
+  size_t prefix = min(flows.size(), max<size_t>(needed, QUERY_MIN_RANKED));
+  auto order = make_shared<vector<uint32_t>>(flows.size());
+  iota(order->begin(), order->end(), 0);
+  partial_sort(order->begin(), order->begin() + prefix, order->end(),
+               [&flows](uint32_t a, uint32_t b) {
+                 return flows[a].rate != flows[b].rate ? flows[a].rate > flows[b].rate : a < b;
+               });
+  lock_guard<mutex> lock(m_rankMutex);
+  if (m_rankedSnapshot != snapshot || m_rankedPrefix < prefix) {
+    m_rankedSnapshot = snapshot;
+    m_ranked = order;
+    m_rankedPrefix = prefix;
+  }
+  return order;
+}
+
+void QueryServer::flows(const QueryRequest& request, QueryResponse& response) {
+  if (!m_collector) return response.error(503, "no flow source");
+  auto snapshot = m_collector->getRateSnapshot();
+  if (!snapshot) return response.error(503, "no roll-up yet");
+  uint64_t offset, limit;
+  if (!request.number("offset", 0, offset) || !request.number("limit", m_config.default_limit, limit)) {
+    return response.error(400, "offset and limit must be numbers");
+  }
+  size_t total = snapshot->flows.size();
+  size_t first = size_t(min<uint64_t>(offset, total));
+  size_t last = limit == 0 ? total : size_t(min<uint64_t>(first + limit, total));
+  auto order = ranked(snapshot, last);
+
+  response.begin(200);
+  response.printf("{\"version\":%llu,\"timestamp_ms\":%lld,\"total\":%zu,\"offset\":%zu,\"flows\":[",
+                  (unsigned long long)snapshot->version, epochMs(snapshot->timestamp), total, first);
+  for (size_t i = first; i < last && !response.failed(); i++) {
+    const FlowRate& flow = snapshot->flows[(*order)[i]];
+    response.write(i != first ? ",\n{" : "{");
+    writeFlowFields(response, flow);
+    response.printf(",\"hops\":%u}", flow.hop_count);
+  }
+  if (last < total) {
+    response.printf("],\"next_offset\":%zu}\n", last);
+  } else {
+    response.write("],\"next_offset\":null}\n");
+  }
+}
+
+void QueryServer::flow(const QueryRequest& request, QueryResponse& response) {
+  if (!m_collector) return response.error(503, "no flow source");
+  const string* srcText = request.param("src");
+  const string* dstText = request.param("dst");
+  IpAddress src, dst;
+  if (!srcText || !dstText || !IpAddress::parse(*srcText, src) ||
+      !IpAddress::parse(*dstText, dst) || src.version != dst.version) {
+    return response.error(400, "src and dst must be addresses of the same family");
+  }
+  uint64_t srcPort, dstPort, protocol;
+  if (!request.param("src_port") || !request.param("dst_port") ||
+      !request.number("src_port", 0, srcPort) || !request.number("dst_port", 0, dstPort) ||
+      !request.number("protocol", IPPROTO_TCP, protocol) ||
+      srcPort > UINT16_MAX || dstPort > UINT16_MAX || protocol > UINT8_MAX) {
+    return response.error(400, "src_port, dst_port and protocol must be valid numbers");
+  }
+  FlowKey key;
+  key.ip_version = src.version;
+  key.src_ip = src.bytes;
+  key.dst_ip = dst.bytes;
+  key.src_port = uint16_t(srcPort);
+  key.dst_port = uint16_t(dstPort);
+  key.protocol = uint8_t(protocol);
+
+  auto snapshot = m_collector->getRateSnapshot();
+  if (!snapshot) return response.error(503, "no roll-up yet");
+  const FlowRate* rate = snapshot->find(key);
+  if (!rate) return response.error(404, "flow not seen in the latest roll-up");
+  shared_ptr<const InterfaceMap> interfaces;
+  if (m_topology) interfaces = m_topology->linkUtilization().current();
+
+  response.begin(200);
+  response.printf("{\"version\":%llu,\"timestamp_ms\":%lld,",
+                  (unsigned long long)snapshot->version, epochMs(snapshot->timestamp));
+  writeFlowFields(response, *rate);
+  if (!snapshot->summary) {
+    response.write(",\"smoothed\":");
+    writeSmoothed(response, rate->smoothed);
+  }
+  response.write(",\"hops\":[");
+  for (uint8_t i = 0; i < rate->hop_count; i++) {
+    const HopRate& hop = rate->hops[i];
+    IpAddress agent = m_collector->agentAddress(hopAgentId(hop.id));
+    uint32_t ifIndex = hopIfIndex(hop.id);
+    response.printf("%s{\"agent\":\"%s\",\"if_index\":%u,\"rate\":%llu", i ? "," : "",
+                    agent.toString().c_str(), ifIndex, (unsigned long long)hop.rate);
+    const InterfaceMap::Target* target = interfaces ? interfaces->find(agent, ifIndex) : nullptr;
+    if (target) {
+      response.printf(",\"edge_id\":%llu,\"end\":%u", (unsigned long long)target->edge_id,
+                      target->end);
+    }
+    response.write("}");
+  }
+  response.write("]}\n");
+}
+
+void QueryServer::metrics(const QueryRequest&, QueryResponse& response) {
+  if (!m_collector) return response.error(503, "no flow source");
+  FlowTableStats flows = m_collector->getFlowTableStats();
+  IngestStats ingest = m_collector->getIngestStats();
+  response.begin(200, "text/plain; version=0.0.4");
+  const pair<const char*, uint64_t> gauges[] = {
+    { "sflow_flows", flows.flows },
+    { "sflow_flow_memory_bytes", flows.memory_bytes },
+    { "sflow_sub_agents", ingest.sub_agents },
+    { "sflow_interfaces", ingest.interfaces },
+  };
+  for (const auto& [name, value] : gauges) {
+    response.printf("# TYPE %s gauge\n%s %llu\n", name, name, (unsigned long long)value);
+  }
+  const pair<const char*, uint64_t> counters[] = {
+    { "sflow_flows_evicted_idle_total", flows.evicted_idle },
+    { "sflow_flows_evicted_active_total", flows.evicted_active },
+    { "sflow_flows_evicted_budget_total", flows.evicted_budget },
+    { "sflow_new_flow_samples_dropped_total", flows.dropped_new_flows },
+    { "sflow_datagrams_total", ingest.datagrams },
+    { "sflow_datagram_bytes_total", ingest.bytes },
+    { "sflow_decode_errors_total", ingest.decode_errors },
+    { "sflow_socket_drops_total", ingest.socket_drops },
+    { "sflow_counter_samples_total", ingest.counter_samples },
+    { "sflow_counter_wraps_total", ingest.counter_wraps },
+    { "sflow_counter_resets_total", ingest.counter_resets },
+    { "sflow_counter_samples_dropped_total", ingest.counter_dropped },
+  };
+  for (const auto& [name, value] : counters) {
+    response.printf("# TYPE %s counter\n%s %llu\n", name, name, (unsigned long long)value);
+  }
+
+  // Per sub-agent series. `lost` can go down again when a late datagram
+  // fills a gap, hence a gauge.
+  vector<SubAgentHealth> subAgents = m_collector->getSubAgentHealth();
+  const struct {
+    const char* name;
+    const char* type;
+    uint64_t SubAgentHealth::*field;
+  } series[] = {
+    { "sflow_agent_datagrams_total", "counter", &SubAgentHealth::datagrams },
+    { "sflow_agent_sequence_lost", "gauge", &SubAgentHealth::lost },
+    { "sflow_agent_reordered_total", "counter", &SubAgentHealth::reordered },
+    { "sflow_agent_duplicates_total", "counter", &SubAgentHealth::duplicates },
+    { "sflow_agent_restarts_total", "counter", &SubAgentHealth::restarts },
+  };
+  for (const auto& s : series) {
+    response.printf("# TYPE %s %s\n", s.name, s.type);
+    for (const SubAgentHealth& health : subAgents) {
+      response.printf("%s{agent=\"%s\",sub_agent=\"%u\"} %llu\n", s.name,
+                      health.agent.toString().c_str(), health.sub_agent_id,
+                      (unsigned long long)(health.*s.field));
+    }
+  }
+}
@@ -0,0 +1,178 @@
+#ifndef QUERY_SERVER_HPP
+#define QUERY_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "FlowPathCorrelator.hpp"
+#include "RateSnapshot.hpp"
+#include "SFlowCollector.hpp"
+#include "TopologyManager.hpp"
+
+struct QueryServerConfig {
+  // "host:port" to listen on TCP, or "unix:<path>" for a Unix domain socket
+  std::string listen = "127.0.0.1:8081";
+  // requests are served by this many threads; idle connections cost none
+  int threads = 2;
+  // keep-alive connections idle for this long are closed
+  uint32_t idle_timeout_ms = 30000;
+  // further connections are refused
+  size_t max_connections = 256;
+  // page size of list endpoints when the request gives no `limit`
+  uint32_t default_limit = 100;
+};
+
+struct QueryRequest {
+  std::string path;
+  std::unordered_map<std::string, std::string> params;
+
+  const std::string* param(const std::string& name) const {
+    auto it = params.find(name);
+    return it == params.end() ? nullptr : &it->second;
+  }
+  // `fallback` if the parameter is missing; false if it is not a number.
+  bool number(const std::string& name, uint64_t fallback, uint64_t& out) const;
+};
+
+// One streamed response. Headers go out with begin(); the body is buffered
+// and sent in chunks (chunked transfer encoding) as it grows, so its size
+// is not bounded by memory. Write errors are remembered and make further
+// writes no-ops.
+class QueryResponse {
+public:
+  QueryResponse(int fd, bool chunked) : m_fd(fd), m_chunked(chunked) {}
+
+  void begin(int status, const char* contentType = "application/json");
+  void write(const char* data, size_t len);
+  void write(const std::string& text) { write(text.data(), text.size()); }
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  // Appends `text` as a quoted, escaped JSON string.
+  void jsonString(const std::string& text);
+  void end();
+
+  // Complete JSON error response {"error": message}.
+  void error(int status, const std::string& message);
+
+  bool started() const { return m_started; }
+  bool failed() const { return m_failed; }
+
+private:
+  void flush();
+  void sendAll(const char* data, size_t len);
+
+  int m_fd;
+  bool m_chunked;
+  bool m_started = false;
+  bool m_failed = false;
+  std::string m_buffer;
+};
+
+// Embedded read-only HTTP/1.1 server for dashboards and scripts. Every
+// answer comes from published snapshots (SFlowCollector::getRateSnapshot(),
+// TopologyManager::getSnapshot() and the interface map), so polling never
+// takes a collector or topology lock. Endpoints, all GET:
+//
+//   /topology                 version and size of the current topology
+//   /links?offset=&limit=     links with the latest utilization per end
+//   /link?id=<edge_id>        one link with its recent samples per end
+//   /link/flows?id=&limit=    flows loading a link, highest rate first
+//                             (needs setCorrelator())
+//   /flows?offset=&limit=     flows of the latest roll-up, highest rate first
+//   /flow?src=&dst=&src_port=&dst_port=[&protocol=6]
+//                             one flow with its per-hop rates and links
+//   /metrics                  collector counters in Prometheus text format:
+//                             flow table, ingest and per sub-agent health
+//
+// Except /metrics, all answer JSON. List endpoints page with offset/limit (limit=0 returns everything) and
+// report `next_offset` while more remain. Bodies are streamed, so even a
+// full dump of a million flows is written out piecewise.
+//
+// One poll() thread owns the listening socket and all idle keep-alive
+// connections; a connection with a request waiting is handed to one of the
+// worker threads, which serves it and hands it back.
+class QueryServer {
+public:
+  using Handler = std::function<void(const QueryRequest&, QueryResponse&)>;
+
+  // Either source may be null; its endpoints then answer 503.
+  QueryServer(const QueryServerConfig& config, sflow::SFlowCollector* collector,
+              TopologyManager* topology);
+  ~QueryServer();
+
+  // Adds or replaces the handler of `path`. Call before start().
+  void addRoute(const std::string& path, Handler handler);
+
+  // Source of /link/flows; must be kept updated by the caller and outlive
+  // the server. Call before start().
+  void setCorrelator(const sflow::FlowPathCorrelator* correlator) { m_correlator = correlator; }
+
+  // Throws std::runtime_error if the address cannot be bound.
+  void start();
+  void stop();
+
+private:
+  struct Connection {
+    int fd = -1;
+    std::string buffer;  // received, not yet consumed
+    int64_t idle_since_ms = 0;
+  };
+
+  void poller();
+  void worker();
+  // Serves the requests buffered or waiting on `conn`; false once the
+  // connection must be closed.
+  bool serve(Connection& conn);
+  void dispatch(const QueryRequest& request, QueryResponse& response);
+  void handBack(std::unique_ptr<Connection> conn);
+  void closeConnection(std::unique_ptr<Connection> conn);
+
+  void topologyInfo(const QueryRequest& request, QueryResponse& response);
+  void links(const QueryRequest& request, QueryResponse& response);
+  void link(const QueryRequest& request, QueryResponse& response);
+  void linkFlows(const QueryRequest& request, QueryResponse& response);
+  void flows(const QueryRequest& request, QueryResponse& response);
+  void flow(const QueryRequest& request, QueryResponse& response);
+  void metrics(const QueryRequest& request, QueryResponse& response);
+
+  // Flow indexes of `snapshot` whose first `needed` (at least) are the
+  // flows with the highest rates, in decreasing order. Shared by all
+  // requests for the same roll-up until a deeper page is asked for.
+  std::shared_ptr<const std::vector<uint32_t>> ranked(
+      const std::shared_ptr<const sflow::RateSnapshot>& snapshot, size_t needed);
+
+  QueryServerConfig m_config;
+  sflow::SFlowCollector* m_collector;
+  TopologyManager* m_topology;
+  const sflow::FlowPathCorrelator* m_correlator = nullptr;
+  std::unordered_map<std::string, Handler> m_routes;
+
+  int m_listenFd = -1;
+  int m_wakeFd = -1;  // eventfd, signals handed-back connections to the poller
+  std::atomic<bool> m_running{false};
+  std::atomic<size_t> m_connections{0};
+
+  std::mutex m_queueMutex;
+  std::condition_variable m_queueCv;
+  std::deque<std::unique_ptr<Connection>> m_ready;     // poller -> workers
+  std::vector<std::unique_ptr<Connection>> m_handedBack;  // workers -> poller
+
+  std::mutex m_rankMutex;
+  std::shared_ptr<const sflow::RateSnapshot> m_rankedSnapshot;
+  std::shared_ptr<const std::vector<uint32_t>> m_ranked;
+  size_t m_rankedPrefix = 0;
+
+  std::thread m_pollThread;
+  std::vector<std::thread> m_workers;
+};
+
+#endif // QUERY_SERVER_HPP
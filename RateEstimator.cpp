@@ -0,0 +1,90 @@
+#include "RateEstimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace sflow {
+
+namespace {
+
+struct WindowLayout {
+  int64_t bucket_ms;
+  int buckets;
+  int first;  // index of the window's first bucket in m_buckets
+};
+
+constexpr WindowLayout WINDOWS[RATE_WINDOW_COUNT] = {
+  { 500, 2, 0 },
+  { 2000, 5, 2 },
+  { 12000, 5, 7 },
+};
+static_assert(WINDOWS[RATE_WINDOW_COUNT - 1].first + WINDOWS[RATE_WINDOW_COUNT - 1].buckets ==
+              RATE_WINDOW_BUCKETS, "window layout must match RATE_WINDOW_BUCKETS");
+static_assert(sizeof(RateEstimator) == 64, "RateEstimator must stay compact");
+
+// Bucket holding the instant just before `t`, so that an interval ending
+// on a bucket boundary does not open the next bucket.
+int64_t lastBucket(int64_t t, int64_t width) {
+  return (t - 1) / width;
+}
+
+}  // namespace
+
+void RateEstimator::add(int64_t fromMs, int64_t toMs, double rateBps,
+                        const RateEstimatorConfig& config) {
+  bool first = m_updatedMs == 0;
+  if (!first) fromMs = max(fromMs, m_updatedMs);
+  if (toMs <= fromMs) return;
+
+  for (int i = 0; i < RATE_EWMA_COUNT; i++) {
+    double halfLife = max(1u, config.half_life_ms[i]);
+    if (first) {
+      // Starting from zero would understate every new flow for a while.
+      m_ewma[i] = float(rateBps);
+      continue;
+    }
+    // The idle gap since the last update decays without adding anything.
+    double keep = exp2(-double(toMs - fromMs) / halfLife);
+    double decay = fromMs == m_updatedMs ? keep : exp2(-double(toMs - m_updatedMs) / halfLife);
+    m_ewma[i] = float(m_ewma[i] * decay + rateBps * (1 - keep));
+  }
+
+  for (const WindowLayout& window : WINDOWS) {
+    float* buckets = m_buckets.data() + window.first;
+    int64_t newest = lastBucket(toMs, window.bucket_ms);
+    // Buckets entered since the last update start empty.
+    int64_t previous = first ? newest - window.buckets : lastBucket(m_updatedMs, window.bucket_ms);
+    for (int64_t b = max(previous + 1, newest - window.buckets + 1); b <= newest; b++) {
+      buckets[b % window.buckets] = 0;
+    }
+    int64_t oldest = max(fromMs / window.bucket_ms, newest - window.buckets + 1);
+    for (int64_t b = oldest; b <= newest; b++) {
+      int64_t begin = max(fromMs, b * window.bucket_ms);
+      int64_t end = min(toMs, (b + 1) * window.bucket_ms);
+      buckets[b % window.buckets] += float(rateBps * double(end - begin) / 1000);
+    }
+  }
+  m_updatedMs = toMs;
+}
+
+SmoothedRate RateEstimator::read() const {
+  SmoothedRate rate;
+  for (int i = 0; i < RATE_EWMA_COUNT; i++) {
+    rate.ewma[i] = uint64_t(m_ewma[i]);
+  }
+  if (m_updatedMs == 0) return rate;
+  for (int w = 0; w < RATE_WINDOW_COUNT; w++) {
+    const WindowLayout& window = WINDOWS[w];
+    double bits = 0;
+    for (int b = 0; b < window.buckets; b++) {
+      bits += m_buckets[window.first + b];
+    }
+    int64_t start = (lastBucket(m_updatedMs, window.bucket_ms) - window.buckets + 1) * window.bucket_ms;
+    rate.window[w] = uint64_t(bits * 1000 / double(m_updatedMs - start));
+  }
+  return rate;
+}
+
+}  // namespace sflow
@@ -0,0 +1,57 @@
+#ifndef RATE_ESTIMATOR_HPP
+#define RATE_ESTIMATOR_HPP
+
+#include <array>
+#include <cstdint>
+
+#define RATE_EWMA_COUNT 2
+// sliding windows of 1 s, 10 s and 60 s
+#define RATE_WINDOW_COUNT 3
+// buckets of all windows together, see RateEstimator.cpp
+#define RATE_WINDOW_BUCKETS 12
+
+namespace sflow {
+
+  struct RateEstimatorConfig {
+    // half-lives of the exponentially weighted moving averages
+    std::array<uint32_t, RATE_EWMA_COUNT> half_life_ms = { 5000, 60000 };
+  };
+
+  // Smoothed rates of one flow or link direction, bits/s.
+  struct SmoothedRate {
+    std::array<uint64_t, RATE_EWMA_COUNT> ewma{};
+    // averages over the last 1 s, 10 s and 60 s
+    std::array<uint64_t, RATE_WINDOW_COUNT> window{};
+  };
+
+  // O(1) multi-resolution rate estimator fed with piecewise-constant rates:
+  // one rate per roll-up for a flow, one per counter sample for a link.
+  // Keeps one EWMA per configured half-life and three fixed-bucket sliding
+  // windows: 2 x 500 ms, 5 x 2 s and 5 x 12 s. A window average covers its
+  // full buckets plus the current partial one, so the 10 s average spans 8
+  // to 10 s, exactly 10 s when updated on a 2 s boundary.
+  //
+  // Updates are lazy: time without an update counts as zero rate and is
+  // caught up by the next add(), so idle flows cost nothing. read() gives
+  // the rates as of the last update. 64 bytes, kept next to the data it
+  // smooths.
+  class RateEstimator {
+  public:
+    // Accounts `rateBps` held over [fromMs, toMs]. Intervals must not go
+    // back in time; the part overlapping earlier ones is ignored.
+    void add(int64_t fromMs, int64_t toMs, double rateBps, const RateEstimatorConfig& config);
+
+    SmoothedRate read() const;
+
+    // 0 until the first add()
+    int64_t updatedMs() const { return m_updatedMs; }
+
+  private:
+    std::array<float, RATE_EWMA_COUNT> m_ewma{};
+    std::array<float, RATE_WINDOW_BUCKETS> m_buckets{};  // bits per bucket
+    int64_t m_updatedMs = 0;
+  };
+
+} // namespace sflow
+
+#endif // RATE_ESTIMATOR_HPP
@@ -0,0 +1,380 @@
+#include "RateHistory.hpp"
+#include "Logger.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace sflow {
+
+#define HISTORY_MAGIC "NDTRH001"
+#define HISTORY_HEADER_BYTES 4096
+
+namespace {
+
+// First page of every segment file. `count` and `key_count` are the
+// committed records and keys; readers load them with acquire and never look
+// past them.
+struct SegmentHeader {
+  char magic[8];
+  uint64_t capacity;      // records
+  uint64_t key_capacity;  // flow keys
+  uint64_t count;
+  uint64_t key_count;
+  int64_t first_ns;
+  int64_t last_ns;
+};
+static_assert(sizeof(SegmentHeader) <= HISTORY_HEADER_BYTES, "segment header too large");
+
+// timestamp, entity and rate
+constexpr size_t RECORD_BYTES = sizeof(int64_t) + 2 * sizeof(uint64_t);
+
+struct KeyRecord {
+  uint64_t entity;
+  FlowKey key;
+};
+
+string segmentName(uint64_t seq) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.seg", (unsigned long long)seq);
+  return name;
+}
+
+uint64_t loadAcquire(uint64_t& field) {
+  return atomic_ref<uint64_t>(field).load(memory_order_acquire);
+}
+
+}  // namespace
+
+// One mapped segment file. Columns follow the header page: timestamps,
+// entities and rates, `capacity` each, then the key records.
+class RateHistory::Segment {
+public:
+  // Creates and maps a new segment of `bytes`; throws std::runtime_error.
+  static shared_ptr<Segment> create(const string& path, uint64_t seq, size_t bytes) {
+    size_t usable = bytes > HISTORY_HEADER_BYTES ? bytes - HISTORY_HEADER_BYTES : 0;
+    uint64_t capacity = usable * 7 / 8 / RECORD_BYTES;
+    uint64_t keyCapacity = (usable - capacity * RECORD_BYTES) / sizeof(KeyRecord);
+    if (capacity == 0 || keyCapacity == 0) {
+      throw runtime_error("history segment size too small: " + to_string(bytes));
+    }
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+      throw runtime_error("cannot create " + path + ": " + strerror(errno));
+    }
+    // Allocating up front turns a full disk into an error here instead of
+    // a SIGBUS on some later store.
+    int err = ::posix_fallocate(fd, 0, off_t(bytes));
+    void* base = err == 0 ? ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                          : MAP_FAILED;
+    if (err == 0 && base == MAP_FAILED) err = errno;
+    ::close(fd);
+    if (err != 0) {
+      ::unlink(path.c_str());
+      throw runtime_error("cannot allocate " + path + ": " + strerror(err));
+    }
+    auto segment = shared_ptr<Segment>(new Segment(path, seq, base, bytes));
+    SegmentHeader& header = segment->header();
+    memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+    header.capacity = capacity;
+    header.key_capacity = keyCapacity;
+    return segment;
+  }
+
+  // Maps a segment of a previous run read-only; nullptr if it is not one.
+  static shared_ptr<Segment> open(const string& path, uint64_t seq) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st {};
+    void* base = MAP_FAILED;
+    size_t bytes = 0;
+    if (::fstat(fd, &st) == 0 && size_t(st.st_size) >= HISTORY_HEADER_BYTES) {
+      bytes = size_t(st.st_size);
+      base = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (base == MAP_FAILED) return nullptr;
+    auto segment = shared_ptr<Segment>(new Segment(path, seq, base, bytes));
+    const SegmentHeader& header = segment->header();
+    uint64_t capacity = header.capacity;
+    uint64_t keyCapacity = header.key_capacity;
+    bool valid = memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) == 0 &&
+                 capacity < bytes && keyCapacity < bytes &&
+                 HISTORY_HEADER_BYTES + capacity * RECORD_BYTES + keyCapacity * sizeof(KeyRecord) <= bytes &&
+                 header.count <= capacity && header.key_count <= keyCapacity;
+    return valid ? segment : nullptr;
+  }
+
+  ~Segment() { ::munmap(m_base, m_bytes); }
+
+  SegmentHeader& header() const { return *static_cast<SegmentHeader*>(m_base); }
+  int64_t* timestamps() const {
+    return reinterpret_cast<int64_t*>(static_cast<char*>(m_base) + HISTORY_HEADER_BYTES);
+  }
+  uint64_t* entities() const { return reinterpret_cast<uint64_t*>(timestamps() + header().capacity); }
+  uint64_t* rates() const { return entities() + header().capacity; }
+  KeyRecord* keys() const { return reinterpret_cast<KeyRecord*>(rates() + header().capacity); }
+
+  // Reader side.
+  uint64_t committed() const { return loadAcquire(header().count); }
+  uint64_t committedKeys() const { return loadAcquire(header().key_count); }
+  int64_t firstNs() const { return atomic_ref<int64_t>(header().first_ns).load(memory_order_relaxed); }
+  int64_t lastNs() const { return atomic_ref<int64_t>(header().last_ns).load(memory_order_relaxed); }
+
+  // Writer side: records and keys are written at `pending` and
+  // `pendingKeys` and published by commit().
+  void commit() {
+    SegmentHeader& h = header();
+    if (pending == h.count && pendingKeys == h.key_count) return;
+    if (h.count == 0 && pending > 0) {
+      atomic_ref<int64_t>(h.first_ns).store(timestamps()[0], memory_order_relaxed);
+    }
+    if (pending > 0) {
+      atomic_ref<int64_t>(h.last_ns).store(timestamps()[pending - 1], memory_order_relaxed);
+    }
+    atomic_ref<uint64_t>(h.key_count).store(pendingKeys, memory_order_release);
+    atomic_ref<uint64_t>(h.count).store(pending, memory_order_release);
+  }
+
+  // Deletes the file; the mapping stays valid for readers still holding it.
+  void remove() { ::unlink(m_path.c_str()); }
+
+  const string& path() const { return m_path; }
+  uint64_t seq() const { return m_seq; }
+  size_t bytes() const { return m_bytes; }
+
+  uint64_t pending = 0;
+  uint64_t pendingKeys = 0;
+
+private:
+  Segment(string path, uint64_t seq, void* base, size_t bytes)
+      : m_path(std::move(path)), m_seq(seq), m_base(base), m_bytes(bytes) {}
+
+  string m_path;
+  uint64_t m_seq;
+  void* m_base;
+  size_t m_bytes;
+};
+
+RateHistory::RateHistory(const HistoryConfig& config) : m_config(config) {
+  namespace fs = std::filesystem;
+  error_code ec;
+  fs::create_directories(m_config.directory, ec);
+  if (ec) {
+    throw runtime_error("cannot create " + m_config.directory + ": " + ec.message());
+  }
+  SegmentList segments;
+  for (const auto& entry : fs::directory_iterator(m_config.directory, ec)) {
+    string name = entry.path().filename().string();
+    if (name.size() != 20 || name.compare(16, 4, ".seg") != 0) continue;
+    char* end = nullptr;
+    uint64_t seq = strtoull(name.c_str(), &end, 16);
+    if (end != name.c_str() + 16) continue;
+    m_nextSeq = max(m_nextSeq, seq + 1);
+    if (auto segment = Segment::open(entry.path().string(), seq)) {
+      segments.push_back(std::move(segment));
+    } else {
+      LOG_WARN("history", "Ignoring %s: not a readable history segment", entry.path().c_str());
+    }
+  }
+  if (ec) {
+    throw runtime_error("cannot read " + m_config.directory + ": " + ec.message());
+  }
+  sort(segments.begin(), segments.end(),
+       [](const auto& a, const auto& b) { return a->seq() < b->seq(); });
+  LOG_INFO("history", "Opened %s with %zu segment(s)", m_config.directory.c_str(), segments.size());
+  publish(std::move(segments));
+}
+
+RateHistory::~RateHistory() {
+  if (m_active) m_active->commit();
+}
+
+void RateHistory::publish(SegmentList segments) {
+  m_segments.store(make_shared<const SegmentList>(std::move(segments)));
+}
+
+bool RateHistory::startSegment() {
+  if (m_active) m_active->commit();
+  string path = m_config.directory + "/" + segmentName(m_nextSeq);
+  shared_ptr<Segment> segment;
+  try {
+    segment = Segment::create(path, m_nextSeq, m_config.segment_bytes);
+  } catch (const exception& e) {
+    LOG_WARN("history", "%s", e.what());
+    m_active.reset();
+    m_writeFailed = true;
+    return false;
+  }
+  m_nextSeq++;
+  m_active = segment;
+  m_activeKeys.clear();
+  SegmentList segments(*m_segments.load());
+  segments.push_back(std::move(segment));
+  publish(std::move(segments));
+  return true;
+}
+
+bool RateHistory::append(int64_t timestampNs, uint64_t entity, uint64_t rate, const FlowKey* key) {
+  if (m_writeFailed) {
+    m_dropped.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+  bool newKey = key && !m_activeKeys.count(entity);
+  if (!m_active || m_active->pending == m_active->header().capacity ||
+      (newKey && m_active->pendingKeys == m_active->header().key_capacity)) {
+    if (!startSegment()) {
+      m_dropped.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+    newKey = key != nullptr;
+  }
+  Segment& segment = *m_active;
+  if (newKey) {
+    segment.keys()[segment.pendingKeys++] = KeyRecord{ entity, *key };
+    m_activeKeys.insert(entity);
+  }
+  uint64_t i = segment.pending++;
+  segment.timestamps()[i] = timestampNs;
+  segment.entities()[i] = entity;
+  segment.rates()[i] = rate;
+  return true;
+}
+
+void RateHistory::recordFlow(int64_t timestampNs, const FlowKey& key, uint64_t rate) {
+  append(timestampNs, flowEntity(key), rate, &key);
+}
+
+void RateHistory::recordLink(int64_t timestampNs, uint64_t edgeId, uint8_t direction,
+                             uint64_t rate) {
+  append(timestampNs, linkEntity(edgeId, direction), rate, nullptr);
+}
+
+void RateHistory::commit(int64_t nowNs) {
+  if (m_active) m_active->commit();
+  m_writeFailed = false;
+  applyRetention(nowNs);
+}
+
+void RateHistory::applyRetention(int64_t nowNs) {
+  auto current = m_segments.load();
+  uint64_t total = 0;
+  for (const auto& segment : *current) total += segment->bytes();
+  int64_t cutoff = m_config.max_age_sec
+      ? nowNs - int64_t(m_config.max_age_sec) * 1000000000
+      : numeric_limits<int64_t>::min();
+  size_t drop = 0;
+  for (; drop < current->size(); drop++) {
+    const auto& segment = (*current)[drop];
+    bool tooOld = segment->committed() == 0 || segment->lastNs() < cutoff;
+    bool tooBig = m_config.max_bytes && total > m_config.max_bytes;
+    if (segment == m_active || !(tooOld || tooBig)) break;
+    total -= segment->bytes();
+    segment->remove();
+  }
+  if (drop > 0) {
+    publish(SegmentList(current->begin() + drop, current->end()));
+  }
+}
+
+RateHistory::SegmentList RateHistory::overlapping(int64_t fromNs, int64_t toNs) const {
+  SegmentList out;
+  for (const auto& segment : *m_segments.load()) {
+    if (segment->committed() > 0 && segment->firstNs() <= toNs && segment->lastNs() >= fromNs) {
+      out.push_back(segment);
+    }
+  }
+  return out;
+}
+
+vector<HistoryPoint> RateHistory::range(uint64_t entity, int64_t fromNs, int64_t toNs) const {
+  vector<HistoryPoint> out;
+  for (const auto& segment : overlapping(fromNs, toNs)) {
+    uint64_t n = segment->committed();
+    const int64_t* ts = segment->timestamps();
+    const uint64_t* entities = segment->entities();
+    const uint64_t* rates = segment->rates();
+    uint64_t begin = lower_bound(ts, ts + n, fromNs) - ts;
+    uint64_t end = upper_bound(ts + begin, ts + n, toNs) - ts;
+    for (uint64_t i = begin; i < end; i++) {
+      if (entities[i] == entity) {
+        out.push_back(HistoryPoint{ ts[i], rates[i] });
+      }
+    }
+  }
+  return out;
+}
+
+vector<FlowVolume> RateHistory::topFlows(int64_t fromNs, int64_t toNs, size_t n) const {
+  SegmentList segments = overlapping(fromNs, toNs);
+  unordered_map<uint64_t, FlowVolume> totals;
+  for (const auto& segment : segments) {
+    uint64_t count = segment->committed();
+    const int64_t* ts = segment->timestamps();
+    const uint64_t* entities = segment->entities();
+    const uint64_t* rates = segment->rates();
+    uint64_t begin = lower_bound(ts, ts + count, fromNs) - ts;
+    uint64_t end = upper_bound(ts + begin, ts + count, toNs) - ts;
+    for (uint64_t i = begin; i < end; i++) {
+      if (entities[i] & LINK_ENTITY) continue;
+      FlowVolume& total = totals[entities[i]];
+      total.volume_bits += rates[i];
+      total.peak_bps = max(total.peak_bps, rates[i]);
+    }
+  }
+
+  vector<pair<uint64_t, FlowVolume>> ranked(totals.begin(), totals.end());
+  n = min(n, ranked.size());
+  partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(), [](const auto& a, const auto& b) {
+    return a.second.volume_bits > b.second.volume_bits;
+  });
+  ranked.resize(n);
+
+  // Each winner's key is stored in every segment it appears in.
+  unordered_map<uint64_t, FlowVolume*> unresolved;
+  for (auto& [entity, volume] : ranked) unresolved.emplace(entity, &volume);
+  for (auto it = segments.rbegin(); it != segments.rend() && !unresolved.empty(); ++it) {
+    const KeyRecord* keys = (*it)->keys();
+    uint64_t count = (*it)->committedKeys();
+    for (uint64_t i = 0; i < count && !unresolved.empty(); i++) {
+      auto found = unresolved.find(keys[i].entity);
+      if (found != unresolved.end()) {
+        found->second->key = keys[i].key;
+        unresolved.erase(found);
+      }
+    }
+  }
+
+  vector<FlowVolume> out;
+  out.reserve(n);
+  for (auto& [entity, volume] : ranked) out.push_back(volume);
+  return out;
+}
+
+HistoryStats RateHistory::stats() const {
+  HistoryStats stats;
+  for (const auto& segment : *m_segments.load()) {
+    uint64_t count = segment->committed();
+    stats.segments++;
+    stats.bytes += segment->bytes();
+    stats.records += count;
+    if (count == 0) continue;
+    if (stats.first_ns == 0) stats.first_ns = segment->firstNs();
+    stats.last_ns = segment->lastNs();
+  }
+  stats.dropped_records = m_dropped.load();
+  return stats;
+}
+
+}  // namespace sflow
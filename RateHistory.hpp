@@ -0,0 +1,132 @@
+#ifndef RATE_HISTORY_HPP
+#define RATE_HISTORY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "FlowTable.hpp"
+
+namespace sflow {
+
+  struct HistoryConfig {
+    std::string directory;  // created if missing
+    // size of one segment file; a segment holds about segment_bytes / 27
+    // records
+    std::size_t segment_bytes = std::size_t(256) << 20;
+    // oldest segments are deleted beyond either limit; 0 disables a limit
+    std::size_t max_bytes = std::size_t(16) << 30;
+    uint32_t max_age_sec = 7 * 86400;
+    // flows below this rate are not recorded
+    uint64_t min_flow_rate_bps = 0;
+  };
+
+  struct HistoryPoint {
+    int64_t timestamp_ns = 0;
+    uint64_t rate = 0;  // bits/s
+  };
+
+  struct FlowVolume {
+    FlowKey key;
+    uint64_t volume_bits = 0;  // sum over the window of the per-second rates
+    uint64_t peak_bps = 0;
+  };
+
+  struct HistoryStats {
+    uint64_t segments = 0;
+    uint64_t bytes = 0;
+    uint64_t records = 0;
+    uint64_t dropped_records = 0;  // no segment could be written
+    int64_t first_ns = 0;
+    int64_t last_ns = 0;
+  };
+
+  // Append-only rate history on disk: (timestamp, entity, rate) records in
+  // fixed-size, memory-mapped segment files, one column per field, so the
+  // roll-up appends with plain stores and a query reads only the columns
+  // it needs. Records are appended in time order; segments know their time
+  // span (the coarse index) and are binary searched on their timestamp
+  // column. Flow entities are hashes of the FlowKey; each segment also
+  // stores the keys of the flows it holds, so it can be dropped or read on
+  // its own.
+  //
+  // One writer (recordFlow()/recordLink() then commit()); any number of
+  // concurrent readers, which only see committed records. Segments left by
+  // a previous run are reopened read-only. Retention deletes whole
+  // segments, oldest first.
+  class RateHistory {
+  public:
+    // Throws std::runtime_error if the directory cannot be created or read.
+    explicit RateHistory(const HistoryConfig& config);
+    ~RateHistory();
+
+    RateHistory(const RateHistory&) = delete;
+    RateHistory& operator=(const RateHistory&) = delete;
+
+    const HistoryConfig& config() const { return m_config; }
+
+    static uint64_t flowEntity(const FlowKey& key) {
+      return FlowKeyHash{}(key) & ~LINK_ENTITY;
+    }
+    // direction 0 is from the link's src switch to its dst switch
+    // (TopologyManager::LinkKey), 1 the reverse
+    static uint64_t linkEntity(uint64_t edgeId, uint8_t direction) {
+      return LINK_ENTITY | (edgeId << 1) | (direction & 1);
+    }
+
+    // Writer side. Records become visible to readers with commit(), which
+    // also applies retention. Timestamps must not decrease.
+    void recordFlow(int64_t timestampNs, const FlowKey& key, uint64_t rate);
+    void recordLink(int64_t timestampNs, uint64_t edgeId, uint8_t direction, uint64_t rate);
+    void commit(int64_t nowNs);
+
+    // Rates of one entity within [fromNs, toNs], oldest first.
+    std::vector<HistoryPoint> range(uint64_t entity, int64_t fromNs, int64_t toNs) const;
+    std::vector<HistoryPoint> linkRange(uint64_t edgeId, uint8_t direction,
+                                        int64_t fromNs, int64_t toNs) const {
+      return range(linkEntity(edgeId, direction), fromNs, toNs);
+    }
+    std::vector<HistoryPoint> flowRange(const FlowKey& key, int64_t fromNs, int64_t toNs) const {
+      return range(flowEntity(key), fromNs, toNs);
+    }
+
+    // The `n` flows that carried the most traffic within [fromNs, toNs],
+    // largest first.
+    std::vector<FlowVolume> topFlows(int64_t fromNs, int64_t toNs, std::size_t n) const;
+
+    HistoryStats stats() const;
+
+  private:
+    static constexpr uint64_t LINK_ENTITY = uint64_t(1) << 63;
+
+    class Segment;
+    using SegmentList = std::vector<std::shared_ptr<Segment>>;
+
+    // Segments overlapping [fromNs, toNs], oldest first.
+    SegmentList overlapping(int64_t fromNs, int64_t toNs) const;
+    bool append(int64_t timestampNs, uint64_t entity, uint64_t rate, const FlowKey* key);
+    bool startSegment();
+    void applyRetention(int64_t nowNs);
+    void publish(SegmentList segments);
+
+    HistoryConfig m_config;
+    uint64_t m_nextSeq = 0;
+
+    // writer state
+    std::shared_ptr<Segment> m_active;
+    // flows whose key the active segment already stores
+    std::unordered_set<uint64_t> m_activeKeys;
+    // no segment could be started; retried at the next commit()
+    bool m_writeFailed = false;
+
+    std::atomic<std::shared_ptr<const SegmentList>> m_segments;
+    std::atomic<uint64_t> m_dropped{0};
+  };
+
+} // namespace sflow
+
+#endif // RATE_HISTORY_HPP
@@ -0,0 +1,64 @@
+#ifndef RATE_SNAPSHOT_HPP
+#define RATE_SNAPSHOT_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "FlowSketch.hpp"
+#include "FlowTable.hpp"
+
+namespace sflow {
+
+  struct HopRate {
+    HopId id = 0;
+    uint64_t rate = 0;  // bits/s
+  };
+
+  struct FlowRate {
+    FlowKey key;
+    uint64_t rate = 0;  // estimated flow sending rate, bits/s
+    // sketch aggregation only: `rate` overestimates by at most this much
+    uint64_t rate_error = 0;
+    uint8_t hop_count = 0;
+    std::array<HopRate, MAX_FLOW_HOPS> hops;
+    // `rate` over longer horizons; EXACT aggregation only
+    SmoothedRate smoothed;
+  };
+
+  struct AggregateRate {
+    AggregateKey key;
+    uint64_t rate = 0;        // bits/s, an upper bound
+    uint64_t rate_error = 0;  // rate - rate_error is a lower bound
+  };
+
+  // Immutable result of one roll-up. The collector publishes a new snapshot
+  // every tick through an atomic pointer swap; readers keep the shared_ptr
+  // for as long as they need a consistent view and never block ingest.
+  struct RateSnapshot {
+    uint64_t version = 0;  // roll-up tick that produced it
+    std::chrono::system_clock::time_point timestamp;
+    // flows that carried traffic during the interval
+    std::vector<FlowRate> flows;
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> index;
+
+    // With CollectorConfig::aggregation SKETCH, `flows` holds only the
+    // heaviest flows, `aggregates` the heaviest prefixes and ports (by
+    // AggregateKind, largest first) and `summary` the whole interval, e.g.
+    // for summary->estimate() of any prefix. Aggregate rates are summed
+    // over the points the traffic was sampled at. Unset in EXACT mode.
+    std::vector<AggregateRate> aggregates;
+    std::shared_ptr<const TrafficSummary> summary;
+
+    const FlowRate* find(const FlowKey& key) const {
+      auto it = index.find(key);
+      return it == index.end() ? nullptr : &flows[it->second];
+    }
+  };
+
+} // namespace sflow
+
+#endif // RATE_SNAPSHOT_HPP
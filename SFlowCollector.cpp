@@ -1,10 +1,17 @@
 #include "SFlowCollector.hpp"
+#include "SFlowDecoder.hpp"
+#include "Logger.hpp"
+#include "PcapReader.hpp"
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <cstring>
-#include <boost/functional/hash.hpp>
+#include <cerrno>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include <chrono>
 #include <ctime>
 #include <cstdint>
@@ -15,266 +22,724 @@ using namespace std;
 
 namespace sflow {
 
-SFlowCollector::SFlowCollector() : m_sockfd(-1) {}
+namespace {
+
+int64_t wallClockNs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Largest flow count whose state fits in `budget` bytes. The table capacity
+// is a power of two kept at most 3/4 full, and every flow also has its key in
+// the expiry wheel.
+size_t maxFlowsFor(size_t budget) {
+  if (budget == 0) {
+    return numeric_limits<size_t>::max();
+  }
+  size_t perSlot = sizeof(FlowInfo) + sizeof(uint32_t) + sizeof(FlowKey) * 3 / 4;
+  size_t capacity = 16;
+  while (capacity * 2 * perSlot <= budget) {
+    capacity *= 2;
+  }
+  return capacity * 3 / 4;
+}
+
+// Slot count of each receive worker's live and spare delta tables. Together
+// the 2 * `shards` tables get at most a quarter of `budget`; the rest is left
+// to the collector's own table.
+size_t shardCapacityFor(size_t budget, size_t shards) {
+  size_t perSlot = sizeof(FlowInfo) + sizeof(uint32_t);
+  size_t capacity = 16;
+  while (2 * shards * capacity * 2 * perSlot <= budget / 4) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+}  // namespace
+
+SFlowCollector::SFlowCollector(const CollectorConfig& config)
+    : m_config(config),
+      m_expiryWheel(max(1u, config.flow_idle_timeout_sec) + 2) {
+  size_t workers = size_t(max(1, m_config.rcv_workers));
+  size_t budget = m_config.flow_table_max_bytes;
+  // Each shard buffers the flows sampled in one roll-up interval. Its two
+  // tables count against the flow budget too; they are never grown past
+  // the capacity reserved for them here.
+  size_t shardCapacity = 1024;
+  if (budget == 0) {
+    m_maxFlows = maxFlowsFor(0);
+    m_maxShardFlows = max<size_t>(1024, m_maxFlows / workers);
+  } else {
+    size_t reserved = shardCapacity = shardCapacityFor(budget, workers);
+    reserved *= 2 * workers * (sizeof(FlowInfo) + sizeof(uint32_t));
+    m_maxFlows = maxFlowsFor(budget > reserved ? budget - reserved : 1);
+    m_maxShardFlows = shardCapacity * 3 / 4;
+  }
+  for (size_t i = 0; i < workers; i++) {
+    m_shards.push_back(make_unique<FlowShard>(min<size_t>(shardCapacity, 1024),
+                                              m_config.counter_max_interfaces));
+  }
+
+  if (m_config.aggregation == FlowAggregation::SKETCH) {
+    m_sketchLayout = SketchLayout::forBudget(m_config.sketch_max_bytes / (2 * m_shards.size() + 2),
+                                             m_config.sketch_ipv4_prefix,
+                                             m_config.sketch_ipv6_prefix);
+    for (auto& shard : m_shards) {
+      shard->live_summary = make_unique<TrafficSummary>(m_sketchLayout);
+      shard->spare_summary = make_unique<TrafficSummary>(m_sketchLayout);
+    }
+    m_flowMemory.store(m_shards.front()->live_summary->memoryUsage() * (2 * m_shards.size() + 2));
+  }
+}
+
+FlowTableStats SFlowCollector::getFlowTableStats() const {
+  FlowTableStats stats;
+  stats.flows = m_flowCount.load();
+  stats.memory_bytes = m_flowMemory.load();
+  stats.evicted_idle = m_evictedIdle.load();
+  stats.evicted_active = m_evictedActive.load();
+  stats.evicted_budget = m_evictedBudget.load();
+  stats.dropped_new_flows = m_droppedNewFlows.load();
+  return stats;
+}
+
+IngestStats SFlowCollector::getIngestStats() const {
+  IngestStats stats;
+  for (const auto& shard : m_shards) {
+    stats.datagrams += shard->datagrams.load(memory_order_relaxed);
+    stats.bytes += shard->bytes.load(memory_order_relaxed);
+    stats.decode_errors += shard->decode_errors.load(memory_order_relaxed);
+    stats.socket_drops += shard->socket_drops.load(memory_order_relaxed);
+    stats.counter_samples += shard->counters.samples();
+    stats.counter_wraps += shard->counters.wraps();
+    stats.counter_resets += shard->counters.resets();
+    stats.counter_dropped += shard->counters.dropped();
+    stats.interfaces += shard->counters.size();
+  }
+  for (const SubAgentHealth& health : m_subAgents.read()) {
+    stats.sequence_lost += health.lost;
+    stats.reordered += health.reordered;
+    stats.duplicates += health.duplicates;
+    stats.agent_restarts += health.restarts;
+    stats.sub_agents++;
+  }
+  return stats;
+}
 
 SFlowCollector::~SFlowCollector() { stop(); }
 
 void SFlowCollector::start() {
+  m_ownScheduler = make_unique<PeriodicScheduler>();
+  m_ownScheduler->start(m_config.rollup_cpus);
+  try {
+    start(*m_ownScheduler);
+  }
+  catch (...) {
+    m_ownScheduler.reset();
+    throw;
+  }
+}
+
+void SFlowCollector::start(PeriodicScheduler& scheduler) {
   initSocket();
-  // Launch the main loop in a separate thread.;
+  // Launch one receive worker per socket.
   this->m_running.store(true);
-  m_pktRcvThread = thread(&SFlowCollector::run, this);
-  m_calAvgFlowSendingRateThread = thread(&SFlowCollector::calAvgFlowSendingRates, this);
+  const vector<int>& cpus = m_config.rcv_cpus;
+  for (size_t i = 0; i < m_sockfds.size(); i++) {
+    m_pktRcvThreads.emplace_back(&SFlowCollector::run, this, m_sockfds[i],
+                                 ref(*m_shards[i]));
+    if (!cpus.empty()) {
+      setThreadAffinity(m_pktRcvThreads.back(), { cpus[i % cpus.size()] });
+    }
+  }
+  m_scheduler = &scheduler;
+  m_rollUpTask = scheduler.add("sflow roll-up", 1000, [this] { rollUp(wallClockNs()); });
 }
 
 void SFlowCollector::stop() {
-  if (m_sockfd != -1) {
-    ::close(m_sockfd);
-    m_sockfd = -1;
+  if (m_scheduler) {
+    m_scheduler->remove(m_rollUpTask);
+    m_scheduler = nullptr;
   }
-  if (m_pktRcvThread.joinable()) {
-    m_pktRcvThread.join();
+  m_ownScheduler.reset();
+  m_running.store(false);
+  // Wakes up workers blocked in recvmmsg(); failing that they observe
+  // m_running within SOCKET_RCV_TIMEOUT_MS.
+  for (int sockfd : m_sockfds) {
+    ::shutdown(sockfd, SHUT_RDWR);
   }
-  if (m_calAvgFlowSendingRateThread.joinable()) {
-    m_calAvgFlowSendingRateThread.join();
+  for (auto& t : m_pktRcvThreads) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+  m_pktRcvThreads.clear();
+  for (int sockfd : m_sockfds) {
+    ::close(sockfd);
   }
+  m_sockfds.clear();
 }
 
 void SFlowCollector::initSocket() {
-  // TODO: Should be Real init Socket
-  // Not be placed in ::run()
-  // lock_guard<mutex> lock(m_socketMutex);
-  // m_sockfd = ::socket(AF_INET, SOCK_DGRAM, 0);
-  // if (m_sockfd < 0) {
-  //   perror("socket");
-  //   exit(EXIT_FAILURE);
-  // }
-  // sockaddr_in addr{};
-  // addr.sin_family = AF_INET;
-  // addr.sin_port = htons(SFLOW_PORT);
-  // addr.sin_addr.s_addr = INADDR_ANY;
-
-  // if (::bind(m_sockfd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
-  //   perror("bind");
-  //   exit(EXIT_FAILURE);
-  // }
-  // cout << "Listening for sFlow on UDP port " << SFLOW_PORT << "...\n";
+  try {
+    for (size_t i = 0; i < m_shards.size(); i++) {
+      m_sockfds.push_back(openSocket());
+    }
+  }
+  catch (...) {
+    for (int sockfd : m_sockfds) {
+      ::close(sockfd);
+    }
+    m_sockfds.clear();
+    throw;
+  }
+  LOG_INFO("sflow", "Listening for sFlow on UDP port %d with %zu receive worker(s)",
+           SFLOW_PORT, m_sockfds.size());
 }
 
-void SFlowCollector::run() {
-  m_sockfd = ::socket(AF_INET, SOCK_DGRAM, 0);
-  if (m_sockfd < 0) {
-    perror("socket");
-    exit(EXIT_FAILURE);
+int SFlowCollector::openSocket() {
+  int sockfd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (sockfd < 0) {
+    throw runtime_error(string("socket: ") + strerror(errno));
+  }
+
+  // Every worker binds its own socket to SFLOW_PORT; the kernel spreads
+  // datagrams across them by flow hash.
+  int on = 1;
+  if (::setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    string error = string("setsockopt(SO_REUSEPORT): ") + strerror(errno);
+    ::close(sockfd);
+    throw runtime_error(error);
   }
+  int rcvBuf = m_config.rcv_buf_bytes;
+  if (rcvBuf > 0 &&
+      ::setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)) < 0) {
+    LOG_WARN("sflow", "setsockopt(SO_RCVBUF): %s", strerror(errno));
+  }
+  // Bounded blocking so that stop() does not hang on an idle socket.
+  timeval timeout{};
+  timeout.tv_sec = SOCKET_RCV_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (SOCKET_RCV_TIMEOUT_MS % 1000) * 1000;
+  ::setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  // Every datagram then carries the socket's drop counter (see run()).
+  if (::setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+    LOG_WARN("sflow", "setsockopt(SO_RXQ_OVFL): %s", strerror(errno));
+  }
+
   sockaddr_in addr{};
   addr.sin_family = AF_INET;
   addr.sin_port = htons(SFLOW_PORT);
   addr.sin_addr.s_addr = INADDR_ANY;
 
-  if (::bind(m_sockfd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
-    perror("bind");
-    exit(EXIT_FAILURE);
+  if (::bind(sockfd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    string error = "bind to UDP port " + to_string(SFLOW_PORT) + ": " + strerror(errno);
+    ::close(sockfd);
+    throw runtime_error(error);
   }
-  cout << "Listening for sFlow on UDP port " << SFLOW_PORT << "...\n";
+  return sockfd;
+}
 
-  char buffer[BUFFER_SIZE];
-  sockaddr_in clientAddr{};
-  socklen_t addrLen = sizeof(clientAddr);
+void SFlowCollector::run(int sockfd, FlowShard& shard) {
+  const int batchSize = max(1, m_config.rcv_batch_size);
+  vector<char> buffers(size_t(batchSize) * BUFFER_SIZE);
+  vector<iovec> iovecs(batchSize);
+  vector<mmsghdr> msgs(batchSize);
+  const size_t controlSize = CMSG_SPACE(sizeof(uint32_t));
+  vector<char> controls(size_t(batchSize) * controlSize);
+  for (int i = 0; i < batchSize; i++) {
+    iovecs[i].iov_base = buffers.data() + size_t(i) * BUFFER_SIZE;
+    iovecs[i].iov_len = BUFFER_SIZE;
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = controls.data() + size_t(i) * controlSize;
+  }
+  // The kernel reports the socket's total drop count (a wrapping uint32)
+  // with each datagram; the shard accumulates its increments.
+  uint32_t lastDrops = 0;
 
   while (m_running) {
-    ssize_t len =
-        ::recvfrom(m_sockfd, buffer, BUFFER_SIZE, 0,
-                   reinterpret_cast<sockaddr*>(&clientAddr), &addrLen);
-    // cout << len << endl;
-    if (len > 0) {
-      handlePacket(buffer);
+    for (int i = 0; i < batchSize; i++) {
+      msgs[i].msg_hdr.msg_controllen = controlSize;
+    }
+    // Block for the first datagram, then take whatever else is queued.
+    int n = ::recvmmsg(sockfd, msgs.data(), batchSize, MSG_WAITFORONE, nullptr);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        LOG_WARN("sflow", "recvmmsg: %s", strerror(errno));
+      }
+      continue;
+    }
+    int64_t now = wallClockNs();
+    // The newest count is enough; it only grows.
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[n - 1].msg_hdr); cmsg;
+         cmsg = CMSG_NXTHDR(&msgs[n - 1].msg_hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+        uint32_t drops;
+        memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+        shard.socket_drops.fetch_add(drops - lastDrops, memory_order_relaxed);
+        lastDrops = drops;
+      }
+    }
+    lock_guard<mutex> lock(shard.mutex);
+    for (int i = 0; i < n; i++) {
+      if (msgs[i].msg_len > 0) {
+        handlePacket(span<const byte>(
+            static_cast<const byte*>(iovecs[i].iov_base), msgs[i].msg_len),
+            shard, now);
+      }
     }
-    // Sleep briefly to avoid busy looping.
-    this_thread::sleep_for(chrono::milliseconds(10));
   }
 }
 
-void SFlowCollector::handlePacket(char* buffer) {
-  uint32_t* data = (uint32_t*)buffer;
+uint32_t SFlowCollector::agentId(const IpAddress& agent, FlowShard& shard) {
+  auto it = shard.agent_ids.find(agent);
+  if (it != shard.agent_ids.end()) {
+    return it->second;
+  }
+  uint32_t id = m_agents.idOf(agent);
+  shard.agent_ids.emplace(agent, id);
+  return id;
+}
 
-  uint32_t version = ntohl(data[0]);
+SequenceTracker& SFlowCollector::sequenceTracker(const IpAddress& agent, uint32_t subAgentId,
+                                                 FlowShard& shard) {
+  SubAgentRegistry::Key key{ agent, subAgentId };
+  auto it = shard.trackers.find(key);
+  if (it != shard.trackers.end()) {
+    return *it->second;
+  }
+  SequenceTracker& tracker = m_subAgents.tracker(agent, subAgentId);
+  shard.trackers.emplace(key, &tracker);
+  return tracker;
+}
 
-  if (version != 5) {
-    cout << "Unsupported sFlow version: " << version << "\n";
+void SFlowCollector::handlePacket(span<const byte> datagram, FlowShard& shard,
+                                  int64_t nowNs) {
+  shard.datagrams.fetch_add(1, memory_order_relaxed);
+  shard.bytes.fetch_add(datagram.size(), memory_order_relaxed);
+  SFlowDecoder decoder(datagram);
+  DatagramHeader header;
+  DecodeStatus status = decoder.decodeHeader(header);
+  if (status == DecodeStatus::UNSUPPORTED_VERSION) {
+    shard.decode_errors.fetch_add(1, memory_order_relaxed);
+    LOG_WARN("sflow", "Unsupported sFlow version: %u", header.version);
+    return;
+  }
+  if (status != DecodeStatus::OK) {
+    shard.decode_errors.fetch_add(1, memory_order_relaxed);
     return;
   }
 
-  uint32_t agent_ip = data[2];
-  uint32_t sub_agent_id = ntohl(data[3]);
-  uint32_t sequence_number = ntohl(data[4]);
-  uint32_t uptime = ntohl(data[5]);
-  uint32_t sample_count = ntohl(data[6]);
-
-  string agent_ip_str = ipToString(agent_ip);
-
-  // cout << "Version:        " << version << "\n";
-  cout << "Agent Address:  " << agent_ip_str << "\n";
-  // cout << "Sub Agent ID:   " << sub_agent_id << "\n";
-  // cout << "Seq Number:     " << sequence_number << "\n";
-  // cout << "Uptime (ms):    " << uptime << "\n";
-  // cout << "Sample Count:   " << sample_count << "\n";
-
-  uint32_t index = 7;
-  for (uint32_t i = 0; i < sample_count; i++) {
-    uint32_t sample_type = ntohl(data[index]);
-    if (sample_type == 2) { // Counter sample
-      uint32_t sample_len = ntohl(data[index + 1]);
-      uint32_t interface_index = ntohl(data[index + 4 + 15 + 3]);
-      uint32_t interface_speed_front = ntohl(data[index + 4 + 15 + 5]);
-      uint32_t interface_speed_back = ntohl(data[index + 4 + 15 + 6]);
-      uint64_t interface_speed = interface_speed_front << 32 | interface_speed_back;
-      uint32_t input_octets_front = ntohl(data[index + 4 + 15 + 9]);
-      uint32_t input_octets_back = ntohl(data[index + 4 + 15 + 10]);
-      uint64_t input_octets = input_octets_front << 32 | input_octets_back;
-      uint32_t output_octets_front = ntohl(data[index + 4 + 15 + 17]);
-      uint32_t output_octets_back = ntohl(data[index + 4 + 15 + 18]);
-      uint64_t output_octets = output_octets_front << 32 | output_octets_back;
-
-      index += (sample_len / 4 + 2);
-
-      cout << "Sample Len:      " << sample_len << endl;
-      cout << "Interface Index: " << interface_index << endl;
-      cout << "Interface Speed: " << interface_speed << endl;
-      cout << "Input Octets:    " << input_octets << endl;
-      cout << "Output Octets:   " << output_octets << endl;
-      cout << "-------------------------------" << endl;
-
-      pair<uint32_t, uint32_t> agent_ip_and_port(agent_ip, interface_index);
-      time_t now = time(NULL);
-      time_t interval = now - m_counterReports[agent_ip_and_port].last_report_time;
-      if (interval <= 0) continue;
-      uint64_t input_octets_diff = input_octets - m_counterReports[agent_ip_and_port].last_received_input_octets;
-      uint64_t output_octets_diff = output_octets - m_counterReports[agent_ip_and_port].last_received_output_octets;
-      if (input_octets_diff >= 0) {
-        uint64_t avg_out = input_octets_diff / interval;
-        cout << "Average Link Usage (Out):  " << avg_out << endl;
+  uint32_t agent_id = agentId(header.agent, shard);
+  sequenceTracker(header.agent, header.sub_agent_id, shard)
+      .observe(header.sequence_number, header.uptime, nowNs);
+
+  LOG_DEBUG("sflow", "Agent Address: %s", header.agent.toString().c_str());
+
+  // interface -> link map, loaded on the first counter sample
+  shared_ptr<const InterfaceMap> interfaces;
+  Sample sample;
+  while (decoder.nextSample(sample)) {
+    if (sample.kind == SampleKind::COUNTER) {
+      const CounterSample& counter = sample.counter;
+      if (!counter.has_generic) continue;
+
+      LOG_DEBUG("sflow", "Counters if=%u speed=%llu in_octets=%llu out_octets=%llu",
+                counter.if_index, (unsigned long long)counter.if_speed,
+                (unsigned long long)counter.in_octets,
+                (unsigned long long)counter.out_octets);
+
+      UtilizationSample usage;
+      if (!shard.counters.update(agent_id, header.uptime, nowNs, counter, usage)) continue;
+      LOG_DEBUG("sflow", "Link usage if=%u in=%llu out=%llu bits/s", counter.if_index,
+                (unsigned long long)usage.in_bps, (unsigned long long)usage.out_bps);
+
+      if (m_linkUtilization) {
+        if (!interfaces) interfaces = m_linkUtilization->current();
+        const InterfaceMap::Target* target =
+            interfaces ? interfaces->find(header.agent, counter.if_index) : nullptr;
+        if (target) {
+          target->ring().push(usage, m_config.rate_estimator);
+        }
+      }
+
+    } else {  // Flow sample
+      const FlowSample& flow = sample.flow;
+      if (!flow.has_ip) continue;
+
+      if (flow.ip_protocol == 6) {  // TCP
+        FlowKey key = FlowKey::fromSample(flow);
+        if (shard.live_summary) {
+          shard.live_summary->add(key, makeHopId(agent_id, flow.input_if), flow.frame_length);
+          continue;
+        }
+        FlowInfo* info = shard.live.find(key);
+        if (!info) {
+          if (shard.live.size() >= m_maxShardFlows) {
+            m_droppedNewFlows.fetch_add(1, memory_order_relaxed);
+            continue;
+          }
+          info = &shard.live.findOrInsert(key);
+        }
+        if (FlowStats* stats = info->hop(makeHopId(agent_id, flow.input_if))) {
+          stats->byte_count_current += flow.frame_length;
+        }
+      }
+    }
+  }
+}
+
+
+void SFlowCollector::mergeShards() {
+  uint32_t firstDeadline =
+      min(max(1u, m_config.flow_idle_timeout_sec), max(1u, m_config.flow_active_timeout_sec));
+  m_shardMemory = 0;
+  for (auto& shard : m_shards) {
+    {
+      lock_guard<mutex> shardLock(shard->mutex);
+      swap(shard->live, shard->spare);
+      m_shardMemory += shard->live.memoryUsage() + shard->spare.memoryUsage();
+    }
+    shard->spare.forEach([&](const FlowInfo& delta) {
+      FlowInfo* info = m_flowTable.find(delta.key);
+      if (!info) {
+        if (m_flowTable.size() >= m_maxFlows) {
+          // Free a little headroom at once instead of one flow per insert.
+          evictForBudget(m_maxFlows - m_maxFlows / 64 - 1);
+        }
+        info = &m_flowTable.findOrInsert(delta.key);
+        info->first_seen = m_tick;
+        info->expiry_tick = m_tick + firstDeadline;
+        m_expiryWheel.schedule(delta.key, info->expiry_tick);
       }
-      if (output_octets_diff >= 0) {
-        uint64_t avg_in = output_octets_diff / interval;
-        cout << "Average Link Usage (In):   " << avg_in << endl;
+      if (info->last_active != m_tick) {
+        info->last_active = m_tick;
+        m_activeFlows.push_back(delta.key);
       }
-      cout << "~~~~~~~~~~~~~~~~~~~~~~~~~~" << endl;
-
-      m_counterReports[agent_ip_and_port].last_report_time = now;
-      m_counterReports[agent_ip_and_port].last_received_input_octets = input_octets;
-      m_counterReports[agent_ip_and_port].last_received_output_octets = output_octets;
-
-      // TODO: store link bandwidth usage info to edge property
-
-    } else if (sample_type == 1) {  // Flow sample
-      uint32_t sample_len = ntohl(data[index + 1]);
-      uint32_t input_port = ntohl(data[index + 7]);
-      uint32_t frame_length = ntohl(data[index + 13]);
-      uint32_t protocol = ntohl(data[index + 21]) & 255;
-      uint32_t src_ip_front = ntohl(data[index + 22]);
-      uint32_t src_ip_back = ntohl(data[index + 23]);
-      uint32_t dst_ip_front = ntohl(data[index + 23]);
-      uint32_t dst_ip_back = ntohl(data[index + 24]);
-      uint16_t src_port = ntohl(data[index + 24]) & 65535;
-      uint16_t dst_port = ntohl(data[index + 25]) >> 16;
-  
-      index += (sample_len / 4 + 2);
-  
-      // cout << "Sample Len:       " << sample_len << endl;
-      // cout << "Input port:       " << input_port << endl;
-      // cout << "Source IP:        "
-      //           << ourIpToString(src_ip_front, src_ip_back) << endl;
-      // cout << "Destination IP:   "
-      //           << ourIpToString(dst_ip_front, dst_ip_back) << endl;
-      // cout << "Source Port:      " << src_port << endl;
-      // cout << "Destination Port: " << dst_port << endl;
-  
-      // cout << "Protocol:            "  << protocol << endl;
-      // cout << "-------------------------------" << endl;
-  
-      if (protocol == 6) {  // TCP
-        FlowKey key = make_tuple(ourIpToString(src_ip_front, src_ip_back),
-                                 ourIpToString(dst_ip_front, dst_ip_back),
-                                 src_port, dst_port);
-        auto item = m_flowTable.find(key);
-        if (item != m_flowTable.end()) {
-          uint64_t old_accumulated_byte_count =
-              m_flowTable[key]
-                  .data[make_pair(agent_ip_str, int(input_port))]
-                  .byte_count_current;
-          m_flowTable[key]
-              .data[make_pair(agent_ip_str, int(input_port))]
-              .byte_count_current =
-              old_accumulated_byte_count + uint64_t(frame_length);
-        } else {
-          m_flowTable[key].data[make_pair(agent_ip_str, int(input_port))] = {0, 0};
+      for (uint8_t i = 0; i < delta.hop_count; i++) {
+        if (FlowStats* stats = info->hop(delta.hops[i].id)) {
+          stats->byte_count_current += delta.hops[i].stats.byte_count_current;
         }
-        // cout << "Accumulated byte count:  " <<
-        // m_flowTable[key].data[make_pair(agent_ip_str,
-        // int(input_port))].byte_count_current << endl;
+      }
+    });
+    shard->spare.clear();
+  }
+}
+
+// Only flows that had traffic this tick or the previous one can have a rate
+// change, so the roll-up never walks idle flows. Their smoothed rates catch
+// up on the idle time when they are active again.
+void SFlowCollector::updateRates(int64_t nowNs) {
+  int64_t toMs = nowNs / 1000000;
+  int64_t fromMs = m_lastRatesNs ? m_lastRatesNs / 1000000 : toMs - 1000;
+  m_lastRatesNs = nowNs;
+  for (const FlowKey& key : m_prevActiveFlows) {
+    FlowInfo* info = m_flowTable.find(key);
+    if (info && info->last_active != m_tick) {
+      updateFlowRate(*info, fromMs, toMs);
+    }
+  }
+  for (const FlowKey& key : m_activeFlows) {
+    if (FlowInfo* info = m_flowTable.find(key)) {
+      updateFlowRate(*info, fromMs, toMs);
+    }
+  }
+  swap(m_prevActiveFlows, m_activeFlows);
+  m_activeFlows.clear();
+}
+
+void SFlowCollector::updateFlowRate(FlowInfo& info, int64_t fromMs, int64_t toMs) {
+  uint64_t avg_flow_sending_rate_temp = 0;
+  int hops_counter = 0;
+  for (uint8_t i = 0; i < info.hop_count; i++) {
+    FlowStats& stats = info.hops[i].stats;
+    uint64_t bytes = stats.byte_count_current;
+
+    stats.byte_count_previous = stats.byte_count_current;
+    stats.byte_count_current = 0;
+    stats.avg_rate = bytes * 8 * SAMPLING_RATE;
+    avg_flow_sending_rate_temp += stats.avg_rate;
+    if (stats.avg_rate != 0) {
+      hops_counter++;
+    } else {
+      continue;
+    }
+
+    LOG_DEBUG("sflow", "stats.avg_rate: %llu bits/s", (unsigned long long)stats.avg_rate);
+  }
+
+  if (hops_counter == 0) {
+    info.estimated_flow_sending_rate = 0;
+    info.rates.add(fromMs, toMs, 0, m_config.rate_estimator);
+    return;
+  }
+  uint64_t estimated_flow_sending_rate =
+      avg_flow_sending_rate_temp / hops_counter;
+  info.estimated_flow_sending_rate = estimated_flow_sending_rate;
+  info.rates.add(fromMs, toMs, double(estimated_flow_sending_rate), m_config.rate_estimator);
+  LOG_DEBUG("sflow", "FlowKey: %s estimated flow sending rate: %llu bits/s",
+            info.key.toString().c_str(), (unsigned long long)estimated_flow_sending_rate);
+}
+
+void SFlowCollector::expireFlows() {
+  uint32_t idle = max(1u, m_config.flow_idle_timeout_sec);
+  uint32_t active = max(1u, m_config.flow_active_timeout_sec);
+  m_expiryWheel.take(m_tick, m_dueFlows);
+  for (const FlowKey& key : m_dueFlows) {
+    FlowInfo* info = m_flowTable.find(key);
+    if (!info || info->expiry_tick != m_tick) continue;  // stale wheel entry
+    uint32_t idleDeadline = info->last_active + idle;
+    uint32_t activeDeadline = info->first_seen + active;
+    if (idleDeadline <= m_tick) {
+      m_flowTable.erase(key);
+      m_evictedIdle.fetch_add(1, memory_order_relaxed);
+    } else if (activeDeadline <= m_tick) {
+      m_flowTable.erase(key);
+      m_evictedActive.fetch_add(1, memory_order_relaxed);
+    } else {
+      info->expiry_tick = min(idleDeadline, activeDeadline);
+      m_expiryWheel.schedule(key, info->expiry_tick);
+    }
+  }
+}
 
-        // TODO: store flow info to edge property
+// Evicts flows in order of their expiry deadline, which approximates least
+// recently active first, until at most `targetFlows` remain.
+void SFlowCollector::evictForBudget(size_t targetFlows) {
+  uint32_t idle = max(1u, m_config.flow_idle_timeout_sec);
+  uint32_t active = max(1u, m_config.flow_active_timeout_sec);
+  vector<FlowKey> due;
+  uint32_t end = m_tick + uint32_t(m_expiryWheel.slotCount());
+  for (uint32_t t = m_tick; t != end && m_flowTable.size() > targetFlows; t++) {
+    m_expiryWheel.take(t, due);
+    for (const FlowKey& key : due) {
+      FlowInfo* info = m_flowTable.find(key);
+      if (!info || info->expiry_tick != t) continue;  // stale wheel entry
+      uint32_t deadline = min(info->last_active + idle, info->first_seen + active);
+      if (m_flowTable.size() <= targetFlows) {
+        m_expiryWheel.schedule(key, t);
+      } else if (deadline > t) {
+        // Active since it was scheduled; revisit it at its real deadline.
+        info->expiry_tick = deadline;
+        m_expiryWheel.schedule(key, deadline);
+      } else {
+        m_flowTable.erase(key);
+        m_evictedBudget.fetch_add(1, memory_order_relaxed);
       }
     }
   }
 }
 
+void SFlowCollector::expireCounters(int64_t nowNs) {
+  int64_t cutoff = nowNs - int64_t(m_config.counter_idle_timeout_sec) * 1000000000;
+  for (auto& shard : m_shards) {
+    lock_guard<mutex> lock(shard->mutex);
+    shard->counters.expire(cutoff);
+  }
+}
 
-void SFlowCollector::calAvgFlowSendingRates() {
-  while (true) {
-    this_thread::sleep_for(chrono::seconds(1));
-    lock_guard<mutex> lock(m_statusMutex);
-    for (auto& [flow_key, info] : m_flowTable) {
-      uint64_t avg_flow_sending_rate_temp = 0;
-      int hops_counter = 0;
-      for (auto& [link_key, stats] : info.data) {
-        uint64_t bytes = stats.byte_count_current;
-
-        stats.byte_count_previous = bytes;
-        stats.byte_count_current = 0;
-        stats.avg_rate = bytes * 8 * SAMPLING_RATE;
-        avg_flow_sending_rate_temp += stats.avg_rate;
-        if (stats.avg_rate != 0) {
-          hops_counter++;
-        } else {
-          continue;
-        }
+// Copies this tick's active flows (left in m_prevActiveFlows by
+// updateRates()) into a new immutable snapshot and swaps it in.
+void SFlowCollector::publishSnapshot(int64_t nowNs) {
+  auto snapshot = make_shared<RateSnapshot>();
+  snapshot->version = m_tick;
+  snapshot->timestamp = chrono::system_clock::time_point(
+      chrono::duration_cast<chrono::system_clock::duration>(chrono::nanoseconds(nowNs)));
+  snapshot->flows.reserve(m_prevActiveFlows.size());
+  snapshot->index.reserve(m_prevActiveFlows.size());
+  for (const FlowKey& key : m_prevActiveFlows) {
+    const FlowInfo* info = m_flowTable.find(key);
+    if (!info) continue;
+    FlowRate& flow = snapshot->flows.emplace_back();
+    flow.key = key;
+    flow.rate = info->estimated_flow_sending_rate;
+    flow.smoothed = info->rates.read();
+    flow.hop_count = info->hop_count;
+    for (uint8_t i = 0; i < info->hop_count; i++) {
+      flow.hops[i].id = info->hops[i].id;
+      flow.hops[i].rate = info->hops[i].stats.avg_rate;
+    }
+    snapshot->index.emplace(key, uint32_t(snapshot->flows.size() - 1));
+  }
+  m_rateSnapshot.store(std::move(snapshot));
+}
+
+// SKETCH counterpart of mergeShards() and publishSnapshot(): adds up the
+// workers' summaries of the interval and publishes the heaviest entries.
+// Nothing carries over to the next interval.
+void SFlowCollector::publishSummary(int64_t nowNs) {
+  auto summary = make_shared<TrafficSummary>(m_sketchLayout);
+  for (auto& shard : m_shards) {
+    {
+      lock_guard<mutex> shardLock(shard->mutex);
+      swap(shard->live_summary, shard->spare_summary);
+    }
+    summary->merge(*shard->spare_summary);
+    shard->spare_summary->clear();
+  }
+
+  auto snapshot = make_shared<RateSnapshot>();
+  snapshot->version = m_tick;
+  snapshot->timestamp = chrono::system_clock::time_point(
+      chrono::duration_cast<chrono::system_clock::duration>(chrono::nanoseconds(nowNs)));
+  auto flows = summary->flows().top(m_config.sketch_report_flows);
+  snapshot->flows.reserve(flows.size());
+  snapshot->index.reserve(flows.size());
+  for (const TrafficSummary::FlowCounter::Entry* entry : flows) {
+    // As in updateFlowRate(): one hop's worth of the bytes sampled at all
+    // of them.
+    const FlowHops& hops = entry->detail;
+    uint64_t hopCount = max<uint64_t>(1, hops.hop_count);
+    FlowRate& flow = snapshot->flows.emplace_back();
+    flow.key = entry->key;
+    flow.rate = entry->count * 8 * SAMPLING_RATE / hopCount;
+    flow.rate_error = entry->error * 8 * SAMPLING_RATE / hopCount;
+    flow.hop_count = hops.hop_count;
+    for (uint8_t i = 0; i < hops.hop_count; i++) {
+      flow.hops[i].id = hops.ids[i];
+      flow.hops[i].rate = uint64_t(hops.bytes[i]) * 8 * SAMPLING_RATE;
+    }
+    snapshot->index.emplace(entry->key, uint32_t(snapshot->flows.size() - 1));
+  }
+  for (int kind = 0; kind < AGGREGATE_KINDS; kind++) {
+    for (const auto* entry : summary->aggregates(AggregateKind(kind)).top(m_config.sketch_report_aggregates)) {
+      uint64_t upper = summary->estimate(entry->key);
+      uint64_t lower = entry->count - entry->error;
+      AggregateRate& aggregate = snapshot->aggregates.emplace_back();
+      aggregate.key = entry->key;
+      aggregate.rate = upper * 8 * SAMPLING_RATE;
+      aggregate.rate_error = (upper - min(upper, lower)) * 8 * SAMPLING_RATE;
+    }
+  }
 
-        // cout << "LineKey: "
-        // << "Agent IP: " << link_key.first << " Input Port: " <<
-        // link_key.second
-        // << endl << endl;
+  LOG_INFO("sflow", "Sketch: %llu sampled bytes, %zu flows tracked (smallest %llu bytes)%s%s",
+           (unsigned long long)summary->totalBytes(), summary->flows().size(),
+           (unsigned long long)summary->flows().minCount(),
+           snapshot->flows.empty() ? "" : ", top flow ",
+           snapshot->flows.empty() ? "" : snapshot->flows.front().key.toString().c_str());
+  m_flowCount.store(summary->flows().size());
+  snapshot->summary = std::move(summary);
+  m_rateSnapshot.store(std::move(snapshot));
+}
 
-        cout << "stats.avg_rate:  " << stats.avg_rate << " bits/s" << endl;
-        // cout << "-------------------------------" << endl;
+// Everything is stamped with the roll-up time. A link direction is recorded
+// by the port sending on it, i.e. from the output rate of its bound end.
+void SFlowCollector::recordHistory(const RateSnapshot& snapshot, int64_t nowNs) {
+  uint64_t minRate = max<uint64_t>(1, m_history->config().min_flow_rate_bps);
+  for (const FlowRate& flow : snapshot.flows) {
+    if (flow.rate >= minRate) {
+      m_history->recordFlow(nowNs, flow.key, flow.rate);
+    }
+  }
+  shared_ptr<const InterfaceMap> interfaces =
+      m_linkUtilization ? m_linkUtilization->current() : nullptr;
+  if (interfaces) {
+    for (const auto& [key, target] : interfaces->targets) {
+      UtilizationSample sample;
+      if (target.ring().latest(sample) && sample.timestamp_ns > m_lastHistoryNs &&
+          sample.timestamp_ns <= nowNs) {
+        m_history->recordLink(nowNs, target.edge_id, target.end, sample.out_bps);
       }
-      
-      if (hops_counter == 0) continue;
-      uint64_t estimated_flow_sending_rate =
-          avg_flow_sending_rate_temp / hops_counter;
-      info.estimated_flow_sending_rate = estimated_flow_sending_rate;
-      cout << "FlowKey: " << get<0>(flow_key) << ":" << get<2>(flow_key)
-           << " → " << get<1>(flow_key) << ":" << get<3>(flow_key) << endl;
-      cout << "Estimated flow sending rate: " << estimated_flow_sending_rate
-           << endl
-           << endl;
     }
-    cout << "===================================" << endl;
   }
+  m_lastHistoryNs = nowNs;
+  m_history->commit(nowNs);
 }
 
-string SFlowCollector::ipToString(uint32_t ip) {
-  struct in_addr addr;
-  addr.s_addr = ip;
-  return string(inet_ntoa(addr));
+void SFlowCollector::ingest(span<const byte> datagram, int64_t nowNs) {
+  FlowShard& shard = *m_shards.front();
+  lock_guard<mutex> lock(shard.mutex);
+  handlePacket(datagram, shard, nowNs);
 }
 
-string SFlowCollector::ourIpToString(uint32_t ip_front, uint32_t ip_back) {
-  string res;
-  res = to_string((ip_front & 65535) >> 8) + "." + to_string(ip_front & 255) +
-        "." + to_string(ip_back >> 24) + "." + to_string((ip_back >> 16) & 255);
-  return res;
+void SFlowCollector::rollUp(int64_t nowNs) {
+  {
+    lock_guard<mutex> lock(m_statusMutex);
+    m_tick++;
+    if (m_config.aggregation == FlowAggregation::SKETCH) {
+      publishSummary(nowNs);
+    } else {
+      mergeShards();
+      updateRates(nowNs);
+      publishSnapshot(nowNs);
+      expireFlows();
+      m_flowCount.store(m_flowTable.size());
+      m_flowMemory.store(m_flowTable.memoryUsage() + m_shardMemory);
+      LOG_INFO("sflow", "Flows: %zu (%zu bytes), evicted idle/active/budget: %llu/%llu/%llu, dropped new: %llu",
+               m_flowTable.size(), m_flowTable.memoryUsage() + m_shardMemory,
+               (unsigned long long)m_evictedIdle.load(), (unsigned long long)m_evictedActive.load(),
+               (unsigned long long)m_evictedBudget.load(), (unsigned long long)m_droppedNewFlows.load());
+    }
+    logIngestHealth();
+    if (m_history) {
+      recordHistory(*m_rateSnapshot.load(), nowNs);
+    }
+    // Interfaces are few and report every few seconds; a periodic sweep is
+    // enough for them.
+    if (m_tick % 10 == 0) {
+      expireCounters(nowNs);
+    }
+  }
+  if (m_rollUpListener) {
+    m_rollUpListener(*m_rateSnapshot.load());
+  }
+}
+
+// Warns once per roll-up in which datagrams went missing, telling kernel
+// drops (collector overload) from sequence gaps (anywhere on the path).
+void SFlowCollector::logIngestHealth() {
+  IngestStats stats = getIngestStats();
+  if (stats.socket_drops > m_loggedSocketDrops) {
+    LOG_WARN("sflow", "Receive queue overflow: %llu datagrams dropped by the kernel (%llu in total)",
+             (unsigned long long)(stats.socket_drops - m_loggedSocketDrops),
+             (unsigned long long)stats.socket_drops);
+  }
+  if (stats.sequence_lost > m_loggedSequenceLost) {
+    LOG_WARN("sflow", "Sequence gaps: %llu datagrams missing (%llu in total, %llu dropped by the kernel)",
+             (unsigned long long)(stats.sequence_lost - m_loggedSequenceLost),
+             (unsigned long long)stats.sequence_lost, (unsigned long long)stats.socket_drops);
+  }
+  m_loggedSocketDrops = stats.socket_drops;
+  // Late datagrams lower the total again; only new gaps are reported.
+  m_loggedSequenceLost = max(m_loggedSequenceLost, stats.sequence_lost);
+}
+
+ReplayStats SFlowCollector::replay(const string& path, bool paced) {
+  PcapReader reader(path);
+  ReplayStats stats;
+  PcapDatagram datagram;
+  int64_t nextRollUp = 0;
+  int64_t firstTimestamp = 0;
+  auto wallStart = chrono::steady_clock::now();
+
+  while (reader.next(datagram, SFLOW_PORT)) {
+    if (stats.datagrams == 0) {
+      firstTimestamp = datagram.timestamp_ns;
+      nextRollUp = firstTimestamp + 1000000000;
+    }
+    // Roll up once per second of capture time, before the first datagram
+    // that belongs to the next interval.
+    while (datagram.timestamp_ns >= nextRollUp) {
+      rollUp(nextRollUp);
+      stats.roll_ups++;
+      nextRollUp += 1000000000;
+    }
+    if (paced) {
+      this_thread::sleep_until(wallStart + chrono::nanoseconds(datagram.timestamp_ns - firstTimestamp));
+    }
+    ingest(datagram.payload, datagram.timestamp_ns);
+    stats.datagrams++;
+    stats.bytes += datagram.payload.size();
+  }
+  if (stats.datagrams > 0) {
+    rollUp(nextRollUp);
+    stats.roll_ups++;
+  }
+  stats.skipped_packets = reader.skippedPackets();
+  stats.capture_seconds = stats.datagrams > 0 ? double(nextRollUp - firstTimestamp) / 1e9 : 0;
+  stats.wall_seconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+  return stats;
 }
 
 }  // namespace sflow
@@ -10,84 +10,279 @@
 #include <mutex>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <tuple>
-#include <map>
+#include <memory>
 #include <string>
 #include <utility>
-#include <iostream>
+#include <span>
+#include <cstddef>
+#include <functional>
+
+#include "IpAddress.hpp"
+#include "CounterPipeline.hpp"
+#include "FlowSketch.hpp"
+#include "FlowTable.hpp"
+#include "IngestHealth.hpp"
+#include "RateSnapshot.hpp"
+#include "RateHistory.hpp"
+#include "LinkUtilization.hpp"
+#include "PeriodicScheduler.hpp"
 
 namespace sflow {
 
 #define SAMPLING_RATE 256
 #define SFLOW_PORT 6343
 #define BUFFER_SIZE 65535
+#define SOCKET_RCV_TIMEOUT_MS 200
+
+  enum class FlowAggregation {
+    EXACT,   // one FlowTable entry per sampled flow
+    SKETCH,  // fixed-size summary per interval, see TrafficSummary
+  };
+
+  struct CollectorConfig {
+    // number of receive workers, each owning its own SO_REUSEPORT socket
+    int rcv_workers = 1;
+    // SO_RCVBUF requested for every worker socket, in bytes
+    int rcv_buf_bytes = 4 * 1024 * 1024;
+    // max datagrams drained by a single recvmmsg() call
+    int rcv_batch_size = 64;
+    // receive worker i runs on rcv_cpus[i % size], e.g. cores on the NIC's
+    // NUMA node; empty leaves placement to the kernel
+    std::vector<int> rcv_cpus;
+    // CPUs of the roll-up thread when start() runs its own scheduler
+    std::vector<int> rollup_cpus;
+    // flows without sampled traffic for this long are evicted
+    uint32_t flow_idle_timeout_sec = 60;
+    // flows tracked for this long are evicted and start over
+    uint32_t flow_active_timeout_sec = 1800;
+    // hard cap on flow state (table plus expiry bookkeeping, and the receive
+    // workers' per-interval buffers, which get up to a quarter of it); once
+    // reached the least recently active flows are evicted, and workers drop
+    // new flows until the next roll-up. 0 disables the cap.
+    std::size_t flow_table_max_bytes = std::size_t(512) << 20;
+    // counter state of interfaces not reported for this long is dropped
+    uint32_t counter_idle_timeout_sec = 300;
+    // interfaces tracked per receive worker; counter samples of further
+    // ones are dropped
+    std::size_t counter_max_interfaces = std::size_t(1) << 20;
+    // EWMA half-lives of the smoothed flow and link rates
+    RateEstimatorConfig rate_estimator;
+    // SKETCH keeps only the heavy-hitter flows and per prefix/port sketches,
+    // so memory stays at sketch_max_bytes whatever the number of flows
+    // (scans, DDoS). The flow_* settings above only apply to EXACT.
+    FlowAggregation aggregation = FlowAggregation::EXACT;
+    // all summaries together: two per receive worker, the one being merged
+    // and the published one
+    std::size_t sketch_max_bytes = std::size_t(64) << 20;
+    uint8_t sketch_ipv4_prefix = 24;
+    uint8_t sketch_ipv6_prefix = 64;
+    // flows, and prefixes/ports per AggregateKind, put in each RateSnapshot
+    uint32_t sketch_report_flows = 1000;
+    uint32_t sketch_report_aggregates = 100;
+  };
+
+  struct FlowTableStats {
+    uint64_t flows = 0;
+    uint64_t memory_bytes = 0;
+    uint64_t evicted_idle = 0;
+    uint64_t evicted_active = 0;
+    uint64_t evicted_budget = 0;
+    // samples of new flows dropped because a worker's shard was full
+    uint64_t dropped_new_flows = 0;
+  };
 
-  typedef std::tuple<std::string, std::string, int, int> FlowKey;   //srcIP, dstIP, srcPort, dstPort
+  // Whether datagrams reach the roll-up. Sequence gaps count datagrams lost
+  // anywhere between agent and collector, including those in
+  // socket_drops; the difference is what the network lost.
+  struct IngestStats {
+    uint64_t datagrams = 0;
+    uint64_t bytes = 0;
+    // malformed datagrams and unsupported sFlow versions
+    uint64_t decode_errors = 0;
+    // dropped by the kernel because a worker's receive queue was full
+    // (SO_RXQ_OVFL), i.e. lost to collector overload
+    uint64_t socket_drops = 0;
+    // summed over all sub-agents, see SubAgentHealth
+    uint64_t sequence_lost = 0;
+    uint64_t reordered = 0;
+    uint64_t duplicates = 0;
+    uint64_t agent_restarts = 0;
+    uint64_t sub_agents = 0;
+    // generic interface counter samples, see CounterPipeline
+    uint64_t counter_samples = 0;
+    uint64_t counter_wraps = 0;   // 32-bit counters that wrapped
+    uint64_t counter_resets = 0;  // counters that started over; no rate
+    uint64_t counter_dropped = 0; // interfaces beyond counter_max_interfaces
+    uint64_t interfaces = 0;
+  };
+
+  struct ReplayStats {
+    uint64_t datagrams = 0;
+    uint64_t bytes = 0;
+    uint64_t roll_ups = 0;
+    uint64_t skipped_packets = 0;  // e.g. IP fragments
+    double capture_seconds = 0;
+    double wall_seconds = 0;
+  };
 
   class SFlowCollector {
   public:
-    SFlowCollector();
+    explicit SFlowCollector(const CollectorConfig& config = CollectorConfig());
     ~SFlowCollector();
 
-    template <typename T>
-    static void hash_combine(std::size_t& seed, const T& val) {
-      seed ^= std::hash<T>{}(val)+0x9e3779b9 + (seed << 6) + (seed >> 2);
-    }
+    // Opens the sockets and starts the receive workers. The one-second
+    // roll-up runs on a scheduler thread of its own, or as a task of
+    // `scheduler`, which must then be running and outlive stop(). Throws
+    // std::runtime_error if the sockets cannot be set up. The collector
+    // can be started again after stop(); flow state is kept.
+    void start();
+    void start(PeriodicScheduler& scheduler);
+    // Returns within SOCKET_RCV_TIMEOUT_MS plus the duration of a roll-up
+    // in progress.
+    void stop();
 
-    struct FlowStats {
-      uint64_t byte_count_current = 0;
-      uint64_t byte_count_previous = 0;
-      uint64_t avg_rate = 0;
-    };
+    FlowTableStats getFlowTableStats() const;
+    IngestStats getIngestStats() const;
+    // Per (agent, sub-agent) sequence accounting; lock-free for ingest.
+    std::vector<SubAgentHealth> getSubAgentHealth() const { return m_subAgents.read(); }
 
+    // Feeds the sFlow datagrams of a pcap/pcapng capture through the same
+    // decode and aggregation path as live traffic. Roll-ups are driven by
+    // capture time: one per captured second. With `paced` the original
+    // inter-arrival times are reproduced, otherwise the capture is read as
+    // fast as possible. Must not be used while start()ed. Throws
+    // std::runtime_error if the capture cannot be read.
+    ReplayStats replay(const std::string& path, bool paced);
 
-    struct FlowInfo {
-      // key -> agent_ip and input_port
-      // value -> avg_flow_sending_rate, accumulated_byte_counts
-      std::map<std::pair<std::string, int>, FlowStats> data;
-      uint64_t estimated_flow_sending_rate;
-    };
+    // Manual drive of the ingest and roll-up path for replay and benchmarks;
+    // must not be used while start()ed. ingest() decodes one datagram into
+    // the first shard, rollUp() closes the current one-second interval.
+    void ingest(std::span<const std::byte> datagram, int64_t nowNs);
+    void rollUp(int64_t nowNs);
 
-    struct FlowKeyHash {
-      std::size_t operator()(const FlowKey& key) const {
-        std::size_t seed = 0;
-        hash_combine(seed, std::get<0>(key));
-        hash_combine(seed, std::get<1>(key));
-        hash_combine(seed, std::get<2>(key));
-        hash_combine(seed, std::get<3>(key));
-        return seed;
-      }
-    };
+    // Latest published roll-up; nullptr before the first one. Lock-free.
+    std::shared_ptr<const RateSnapshot> getRateSnapshot() const {
+      return m_rateSnapshot.load();
+    }
 
-    struct CounterInfo {
-      time_t last_report_time;
-      uint64_t last_received_input_octets;
-      uint64_t last_received_output_octets;
-    };
+    IpAddress agentAddress(uint32_t agentId) { return m_agents.address(agentId); }
 
-    std::mutex m_statusMutex;
-    std::unordered_map<FlowKey, FlowInfo, FlowKeyHash> m_flowTable;
-    // key -> agent_ip and port
-    // value -> last_report_time, last_received_input_octets and last_received_output_octets, ...
-    std::map<std::pair<uint32_t, uint32_t>, CounterInfo> m_counterReports;
+    // Where counter-sample rates of known interfaces are recorded (usually
+    // TopologyManager::linkUtilization()). Call before start(); the index
+    // must outlive the collector.
+    void setLinkUtilization(const LinkUtilizationIndex* index) { m_linkUtilization = index; }
 
-    void start();
-    void stop();
+    // Where every roll-up appends its flow rates and the link rates sampled
+    // since the previous one. Call before start(); the history must outlive
+    // the collector.
+    void setRateHistory(RateHistory* history) { m_history = history; }
+
+    // Called at the end of every roll-up with the snapshot it published,
+    // outside the collector's locks, e.g. to correlate flows with links in
+    // step with the roll-ups. Call before start().
+    void setRollUpListener(std::function<void(const RateSnapshot&)> listener) {
+      m_rollUpListener = std::move(listener);
+    }
 
   private:
-    std::string ipToString(uint32_t ip);
-    std::string ourIpToString(uint32_t ip_front, uint32_t ip_back);
-    void calAvgFlowSendingRates();
+    // Per-worker flow accumulator. The owning receive worker adds sampled
+    // bytes into `live` while holding `mutex` for one batch at a time, so the
+    // only other party ever taking it is the roll-up, which swaps `live` and
+    // `spare` (O(1)) and merges the swapped-out deltas after unlocking.
+    struct FlowShard {
+      FlowShard(std::size_t tableCapacity, std::size_t maxInterfaces)
+          : live(tableCapacity), spare(tableCapacity), counters(maxInterfaces) {}
+
+      std::mutex mutex;
+      FlowTable live;
+      FlowTable spare;
+      // SKETCH aggregation: used instead of live/spare, swapped the same way
+      std::unique_ptr<TrafficSummary> live_summary;
+      std::unique_ptr<TrafficSummary> spare_summary;
+      // interface counters of the agents this worker receives
+      CounterPipeline counters;
+      // agent ids already resolved by this worker; no lock needed
+      std::unordered_map<IpAddress, uint32_t, IpAddressHash> agent_ids;
+      std::unordered_map<SubAgentRegistry::Key, SequenceTracker*, SubAgentRegistry::KeyHash>
+          trackers;
+      // ingest counters, written by the owning worker only
+      std::atomic<uint64_t> datagrams{0};
+      std::atomic<uint64_t> bytes{0};
+      std::atomic<uint64_t> decode_errors{0};
+      std::atomic<uint64_t> socket_drops{0};
+    };
+
+    void mergeShards();
+    void updateRates(int64_t nowNs);
+    void updateFlowRate(FlowInfo& info, int64_t fromMs, int64_t toMs);
+    void expireFlows();
+    void evictForBudget(std::size_t targetFlows);
+    void expireCounters(int64_t nowNs);
+    void publishSnapshot(int64_t nowNs);
+    void publishSummary(int64_t nowNs);
+    void recordHistory(const RateSnapshot& snapshot, int64_t nowNs);
     void initSocket();
-    void run();
-    void handlePacket(char *buffer);
+    int openSocket();
+    void run(int sockfd, FlowShard& shard);
+    // nowNs: receive time (wall clock) or capture time when replaying
+    void handlePacket(std::span<const std::byte> datagram, FlowShard& shard,
+                      int64_t nowNs);
+    uint32_t agentId(const IpAddress& agent, FlowShard& shard);
+    SequenceTracker& sequenceTracker(const IpAddress& agent, uint32_t subAgentId,
+                                     FlowShard& shard);
+    void logIngestHealth();
+
+    CollectorConfig m_config;
+    const LinkUtilizationIndex* m_linkUtilization = nullptr;
+    RateHistory* m_history = nullptr;
+    std::function<void(const RateSnapshot&)> m_rollUpListener;
+
+    // m_statusMutex guards m_flowTable and the roll-up state below. Only the
+    // roll-up writes them; ingest goes through FlowShard and readers through
+    // getRateSnapshot().
+    std::mutex m_statusMutex;
+    FlowTable m_flowTable;
+    AgentRegistry m_agents;
+    SubAgentRegistry m_subAgents;
+    std::atomic<std::shared_ptr<const RateSnapshot>> m_rateSnapshot;
+    std::size_t m_maxFlows;
+    std::size_t m_maxShardFlows;
+    // bytes held by the shards' live and spare tables, as of the last merge
+    std::size_t m_shardMemory = 0;
+    SketchLayout m_sketchLayout;
+
+    // Roll-up state, guarded by m_statusMutex like m_flowTable.
+    uint32_t m_tick = 0;
+    ExpiryWheel m_expiryWheel;
+    std::vector<FlowKey> m_dueFlows;
+    // flows that received bytes in the current and in the previous tick
+    std::vector<FlowKey> m_activeFlows;
+    std::vector<FlowKey> m_prevActiveFlows;
+    // roll-up time of the last history append
+    int64_t m_lastHistoryNs = 0;
+    // roll-up time of the previous updateRates()
+    int64_t m_lastRatesNs = 0;
+    // ingest losses already reported by logIngestHealth()
+    uint64_t m_loggedSocketDrops = 0;
+    uint64_t m_loggedSequenceLost = 0;
 
+    std::atomic<uint64_t> m_evictedIdle{0};
+    std::atomic<uint64_t> m_evictedActive{0};
+    std::atomic<uint64_t> m_evictedBudget{0};
+    std::atomic<uint64_t> m_droppedNewFlows{0};
+    std::atomic<uint64_t> m_flowCount{0};
+    std::atomic<uint64_t> m_flowMemory{0};
 
-    std::atomic<int> m_sockfd{-1};
+    std::vector<int> m_sockfds;
+    std::vector<std::unique_ptr<FlowShard>> m_shards;
     std::atomic<bool> m_running{false};
 
-    std::thread m_pktRcvThread;
-    std::thread m_calAvgFlowSendingRateThread;
+    std::vector<std::thread> m_pktRcvThreads;
+    // scheduler running the roll-up task while started; m_ownScheduler
+    // when start() was not given one
+    std::unique_ptr<PeriodicScheduler> m_ownScheduler;
+    PeriodicScheduler* m_scheduler = nullptr;
+    uint64_t m_rollUpTask = 0;
   };
 
 } // namespace sflow
@@ -0,0 +1,379 @@
+#include "SFlowDecoder.hpp"
+
+#include <cstring>
+
+using namespace std;
+
+namespace sflow {
+
+namespace {
+
+// sFlow v5 structure tags (enterprise 0).
+constexpr uint32_t SAMPLE_FLOW = 1;
+constexpr uint32_t SAMPLE_COUNTER = 2;
+constexpr uint32_t SAMPLE_FLOW_EXPANDED = 3;
+constexpr uint32_t SAMPLE_COUNTER_EXPANDED = 4;
+
+constexpr uint32_t FLOW_RAW_HEADER = 1;
+constexpr uint32_t FLOW_SAMPLED_IPV4 = 3;
+constexpr uint32_t FLOW_SAMPLED_IPV6 = 4;
+
+constexpr uint32_t COUNTER_GENERIC_IF = 1;
+
+constexpr uint32_t HEADER_PROTO_ETHERNET = 1;
+constexpr uint32_t HEADER_PROTO_IPV4 = 11;
+constexpr uint32_t HEADER_PROTO_IPV6 = 12;
+
+// Cursor over XDR-encoded (big endian, 4-byte aligned) data. Every read is
+// bounds checked; after the first failed read ok() stays false and all
+// further reads return zero.
+class XdrReader {
+public:
+  explicit XdrReader(span<const byte> data) : m_data(data) {}
+
+  bool ok() const { return m_ok; }
+  size_t remaining() const { return m_data.size() - m_pos; }
+
+  uint32_t u32() {
+    if (!require(4)) return 0;
+    const auto* p = reinterpret_cast<const uint8_t*>(m_data.data() + m_pos);
+    m_pos += 4;
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+           (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+  }
+
+  uint64_t u64() {
+    uint64_t hi = u32();
+    uint64_t lo = u32();
+    return (hi << 32) | lo;
+  }
+
+  const uint8_t* bytes(size_t n) {
+    if (!require(n)) return nullptr;
+    const auto* p = reinterpret_cast<const uint8_t*>(m_data.data() + m_pos);
+    m_pos += n;
+    return p;
+  }
+
+  // Opaque data is padded to a multiple of 4 bytes.
+  span<const byte> opaque(size_t n) {
+    size_t padded = (n + 3) & ~size_t(3);
+    if (padded < n || !require(padded)) return {};
+    auto out = m_data.subspan(m_pos, n);
+    m_pos += padded;
+    return out;
+  }
+
+  void skip(size_t n) {
+    if (require(n)) m_pos += n;
+  }
+
+  bool address(IpAddress& addr) {
+    uint32_t type = u32();
+    if (type == 1) {
+      const uint8_t* p = bytes(4);
+      if (p) addr = IpAddress::fromV4(p);
+    } else if (type == 2) {
+      const uint8_t* p = bytes(16);
+      if (p) addr = IpAddress::fromV6(p);
+    } else {
+      m_ok = false;
+    }
+    return m_ok;
+  }
+
+private:
+  bool require(size_t n) {
+    if (!m_ok || n > remaining()) {
+      m_ok = false;
+      return false;
+    }
+    return true;
+  }
+
+  span<const byte> m_data;
+  size_t m_pos = 0;
+  bool m_ok = true;
+};
+
+inline uint16_t load16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+
+void decodeTransport(const uint8_t* l4, size_t len, uint8_t proto, FlowSample& flow) {
+  if (proto != 6 && proto != 17 && proto != 132) return;
+  if (len < 4) return;
+  flow.src_port = load16(l4);
+  flow.dst_port = load16(l4 + 2);
+  if (proto == 6 && len >= 14) {
+    flow.tcp_flags = l4[13];
+  }
+}
+
+void decodeIpv4(const uint8_t* p, size_t len, FlowSample& flow) {
+  if (len < 20 || (p[0] >> 4) != 4) return;
+  size_t ihl = size_t(p[0] & 0x0f) * 4;
+  if (ihl < 20 || ihl > len) return;
+  flow.has_ip = true;
+  flow.ip_protocol = p[9];
+  flow.src_ip = IpAddress::fromV4(p + 12);
+  flow.dst_ip = IpAddress::fromV4(p + 16);
+  bool firstFragment = (load16(p + 6) & 0x1fff) == 0;
+  if (firstFragment) {
+    decodeTransport(p + ihl, len - ihl, flow.ip_protocol, flow);
+  }
+}
+
+void decodeIpv6(const uint8_t* p, size_t len, FlowSample& flow) {
+  if (len < 40 || (p[0] >> 4) != 6) return;
+  flow.has_ip = true;
+  flow.src_ip = IpAddress::fromV6(p + 8);
+  flow.dst_ip = IpAddress::fromV6(p + 24);
+  uint8_t next = p[6];
+  size_t off = 40;
+  // Skip the common extension headers to reach the transport header.
+  while (off + 8 <= len) {
+    if (next == 0 || next == 43 || next == 60) {
+      size_t extLen = (size_t(p[off + 1]) + 1) * 8;
+      next = p[off];
+      off += extLen;
+    } else if (next == 44) {
+      bool firstFragment = (load16(p + off + 2) & 0xfff8) == 0;
+      next = p[off];
+      off += 8;
+      if (!firstFragment) {
+        flow.ip_protocol = next;
+        return;
+      }
+    } else {
+      break;
+    }
+  }
+  flow.ip_protocol = next;
+  if (off <= len) {
+    decodeTransport(p + off, len - off, next, flow);
+  }
+}
+
+void decodeRawHeader(XdrReader& in, FlowSample& flow) {
+  uint32_t protocol = in.u32();
+  uint32_t frameLength = in.u32();
+  in.u32();  // stripped
+  uint32_t headerLength = in.u32();
+  auto header = in.opaque(headerLength);
+  if (!in.ok()) return;
+
+  flow.frame_length = frameLength;
+  const auto* p = reinterpret_cast<const uint8_t*>(header.data());
+  size_t len = header.size();
+
+  if (protocol == HEADER_PROTO_ETHERNET) {
+    if (len < 14) return;
+    uint16_t etherType = load16(p + 12);
+    size_t off = 14;
+    while ((etherType == 0x8100 || etherType == 0x88a8) && off + 4 <= len) {
+      etherType = load16(p + off + 2);
+      off += 4;
+    }
+    if (etherType == 0x0800) {
+      decodeIpv4(p + off, len - off, flow);
+    } else if (etherType == 0x86dd) {
+      decodeIpv6(p + off, len - off, flow);
+    }
+  } else if (protocol == HEADER_PROTO_IPV4) {
+    decodeIpv4(p, len, flow);
+  } else if (protocol == HEADER_PROTO_IPV6) {
+    decodeIpv6(p, len, flow);
+  }
+}
+
+void decodeSampledIp(XdrReader& in, bool v6, FlowSample& flow) {
+  uint32_t length = in.u32();
+  uint32_t protocol = in.u32();
+  const uint8_t* src = in.bytes(v6 ? 16 : 4);
+  const uint8_t* dst = in.bytes(v6 ? 16 : 4);
+  uint32_t srcPort = in.u32();
+  uint32_t dstPort = in.u32();
+  uint32_t tcpFlags = in.u32();
+  in.u32();  // tos / priority
+  if (!in.ok() || flow.has_ip) return;
+
+  flow.has_ip = true;
+  flow.frame_length = length;
+  flow.ip_protocol = uint8_t(protocol);
+  flow.src_ip = v6 ? IpAddress::fromV6(src) : IpAddress::fromV4(src);
+  flow.dst_ip = v6 ? IpAddress::fromV6(dst) : IpAddress::fromV4(dst);
+  flow.src_port = uint16_t(srcPort);
+  flow.dst_port = uint16_t(dstPort);
+  flow.tcp_flags = uint8_t(tcpFlags);
+}
+
+bool decodeFlowSample(XdrReader& in, bool expanded, FlowSample& flow) {
+  flow = FlowSample{};
+  flow.expanded = expanded;
+  flow.sequence_number = in.u32();
+  if (expanded) {
+    flow.source_id_type = in.u32();
+    flow.source_id_index = in.u32();
+  } else {
+    uint32_t sourceId = in.u32();
+    flow.source_id_type = sourceId >> 24;
+    flow.source_id_index = sourceId & 0x00ffffff;
+  }
+  flow.sampling_rate = in.u32();
+  flow.sample_pool = in.u32();
+  flow.drops = in.u32();
+  if (expanded) {
+    in.u32();  // input format
+    flow.input_if = in.u32();
+    in.u32();  // output format
+    flow.output_if = in.u32();
+  } else {
+    flow.input_if = in.u32() & 0x3fffffff;
+    flow.output_if = in.u32() & 0x3fffffff;
+  }
+
+  uint32_t records = in.u32();
+  for (uint32_t r = 0; r < records && in.ok(); r++) {
+    uint32_t format = in.u32();
+    uint32_t length = in.u32();
+    XdrReader rec(in.opaque(length));
+    if (!in.ok()) break;
+    if ((format >> 12) != 0) continue;  // enterprise specific
+    switch (format & 0xfff) {
+      case FLOW_RAW_HEADER: {
+        // A raw header is authoritative, so an IP packet in it replaces
+        // sampled-IP fields, frame length included; a non-IP or truncated
+        // one leaves them be, so that they all come from one record.
+        FlowSample header;
+        decodeRawHeader(rec, header);
+        if (rec.ok() && header.has_ip) {
+          flow.has_ip = true;
+          flow.frame_length = header.frame_length;
+          flow.ip_protocol = header.ip_protocol;
+          flow.tcp_flags = header.tcp_flags;
+          flow.src_port = header.src_port;
+          flow.dst_port = header.dst_port;
+          flow.src_ip = header.src_ip;
+          flow.dst_ip = header.dst_ip;
+        }
+        break;
+      }
+      case FLOW_SAMPLED_IPV4:
+        decodeSampledIp(rec, false, flow);
+        break;
+      case FLOW_SAMPLED_IPV6:
+        decodeSampledIp(rec, true, flow);
+        break;
+      default:
+        break;
+    }
+  }
+  return in.ok();
+}
+
+bool decodeCounterSample(XdrReader& in, bool expanded, CounterSample& counter) {
+  counter = CounterSample{};
+  counter.expanded = expanded;
+  counter.sequence_number = in.u32();
+  if (expanded) {
+    counter.source_id_type = in.u32();
+    counter.source_id_index = in.u32();
+  } else {
+    uint32_t sourceId = in.u32();
+    counter.source_id_type = sourceId >> 24;
+    counter.source_id_index = sourceId & 0x00ffffff;
+  }
+
+  uint32_t records = in.u32();
+  for (uint32_t r = 0; r < records && in.ok(); r++) {
+    uint32_t format = in.u32();
+    uint32_t length = in.u32();
+    XdrReader rec(in.opaque(length));
+    if (!in.ok()) break;
+    if (format != COUNTER_GENERIC_IF) continue;
+
+    counter.if_index = rec.u32();
+    counter.if_type = rec.u32();
+    counter.if_speed = rec.u64();
+    counter.if_direction = rec.u32();
+    counter.if_status = rec.u32();
+    counter.in_octets = rec.u64();
+    counter.in_ucast_pkts = rec.u32();
+    rec.u32();  // in multicast
+    rec.u32();  // in broadcast
+    counter.in_discards = rec.u32();
+    counter.in_errors = rec.u32();
+    rec.u32();  // in unknown protos
+    counter.out_octets = rec.u64();
+    counter.out_ucast_pkts = rec.u32();
+    rec.u32();  // out multicast
+    rec.u32();  // out broadcast
+    counter.out_discards = rec.u32();
+    counter.out_errors = rec.u32();
+    counter.has_generic = rec.ok();
+  }
+  return in.ok();
+}
+
+}  // namespace
+
+SFlowDecoder::SFlowDecoder(span<const byte> datagram) : m_data(datagram) {}
+
+DecodeStatus SFlowDecoder::decodeHeader(DatagramHeader& header) {
+  XdrReader in(m_data);
+  header.version = in.u32();
+  if (in.ok() && header.version != 5) {
+    return m_status = DecodeStatus::UNSUPPORTED_VERSION;
+  }
+  in.address(header.agent);
+  header.sub_agent_id = in.u32();
+  header.sequence_number = in.u32();
+  header.uptime = in.u32();
+  header.sample_count = in.u32();
+  if (!in.ok()) {
+    return m_status = DecodeStatus::TRUNCATED;
+  }
+  m_samplesLeft = header.sample_count;
+  m_pos = m_data.size() - in.remaining();
+  return m_status = DecodeStatus::OK;
+}
+
+bool SFlowDecoder::nextSample(Sample& sample) {
+  while (m_status == DecodeStatus::OK && m_samplesLeft > 0) {
+    m_samplesLeft--;
+    XdrReader in(m_data.subspan(m_pos));
+    uint32_t format = in.u32();
+    uint32_t length = in.u32();
+    XdrReader body(in.opaque(length));
+    if (!in.ok()) {
+      m_status = DecodeStatus::TRUNCATED;
+      return false;
+    }
+    m_pos = m_data.size() - in.remaining();
+
+    if ((format >> 12) != 0) continue;  // enterprise specific
+    bool decoded;
+    switch (format & 0xfff) {
+      case SAMPLE_FLOW:
+      case SAMPLE_FLOW_EXPANDED:
+        sample.kind = SampleKind::FLOW;
+        decoded = decodeFlowSample(body, format == SAMPLE_FLOW_EXPANDED, sample.flow);
+        break;
+      case SAMPLE_COUNTER:
+      case SAMPLE_COUNTER_EXPANDED:
+        sample.kind = SampleKind::COUNTER;
+        decoded = decodeCounterSample(body, format == SAMPLE_COUNTER_EXPANDED, sample.counter);
+        break;
+      default:
+        continue;
+    }
+    if (!decoded) {
+      // The sample's own length was valid but its contents overran it.
+      m_status = DecodeStatus::MALFORMED;
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+}  // namespace sflow
@@ -0,0 +1,113 @@
+#ifndef SFLOW_DECODER_HPP
+#define SFLOW_DECODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "IpAddress.hpp"
+
+namespace sflow {
+
+  // Bounds-checked, allocation-free walker over an sFlow v5 datagram.
+  // Samples and records are located by their declared tag/length, so unknown
+  // record types are skipped and truncated datagrams are rejected instead of
+  // read past the end.
+  //
+  //   SFlowDecoder decoder(datagram);
+  //   DatagramHeader header;
+  //   if (decoder.decodeHeader(header) != DecodeStatus::OK) return;
+  //   Sample sample;
+  //   while (decoder.nextSample(sample)) { ... }
+
+  enum class DecodeStatus { OK, TRUNCATED, UNSUPPORTED_VERSION, MALFORMED };
+
+  enum class SampleKind : uint8_t { FLOW, COUNTER };
+
+  struct DatagramHeader {
+    uint32_t version = 0;
+    IpAddress agent;
+    uint32_t sub_agent_id = 0;
+    uint32_t sequence_number = 0;
+    uint32_t uptime = 0;  // ms since the agent booted
+    uint32_t sample_count = 0;
+  };
+
+  // Flow sample (type 1) or expanded flow sample (type 3).
+  struct FlowSample {
+    bool expanded = false;
+    uint32_t sequence_number = 0;
+    uint32_t source_id_type = 0;
+    uint32_t source_id_index = 0;
+    uint32_t sampling_rate = 0;
+    uint32_t sample_pool = 0;
+    uint32_t drops = 0;
+    uint32_t input_if = 0;
+    uint32_t output_if = 0;
+
+    // Filled from a raw packet header record (preferred) or a sampled
+    // IPv4/IPv6 record. has_ip is false if neither carried an IP packet.
+    bool has_ip = false;
+    uint32_t frame_length = 0;
+    uint8_t ip_protocol = 0;
+    uint8_t tcp_flags = 0;
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    IpAddress src_ip;
+    IpAddress dst_ip;
+  };
+
+  // Counter sample (type 2) or expanded counter sample (type 4).
+  struct CounterSample {
+    bool expanded = false;
+    uint32_t sequence_number = 0;
+    uint32_t source_id_type = 0;
+    uint32_t source_id_index = 0;
+
+    // Generic interface counters record (tag 1).
+    bool has_generic = false;
+    uint32_t if_index = 0;
+    uint32_t if_type = 0;
+    uint64_t if_speed = 0;
+    uint32_t if_direction = 0;
+    uint32_t if_status = 0;
+    uint64_t in_octets = 0;
+    uint32_t in_ucast_pkts = 0;
+    uint32_t in_discards = 0;
+    uint32_t in_errors = 0;
+    uint64_t out_octets = 0;
+    uint32_t out_ucast_pkts = 0;
+    uint32_t out_discards = 0;
+    uint32_t out_errors = 0;
+  };
+
+  struct Sample {
+    SampleKind kind = SampleKind::FLOW;
+    FlowSample flow;
+    CounterSample counter;
+  };
+
+  class SFlowDecoder {
+  public:
+    explicit SFlowDecoder(std::span<const std::byte> datagram);
+
+    // Must be called first. Anything but OK means no samples can be read.
+    DecodeStatus decodeHeader(DatagramHeader& header);
+
+    // Decodes the next flow or counter sample, skipping sample types this
+    // decoder does not understand. Returns false at the end of the datagram
+    // or on error; status() tells which.
+    bool nextSample(Sample& sample);
+
+    DecodeStatus status() const { return m_status; }
+
+  private:
+    std::span<const std::byte> m_data;
+    std::size_t m_pos = 0;
+    uint32_t m_samplesLeft = 0;
+    DecodeStatus m_status = DecodeStatus::OK;
+  };
+
+} // namespace sflow
+
+#endif // SFLOW_DECODER_HPP
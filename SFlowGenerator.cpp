@@ -0,0 +1,186 @@
+#include "SFlowGenerator.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace sflow {
+
+namespace {
+
+void put32(vector<byte>& out, uint32_t v) {
+  out.push_back(byte(v >> 24));
+  out.push_back(byte(v >> 16));
+  out.push_back(byte(v >> 8));
+  out.push_back(byte(v));
+}
+
+void put64(vector<byte>& out, uint64_t v) {
+  put32(out, uint32_t(v >> 32));
+  put32(out, uint32_t(v));
+}
+
+// Reserves a 4-byte length field; finishLength() fills it in.
+size_t beginLength(vector<byte>& out) {
+  put32(out, 0);
+  return out.size();
+}
+
+void finishLength(vector<byte>& out, size_t start) {
+  uint32_t len = uint32_t(out.size() - start);
+  out[start - 4] = byte(len >> 24);
+  out[start - 3] = byte(len >> 16);
+  out[start - 2] = byte(len >> 8);
+  out[start - 1] = byte(len);
+}
+
+uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+SFlowGenerator::SFlowGenerator(const GeneratorConfig& config)
+    : m_config(config), m_state(config.seed) {
+  m_config.flows = max(1u, m_config.flows);
+  m_config.agents = max(1u, m_config.agents);
+  m_config.interfaces_per_agent = max(1u, m_config.interfaces_per_agent);
+  m_config.max_frame = max(m_config.min_frame, m_config.max_frame);
+  m_agents.resize(m_config.agents);
+  for (auto& agent : m_agents) {
+    agent.in_octets.assign(m_config.interfaces_per_agent, 0);
+    agent.out_octets.assign(m_config.interfaces_per_agent, 0);
+  }
+}
+
+uint64_t SFlowGenerator::random() {
+  m_state += 0x9e3779b97f4a7c15ULL;
+  return mix(m_state);
+}
+
+void SFlowGenerator::next(vector<byte>& out) {
+  out.clear();
+  uint32_t agentIndex = m_nextAgent;
+  m_nextAgent = (m_nextAgent + 1) % m_config.agents;
+  AgentState& agent = m_agents[agentIndex];
+
+  put32(out, 5);
+  put32(out, 1);  // IPv4 agent
+  put32(out, 0x0a000000 | (agentIndex + 1));
+  put32(out, 0);  // sub agent
+  put32(out, ++agent.sequence);
+  put32(out, agent.sequence * 10);  // uptime in ms
+  put32(out, m_config.samples_per_datagram);
+
+  for (uint32_t i = 0; i < m_config.samples_per_datagram; i++) {
+    if (uniform() < m_config.counter_fraction) {
+      writeCounterSample(out, agent);
+    } else {
+      writeFlowSample(out, agent, agentIndex);
+    }
+  }
+}
+
+void SFlowGenerator::writeFlowSample(vector<byte>& out, AgentState& agent,
+                                     uint32_t agentIndex) {
+  m_flowSamples++;
+  uint64_t flow = random() % m_config.flows;
+  uint64_t h = mix(flow ^ m_config.seed);
+  bool v6 = double(h & 0xffff) / 65536.0 < m_config.ipv6_fraction;
+  bool tcp = double((h >> 16) & 0xffff) / 65536.0 < m_config.tcp_fraction;
+  uint32_t frame = m_config.min_frame +
+                   uint32_t(random() % (m_config.max_frame - m_config.min_frame + 1));
+
+  // Ethernet + IP + L4 header, then zero payload up to header_bytes.
+  size_t ipLen = v6 ? 40 : 20;
+  size_t l4Len = tcp ? 20 : 8;
+  size_t minimum = 14 + ipLen + l4Len;
+  size_t headerLen = max<size_t>(minimum, min<size_t>(m_config.header_bytes, frame));
+  m_header.assign(headerLen, 0);
+  uint8_t* eth = m_header.data();
+  eth[12] = v6 ? 0x86 : 0x08;
+  eth[13] = v6 ? 0xdd : 0x00;
+  uint8_t* ip = eth + 14;
+  uint8_t proto = tcp ? 6 : 17;
+  if (v6) {
+    ip[0] = 0x60;
+    ip[6] = proto;
+    ip[8] = 0x20; ip[9] = 0x01; ip[10] = 0x0d; ip[11] = 0xb8;
+    memcpy(ip + 16, &h, 8);
+    ip[24] = 0x20; ip[25] = 0x01; ip[26] = 0x0d; ip[27] = 0xb8;
+    uint64_t h2 = mix(h);
+    memcpy(ip + 32, &h2, 8);
+  } else {
+    ip[0] = 0x45;
+    ip[2] = uint8_t(frame >> 8);
+    ip[3] = uint8_t(frame);
+    ip[9] = proto;
+    ip[12] = 10; ip[13] = uint8_t(h >> 24); ip[14] = uint8_t(h >> 32); ip[15] = uint8_t(h >> 40);
+    ip[16] = 10; ip[17] = uint8_t(h >> 48); ip[18] = uint8_t(h >> 56); ip[19] = uint8_t(flow);
+  }
+  uint8_t* l4 = ip + ipLen;
+  uint16_t srcPort = uint16_t(1024 + (h >> 20) % 60000);
+  uint16_t dstPort = uint16_t((h >> 40) & 1 ? 443 : 80 + (h >> 41) % 8000);
+  l4[0] = uint8_t(srcPort >> 8); l4[1] = uint8_t(srcPort);
+  l4[2] = uint8_t(dstPort >> 8); l4[3] = uint8_t(dstPort);
+  if (tcp) {
+    l4[12] = 0x50;
+    l4[13] = 0x10;  // ACK
+  }
+
+  put32(out, 1);  // flow sample
+  size_t sample = beginLength(out);
+  put32(out, ++agent.flow_sequence);
+  uint32_t inputIf = uint32_t(1 + (h + agentIndex) % m_config.interfaces_per_agent);
+  put32(out, inputIf);  // source id: ifIndex
+  put32(out, 256);
+  put32(out, agent.flow_sequence * 256);
+  put32(out, 0);
+  put32(out, inputIf);
+  put32(out, 1 + (h >> 8) % m_config.interfaces_per_agent);
+  put32(out, 1);  // one record
+
+  put32(out, 1);  // raw packet header
+  size_t record = beginLength(out);
+  put32(out, 1);  // ethernet
+  put32(out, frame);
+  put32(out, 4);
+  put32(out, uint32_t(m_header.size()));
+  for (uint8_t b : m_header) out.push_back(byte(b));
+  while (out.size() % 4) out.push_back(byte(0));
+  finishLength(out, record);
+  finishLength(out, sample);
+}
+
+void SFlowGenerator::writeCounterSample(vector<byte>& out, AgentState& agent) {
+  m_counterSamples++;
+  uint32_t itf = uint32_t(random() % m_config.interfaces_per_agent);
+  agent.in_octets[itf] += random() % 100000000;
+  agent.out_octets[itf] += random() % 100000000;
+
+  put32(out, 2);  // counter sample
+  size_t sample = beginLength(out);
+  put32(out, ++agent.counter_sequence);
+  put32(out, itf + 1);
+  put32(out, 1);  // one record
+
+  put32(out, 1);  // generic interface counters
+  size_t record = beginLength(out);
+  put32(out, itf + 1);
+  put32(out, 6);
+  put64(out, 10000000000ULL);
+  put32(out, 1);
+  put32(out, 3);
+  put64(out, agent.in_octets[itf]);
+  for (int i = 0; i < 6; i++) put32(out, 0);
+  put64(out, agent.out_octets[itf]);
+  for (int i = 0; i < 6; i++) put32(out, 0);
+  finishLength(out, record);
+  finishLength(out, sample);
+}
+
+}  // namespace sflow
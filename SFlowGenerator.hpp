@@ -0,0 +1,68 @@
+#ifndef SFLOW_GENERATOR_HPP
+#define SFLOW_GENERATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sflow {
+
+  struct GeneratorConfig {
+    uint64_t seed = 1;
+    // distinct 5-tuples samples are drawn from (uniformly)
+    uint32_t flows = 10000;
+    uint32_t agents = 16;
+    uint32_t interfaces_per_agent = 48;
+    uint32_t samples_per_datagram = 8;
+    // share of samples that are counter samples, the rest are flow samples
+    double counter_fraction = 0.05;
+    // share of flows that are TCP (the rest UDP) and that are IPv6
+    double tcp_fraction = 0.9;
+    double ipv6_fraction = 0.0;
+    // sampled frame sizes, drawn uniformly
+    uint32_t min_frame = 64;
+    uint32_t max_frame = 1500;
+    // bytes of each sampled packet copied into the raw header record
+    uint32_t header_bytes = 128;
+  };
+
+  // Deterministic generator of valid sFlow v5 datagrams: the same config and
+  // seed always produce the same byte stream. Flow samples carry raw
+  // Ethernet/IP/TCP-or-UDP headers, counter samples generic interface
+  // counters that grow monotonically per interface.
+  class SFlowGenerator {
+  public:
+    explicit SFlowGenerator(const GeneratorConfig& config);
+
+    // Writes the next datagram into `out`, replacing its contents.
+    void next(std::vector<std::byte>& out);
+
+    uint64_t flowSamples() const { return m_flowSamples; }
+    uint64_t counterSamples() const { return m_counterSamples; }
+
+  private:
+    struct AgentState {
+      uint32_t sequence = 0;
+      uint32_t flow_sequence = 0;
+      uint32_t counter_sequence = 0;
+      std::vector<uint64_t> in_octets;
+      std::vector<uint64_t> out_octets;
+    };
+
+    uint64_t random();
+    double uniform() { return double(random() >> 11) * (1.0 / 9007199254740992.0); }
+    void writeFlowSample(std::vector<std::byte>& out, AgentState& agent, uint32_t agentIndex);
+    void writeCounterSample(std::vector<std::byte>& out, AgentState& agent);
+
+    GeneratorConfig m_config;
+    uint64_t m_state;
+    uint32_t m_nextAgent = 0;
+    std::vector<AgentState> m_agents;
+    std::vector<uint8_t> m_header;
+    uint64_t m_flowSamples = 0;
+    uint64_t m_counterSamples = 0;
+  };
+
+} // namespace sflow
+
+#endif // SFLOW_GENERATOR_HPP
@@ -0,0 +1,193 @@
+#ifndef TEST_SUPPORT_HPP
+#define TEST_SUPPORT_HPP
+
+// Helpers shared by the standalone test_*.cpp programs: CHECK(), which
+// counts failures instead of aborting, and a loopback TCP server standing
+// in for Ryu, its event relay or any other peer.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+inline int& testFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond)                                                           \
+  do {                                                                        \
+    if (!(cond)) {                                                            \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      testFailures()++;                                                       \
+    }                                                                         \
+  } while (0)
+
+// Prints the outcome; returns main()'s exit code.
+inline int testResult(const char* name) {
+  if (testFailures() == 0) {
+    printf("%s: all checks passed\n", name);
+    return 0;
+  }
+  printf("%s: %d check(s) failed\n", name, testFailures());
+  return 1;
+}
+
+// Polls `done` every 10 ms; false if it is still false after `timeoutMs`.
+inline bool waitFor(const std::function<bool()>& done, int timeoutMs = 2000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() >= deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+// One accepted connection and what was received on it but not consumed.
+class StubConnection {
+public:
+  explicit StubConnection(int fd) : m_fd(fd) {}
+  ~StubConnection() { ::close(m_fd); }
+
+  StubConnection(const StubConnection&) = delete;
+  StubConnection& operator=(const StubConnection&) = delete;
+
+  // Reads one HTTP request head and returns its target (e.g. "/a?b=1");
+  // false on end of stream, error or timeout.
+  bool readRequest(std::string& target, int timeoutMs = 2000) {
+    size_t end;
+    while ((end = m_buffer.find("\r\n\r\n")) == std::string::npos) {
+      pollfd pfd{ m_fd, POLLIN, 0 };
+      if (::poll(&pfd, 1, timeoutMs) <= 0) return false;
+      char buffer[4096];
+      ssize_t n = ::recv(m_fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) return false;
+      m_buffer.append(buffer, size_t(n));
+    }
+    std::string line = m_buffer.substr(0, m_buffer.find("\r\n"));
+    m_buffer.erase(0, end + 4);
+    size_t first = line.find(' ');
+    size_t second = line.find(' ', first + 1);
+    if (first == std::string::npos || second == std::string::npos) return false;
+    target = line.substr(first + 1, second - first - 1);
+    return true;
+  }
+
+  bool send(const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      ssize_t n = ::send(m_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      sent += size_t(n);
+    }
+    return true;
+  }
+
+  // Ends the connection in both directions; the descriptor stays open
+  // until destruction, so it is never reused while a handler holds it.
+  void close() { ::shutdown(m_fd, SHUT_RDWR); }
+
+private:
+  int m_fd;
+  std::string m_buffer;
+};
+
+// TCP listener on an ephemeral 127.0.0.1 port. Connections are taken one
+// at a time with accept(), or all handled in the background with serve().
+class StubServer {
+public:
+  using Handler = std::function<void(StubConnection&)>;
+
+  StubServer() {
+    m_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (m_fd < 0 || ::bind(m_fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        ::listen(m_fd, 16) < 0 || ::getsockname(m_fd, (sockaddr*)&addr, &len) < 0) {
+      throw std::runtime_error("cannot open stub server");
+    }
+    m_port = ntohs(addr.sin_port);
+  }
+
+  ~StubServer() { stop(); }
+
+  uint16_t port() const { return m_port; }
+  std::string address() const { return "127.0.0.1:" + std::to_string(m_port); }
+  std::string url(const std::string& path) const { return "http://" + address() + path; }
+  size_t accepted() const { return m_accepted.load(); }
+
+  // Next connection; nullptr after `timeoutMs`.
+  std::unique_ptr<StubConnection> accept(int timeoutMs = 2000) {
+    pollfd pfd{ m_fd, POLLIN, 0 };
+    if (::poll(&pfd, 1, timeoutMs) <= 0) return nullptr;
+    int fd = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return nullptr;
+    m_accepted++;
+    return std::make_unique<StubConnection>(fd);
+  }
+
+  // Runs `handler` for every connection, each on a thread of its own,
+  // until stop().
+  void serve(Handler handler) {
+    m_serving = true;
+    m_acceptThread = std::thread([this, handler] {
+      while (m_serving) {
+        auto conn = accept(50);
+        if (!conn) continue;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        StubConnection& ref = *conn;
+        m_connections.push_back(std::move(conn));
+        m_threads.emplace_back([handler, &ref] { handler(ref); });
+      }
+    });
+  }
+
+  // Stops serving and closes the listener (further connects are refused)
+  // and every served connection.
+  void stop() {
+    m_serving = false;
+    if (m_acceptThread.joinable()) m_acceptThread.join();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (auto& conn : m_connections) conn->close();
+    }
+    for (auto& t : m_threads) t.join();
+    m_threads.clear();
+    m_connections.clear();
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+private:
+  int m_fd = -1;
+  uint16_t m_port = 0;
+  std::atomic<size_t> m_accepted{0};
+  std::atomic<bool> m_serving{false};
+  std::thread m_acceptThread;
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<StubConnection>> m_connections;
+  std::vector<std::thread> m_threads;
+};
+
+// "HTTP/1.1 <status> OK" with a Content-Length body.
+inline std::string httpResponse(const std::string& body, int status = 200) {
+  return "HTTP/1.1 " + std::to_string(status) + " OK\r\nContent-Type: application/json\r\n"
+         "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+#endif // TEST_SUPPORT_HPP
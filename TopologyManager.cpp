@@ -1,36 +1,175 @@
 #include "TopologyManager.hpp"
+#include "TopologyView.hpp"
+#include "Logger.hpp"
+#include "PeriodicScheduler.hpp"
 #include <iostream>
 #include <stdexcept>
-#include <cstdio>
 #include <array>
 #include <memory>
 #include <chrono>
-#include <sstream>
+#include <tuple>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
 
 using namespace std;
 using json = nlohmann::json;
 
-// Utility function: execute a command and return its output.
-string execCommand(const std::string& cmd) {
-  array<char, 128> buffer;
-  string result;
-  // Open a pipe to run the command.
-  using PipeCloser = int(*)(FILE*);
-  unique_ptr<FILE, PipeCloser> pipe(popen(cmd.c_str(), "r"), pclose);
-  if (!pipe) {
-    throw runtime_error("popen() failed!");
-  }
-  while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-    result += buffer.data();
+// Most bytes of the event feed applied per commit, see readEvents().
+#define TOPOLOGY_EVENT_DRAIN_BYTES (1 << 20)
+
+namespace {
+
+// Orders the endpoints so both directions of a link give the same key.
+void normalizeLink(TopologyManager::LinkKey& link) {
+  if (std::tie(link.dst_dpid, link.dst_port) < std::tie(link.src_dpid, link.src_port)) {
+    std::swap(link.src_dpid, link.dst_dpid);
+    std::swap(link.src_port, link.dst_port);
   }
-  return result;
 }
 
-TopologyManager::TopologyManager(const std::array<std::string, 3>& ryuUrl)
-  : m_ryuUrl(ryuUrl), m_running(false)
+// SAX handler for the Ryu topology REST responses. Each response is a JSON
+// array of objects; only the fields the graph uses are picked up, straight
+// into the output vector, without building a DOM:
+//   switches: [{"dpid": ..., "ports": [...]}]
+//   hosts:    [{"ipv4": ["a.b.c.d", ...], "port": {...}, ...}]
+//   links:    [{"src": {"dpid": ..., "port_no": ...}, "dst": {...}}]
+// Depth 1 is the outer array, depth 2 one element, depth 3 anything nested
+// in it; m_keys[d] is the last key seen in the object at depth d.
+class RyuSaxHandler {
+public:
+  enum Kind { SWITCHES, HOSTS, LINKS };
+
+  explicit RyuSaxHandler(Kind kind) : m_kind(kind) {}
+
+  std::vector<std::string>* switches = nullptr;
+  std::vector<TopologyManager::HostInfo>* hosts = nullptr;
+  std::vector<TopologyManager::LinkKey>* links = nullptr;
+
+  bool parse(const std::string& data, const char* what) {
+    if (!json::sax_parse(data, this) || m_depth != 0) {
+      LOG_WARN("topology", "%s JSON error: %s", what,
+               m_error.empty() ? "unexpected document structure" : m_error.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool null() { return true; }
+  bool boolean(bool) { return true; }
+  bool number_integer(json::number_integer_t) { return true; }
+  bool number_unsigned(json::number_unsigned_t value) {
+    // port_no is a hex string in Ryu, but accept a plain number too
+    if (m_kind == LINKS && m_depth == 3 && m_keys[3] == "port_no") {
+      (m_keys[2] == "src" ? m_link.src_port : m_link.dst_port) = uint32_t(value);
+    }
+    return true;
+  }
+  bool number_float(json::number_float_t, const json::string_t&) { return true; }
+  bool binary(json::binary_t&) { return true; }
+
+  bool string(json::string_t& value) {
+    switch (m_kind) {
+    case SWITCHES:
+      if (m_depth == 2 && m_keys[2] == "dpid") m_dpid = std::move(value);
+      break;
+    case HOSTS:
+      // first entry of the ipv4 array
+      if (m_depth == 3 && m_keys[2] == "ipv4" && m_host.ip.empty()) m_host.ip = std::move(value);
+      if (m_depth == 3 && m_keys[2] == "port" && m_keys[3] == "dpid") m_host.dpid = std::move(value);
+      break;
+    case LINKS:
+      if (m_depth == 3 && (m_keys[2] == "src" || m_keys[2] == "dst")) {
+        bool src = m_keys[2] == "src";
+        if (m_keys[3] == "dpid") {
+          (src ? m_link.src_dpid : m_link.dst_dpid) = std::move(value);
+        } else if (m_keys[3] == "port_no") {
+          (src ? m_link.src_port : m_link.dst_port) = uint32_t(strtoul(value.c_str(), nullptr, 16));
+        }
+      }
+      break;
+    }
+    return true;
+  }
+
+  bool start_object(std::size_t) {
+    if (++m_depth == 2) {
+      m_dpid.clear();
+      m_host = TopologyManager::HostInfo();
+      m_link = TopologyManager::LinkKey();
+    }
+    if (m_depth < m_keys.size()) m_keys[m_depth].clear();
+    return m_depth > 1;  // the document must be an array of objects
+  }
+
+  bool end_object() {
+    if (m_depth == 2) finishElement();
+    m_depth--;
+    return true;
+  }
+
+  bool start_array(std::size_t) {
+    ++m_depth;
+    return true;
+  }
+
+  bool end_array() {
+    m_depth--;
+    return true;
+  }
+
+  bool key(json::string_t& key) {
+    if (m_depth < m_keys.size()) m_keys[m_depth] = std::move(key);
+    return true;
+  }
+
+  bool parse_error(std::size_t, const std::string&, const json::exception& ex) {
+    m_error = ex.what();
+    return false;
+  }
+
+private:
+  void finishElement() {
+    switch (m_kind) {
+    case SWITCHES:
+      if (!m_dpid.empty()) switches->push_back(std::move(m_dpid));
+      break;
+    case HOSTS:
+      // TODO: check ip's correctness
+      if (!m_host.ip.empty() && m_host.ip != "0.0.0.0") hosts->push_back(std::move(m_host));
+      break;
+    case LINKS:
+      if (m_link.src_dpid.empty() || m_link.dst_dpid.empty()) break;
+      normalizeLink(m_link);
+      links->push_back(std::move(m_link));
+      break;
+    }
+  }
+
+  Kind m_kind;
+  size_t m_depth = 0;
+  std::array<std::string, 4> m_keys;
+  std::string m_dpid;
+  TopologyManager::HostInfo m_host;
+  TopologyManager::LinkKey m_link;
+  std::string m_error;
+};
+
+}  // namespace
+
+TopologyManager::TopologyManager(const std::array<std::string, 3>& ryuUrl,
+                                 const TopologyConfig& config)
+  : m_ryuUrl(ryuUrl), m_config(config), m_running(false)
 {
-  // You can initialize m_graph if needed.
+  for (size_t i = 0; i < m_ryuUrl.size(); i++) {
+    m_clients[i] = std::make_unique<HttpClient>(m_ryuUrl[i]);
+  }
+  publishSnapshot();
 }
 
 TopologyManager::~TopologyManager() {
@@ -38,166 +177,496 @@ TopologyManager::~TopologyManager() {
 }
 
 void TopologyManager::start() {
+  m_wakeFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_wakeFd < 0) {
+    throw runtime_error(string("eventfd: ") + strerror(errno));
+  }
   m_running.store(true);
   m_thread = std::thread(&TopologyManager::run, this);
+  setThreadAffinity(m_thread, m_config.cpus);
 }
 
 void TopologyManager::stop() {
   m_running.store(false);
+  if (m_wakeFd >= 0) {
+    uint64_t one = 1;
+    ssize_t written = ::write(m_wakeFd, &one, sizeof(one));
+    (void)written;
+  }
   if (m_thread.joinable()) {
     m_thread.join();
   }
-}
-
-TopologyManager::Graph TopologyManager::getGraph() {
-  std::lock_guard<std::mutex> lock(m_graphMutex);
-  // Returns a copy of the current graph.
-  return m_graph;
+  if (m_wakeFd >= 0) {
+    ::close(m_wakeFd);
+    m_wakeFd = -1;
+  }
 }
 
 void TopologyManager::fetchAndUpdateTopologyData() {
-  // Get switches
-  std::string curlCommand = "curl -s -X GET " + m_ryuUrl[0];
-  std::string switchesStr;
+  // Issue switches, hosts and links requests before reading any response so
+  // the controller serves them concurrently.
   try {
-    switchesStr = execCommand(curlCommand);
+    for (auto& client : m_clients) {
+      client->sendGet();
+    }
+    for (size_t i = 0; i < m_clients.size(); i++) {
+      int status = m_clients[i]->readResponse(m_responses[i]);
+      if (status != 200) {
+        throw runtime_error("HTTP " + to_string(status) + " from " + m_ryuUrl[i]);
+      }
+    }
   }
   catch (const std::exception& ex) {
-    std::cerr << "Error executing curl command: " << ex.what() << std::endl;
+    LOG_WARN("topology", "Error fetching topology: %s", ex.what());
+    // Responses still in flight on the other connections are discarded.
+    for (auto& client : m_clients) {
+      client->reset();
+    }
     return;
   }
 
-  curlCommand = "curl -s -X GET " + m_ryuUrl[1];
-  std::string hostsStr;
-  try {
-    hostsStr = execCommand(curlCommand);
+  updateGraph(m_responses[0], m_responses[1], m_responses[2]);
+}
+
+size_t TopologyManager::LinkKeyHash::operator()(const LinkKey& k) const {
+  size_t h = std::hash<std::string>()(k.src_dpid);
+  h = h * 31 + k.src_port;
+  h = h * 31 + std::hash<std::string>()(k.dst_dpid);
+  return h * 31 + k.dst_port;
+}
+
+bool TopologyManager::parseSwitches(const std::string& topologyData, std::vector<std::string>& dpids) {
+  dpids.clear();
+  RyuSaxHandler handler(RyuSaxHandler::SWITCHES);
+  handler.switches = &dpids;
+  return handler.parse(topologyData, "Switches");
+}
+
+bool TopologyManager::parseHosts(const std::string& topologyData, std::vector<HostInfo>& hosts) {
+  hosts.clear();
+  RyuSaxHandler handler(RyuSaxHandler::HOSTS);
+  handler.hosts = &hosts;
+  return handler.parse(topologyData, "Hosts");
+}
+
+bool TopologyManager::parseLinks(const std::string& topologyData, std::vector<LinkKey>& links) {
+  links.clear();
+  RyuSaxHandler handler(RyuSaxHandler::LINKS);
+  handler.links = &links;
+  return handler.parse(topologyData, "Links");
+}
+
+void TopologyManager::addSwitch(const std::string& dpid) {
+  auto [it, inserted] = m_switchIndex.try_emplace(dpid);
+  if (inserted) {
+    auto vertex = boost::add_vertex(m_graph);
+    m_graph[vertex].vertex_type = VertexType::SWITCH;
+    m_graph[vertex].switch_dpid = dpid;
+    it->second.vertex = vertex;
+    m_delta.switches_added++;
   }
-  catch (const std::exception& ex) {
-    std::cerr << "Error executing curl command: " << ex.what() << std::endl;
-    return;
+  it->second.generation = m_generation;
+}
+
+void TopologyManager::addHost(const HostInfo& host) {
+  auto [it, inserted] = m_hostIndex.try_emplace(host.ip);
+  if (inserted) {
+    auto vertex = boost::add_vertex(m_graph);
+    m_graph[vertex].vertex_type = VertexType::HOST;
+    m_graph[vertex].host_ip_addr = host.ip;
+    m_graph[vertex].attached_dpid = host.dpid;
+    it->second.vertex = vertex;
+    m_delta.hosts_added++;
+  } else if (m_graph[it->second.vertex].attached_dpid != host.dpid) {
+    m_graph[it->second.vertex].attached_dpid = host.dpid;
+    m_delta.hosts_moved++;
   }
+  it->second.generation = m_generation;
+}
 
-  curlCommand = "curl -s -X GET " + m_ryuUrl[2];
-  std::string linksStr;
-  try {
-    linksStr = execCommand(curlCommand);
+bool TopologyManager::addLink(const LinkKey& link) {
+  auto src = m_switchIndex.find(link.src_dpid);
+  auto dst = m_switchIndex.find(link.dst_dpid);
+  if (src == m_switchIndex.end() || dst == m_switchIndex.end()) {
+    return false;
   }
-  catch (const std::exception& ex) {
-    std::cerr << "Error executing curl command: " << ex.what() << std::endl;
-    return;
+  auto [it, inserted] = m_linkIndex.try_emplace(link);
+  if (inserted) {
+    auto [edge, added] = boost::add_edge(src->second.vertex, dst->second.vertex, m_graph);
+    m_graph[edge].link = link;
+    m_graph[edge].edge_id = ++m_lastEdgeId;
+    m_graph[edge].utilization = std::make_shared<sflow::LinkUtilization>();
+    it->second.edge = edge;
+    m_delta.links_added++;
   }
+  it->second.generation = m_generation;
+  return true;
+}
 
-  updateGraph(switchesStr, hostsStr, linksStr);
+void TopologyManager::removeSwitch(const std::string& dpid) {
+  auto it = m_switchIndex.find(dpid);
+  if (it == m_switchIndex.end()) return;
+  auto vertex = it->second.vertex;
+  // Drop the links of the switch from the index before the vertex goes.
+  for (auto [ei, ei_end] = boost::out_edges(vertex, m_graph); ei != ei_end; ++ei) {
+    m_linkIndex.erase(m_graph[*ei].link);
+    m_delta.links_removed++;
+  }
+  boost::clear_vertex(vertex, m_graph);
+  boost::remove_vertex(vertex, m_graph);
+  m_switchIndex.erase(it);
+  m_delta.switches_removed++;
 }
 
-void TopologyManager::updateSwitches(const std::string& topologyData) {
-  try {
-    auto j = json::parse(topologyData);
+void TopologyManager::removeHost(const std::string& ip) {
+  auto it = m_hostIndex.find(ip);
+  if (it == m_hostIndex.end()) return;
+  boost::clear_vertex(it->second.vertex, m_graph);
+  boost::remove_vertex(it->second.vertex, m_graph);
+  m_hostIndex.erase(it);
+  m_delta.hosts_removed++;
+}
 
-    for (const auto& sw : j) {
-      std::string dpid = sw.value("dpid", "");
-      // std::cout << dpid << std::endl;
-      a
-      
+void TopologyManager::removeLink(const LinkKey& link) {
+  auto it = m_linkIndex.find(link);
+  if (it == m_linkIndex.end()) return;
+  boost::remove_edge(it->second.edge, m_graph);
+  m_linkIndex.erase(it);
+  m_delta.links_removed++;
+}
 
-      auto vertex = boost::add_vertex(m_graph);
-      m_graph[vertex].vertex_type = VertexType::SWITCH;
-      m_graph[vertex].switch_dpid = dpid;
-    }
+void TopologyManager::updateSwitches(const std::vector<std::string>& dpids) {
+  for (const auto& dpid : dpids) {
+    addSwitch(dpid);
   }
-  catch (const json::parse_error& err) {
-    std::cerr << "JSON parse error: " << err.what() << std::endl;
-    return;
+}
+
+void TopologyManager::updateHosts(const std::vector<HostInfo>& hosts) {
+  for (const auto& host : hosts) {
+    addHost(host);
+  }
+  std::vector<std::string> stale;
+  for (const auto& [ip, entry] : m_hostIndex) {
+    if (entry.generation != m_generation) stale.push_back(ip);
+  }
+  for (const auto& ip : stale) {
+    removeHost(ip);
   }
 }
 
-void TopologyManager::updateHosts(const std::string& topologyData) {
-  try {
-    auto j = json::parse(topologyData);
-    std::cout << j << std::endl;
-    for (const auto& host : j) {
-      std::string ip = host["ipv4"].empty() ? "" : host["ipv4"][0];
-      // TODO: check ip's correctness
-      if (ip.empty() or ip == "0.0.0.0") continue;
-      // std::cout << ip << std::endl;
-      auto vertex = boost::add_vertex(m_graph);
-      m_graph[vertex].vertex_type = VertexType::HOST;
-      m_graph[vertex].host_ip_addr = ip;
+void TopologyManager::updateLinks(const std::vector<LinkKey>& links) {
+  for (const auto& link : links) {
+    if (!addLink(link)) {
+      LOG_WARN("topology", "Link %s:%u <-> %s:%u references an unknown switch",
+               link.src_dpid.c_str(), link.src_port, link.dst_dpid.c_str(), link.dst_port);
     }
   }
-  catch (const json::parse_error& err) {
-    std::cerr << "JSON parse error: " << err.what() << std::endl;
-    return;
+  std::vector<LinkKey> stale;
+  for (const auto& [link, entry] : m_linkIndex) {
+    if (entry.generation != m_generation) stale.push_back(link);
+  }
+  for (const auto& link : stale) {
+    removeLink(link);
   }
 }
 
-void TopologyManager::updateLinks(const std::string& topologyData) {
-  try {
-    auto j = json::parse(topologyData);
+void TopologyManager::removeStaleSwitches() {
+  std::vector<std::string> stale;
+  for (const auto& [dpid, entry] : m_switchIndex) {
+    if (entry.generation != m_generation) stale.push_back(dpid);
+  }
+  for (const auto& dpid : stale) {
+    removeSwitch(dpid);
+  }
+}
 
-    for (const auto& link : j) {
-      std::string src_dpid = link["src"].value("dpid", "");
-      std::string dst_dpid = link["dst"].value("dpid", "");
+void TopologyManager::updateGraph(const std::string& switchesStr, const std::string& hostsStr, const std::string& linksStr) {
+  // The topology rarely changes: only re-parse bodies that differ from the
+  // last successfully parsed one, and skip the update if none does. m_parsed
+  // keeps the previous result for the others.
+  const std::array<const std::string*, 3> bodies = { &switchesStr, &hostsStr, &linksStr };
+  bool changed = m_eventsApplied;
+  bool failed = false;
+  for (size_t i = 0; i < bodies.size(); i++) {
+    size_t hash = std::hash<std::string>()(*bodies[i]);
+    if (hash == m_responseHash[i]) continue;
+    changed = true;
+    bool ok = i == 0 ? parseSwitches(*bodies[i], m_parsed.switches)
+            : i == 1 ? parseHosts(*bodies[i], m_parsed.hosts)
+            : parseLinks(*bodies[i], m_parsed.links);
+    // A response that fails to parse must not read as "everything vanished";
+    // forget its hash so the next poll parses it again.
+    m_responseHash[i] = ok ? hash : 0;
+    failed |= !ok;
+  }
+  if (!changed || failed) {
+    return;
+  }
 
-      if (src_dpid.empty() || dst_dpid.empty()) continue;
+  m_generation++;
+  updateSwitches(m_parsed.switches);
+  updateHosts(m_parsed.hosts);
+  updateLinks(m_parsed.links);
+  removeStaleSwitches();
+  m_eventsApplied = false;
+  commitDelta();
+  // printGraph();
+}
 
-      // Check if both switches exist in the graph
-      try {
-        auto src_vertex = findSwitchByDpid(src_dpid);
-        auto dst_vertex = findSwitchByDpid(dst_dpid);
-        boost::add_edge(src_vertex, dst_vertex, m_graph);
-      }
-      catch (const std::runtime_error& e) {
-        std::cerr << "Warning: " << e.what() << std::endl;
-      }
+void TopologyManager::commitDelta() {
+  const TopologyDelta& d = m_delta;
+  if (d.switches_added || d.switches_removed || d.hosts_added || d.hosts_removed ||
+      d.hosts_moved || d.links_added || d.links_removed) {
+    LOG_INFO("topology", "Topology changed: switches +%zu/-%zu, hosts +%zu/-%zu (%zu moved), "
+             "links +%zu/-%zu (now %zu switches, %zu hosts, %zu links)",
+             d.switches_added, d.switches_removed, d.hosts_added, d.hosts_removed, d.hosts_moved,
+             d.links_added, d.links_removed,
+             m_switchIndex.size(), m_hostIndex.size(), m_linkIndex.size());
+    publishSnapshot();
+  }
+  m_delta = TopologyDelta();
+}
+
+void TopologyManager::publishSnapshot() {
+  auto previous = m_snapshot.load();
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->version = previous ? previous->version + 1 : 0;
+  snapshot->timestamp = std::chrono::system_clock::now();
+
+  // Rebuild rather than copy-construct so the snapshot's indexes can be
+  // filled with its own descriptors on the way.
+  Graph& graph = snapshot->graph;
+  std::unordered_map<Graph::vertex_descriptor, Graph::vertex_descriptor> mapped;
+  mapped.reserve(m_switchIndex.size() + m_hostIndex.size());
+  for (auto [vi, vi_end] = boost::vertices(m_graph); vi != vi_end; ++vi) {
+    const VertexProperties& prop = m_graph[*vi];
+    auto vertex = boost::add_vertex(prop, graph);
+    mapped.emplace(*vi, vertex);
+    if (prop.vertex_type == VertexType::SWITCH) {
+      snapshot->switches.emplace(prop.switch_dpid, vertex);
+    } else {
+      snapshot->hosts.emplace(prop.host_ip_addr, vertex);
     }
   }
-  catch (const json::parse_error& err) {
-    std::cerr << "JSON parse error: " << err.what() << std::endl;
-    return;
+  for (auto [ei, ei_end] = boost::edges(m_graph); ei != ei_end; ++ei) {
+    auto [edge, added] = boost::add_edge(mapped[boost::source(*ei, m_graph)],
+                                         mapped[boost::target(*ei, m_graph)], m_graph[*ei], graph);
+    snapshot->edges.emplace(m_graph[*ei].edge_id, edge);
+  }
+  // Host changes leave the fabric alone: keep its hop counts warm.
+  const TopologyDelta& d = m_delta;
+  bool fabricChanged = d.switches_added || d.switches_removed || d.links_added || d.links_removed;
+  try {
+    if (previous && previous->view && !fabricChanged) {
+      snapshot->view = std::make_shared<TopologyView>(*snapshot, *previous->view);
+    } else {
+      snapshot->view = std::make_shared<TopologyView>(*snapshot);
+    }
+  } catch (const std::exception& ex) {
+    LOG_WARN("topology", "No path view for topology version %llu: %s",
+             (unsigned long long)snapshot->version, ex.what());
+  }
+  m_snapshot.store(std::move(snapshot));
+  // Interface maps resolve to links only; hosts coming and going leave the
+  // current one valid.
+  if (!previous || fabricChanged) {
+    publishInterfaceMap();
   }
 }
 
-void TopologyManager::updateGraph(const std::string& switchesStr, const std::string& hostsStr, const std::string& linksStr) {
-  std::lock_guard<std::mutex> lock(m_graphMutex);
-  updateSwitches(switchesStr);
-  updateHosts(hostsStr);
-  updateLinks(linksStr);
-  // printGraph();
+void TopologyManager::setInterfaceBindings(std::vector<sflow::InterfaceBinding> bindings) {
+  {
+    std::lock_guard<std::mutex> lock(m_bindingsMutex);
+    m_bindings = std::move(bindings);
+    m_bindingsVersion++;
+  }
+  publishInterfaceMap();
+}
+
+void TopologyManager::publishInterfaceMap() {
+  std::lock_guard<std::mutex> lock(m_bindingsMutex);
+  // Always map against the latest snapshot, whichever caller gets here last.
+  auto snapshot = getSnapshot();
+  auto map = std::make_shared<sflow::InterfaceMap>();
+  map->topology_version = snapshot->version;
+  map->bindings_version = m_bindingsVersion;
+  if (!m_bindings.empty()) {
+    // "dpid:port" -> link end
+    std::unordered_map<std::string, sflow::InterfaceMap::Target> ports;
+    const Graph& graph = snapshot->graph;
+    for (auto [ei, ei_end] = boost::edges(graph); ei != ei_end; ++ei) {
+      const EdgeProperties& edge = graph[*ei];
+      ports[edge.link.src_dpid + ":" + std::to_string(edge.link.src_port)] = { edge.utilization, 0, edge.edge_id };
+      ports[edge.link.dst_dpid + ":" + std::to_string(edge.link.dst_port)] = { edge.utilization, 1, edge.edge_id };
+    }
+    for (const auto& binding : m_bindings) {
+      auto it = ports.find(binding.dpid + ":" + std::to_string(binding.port_no));
+      if (it != ports.end()) {
+        map->targets.emplace(sflow::InterfaceMap::Key{ binding.agent, binding.if_index }, it->second);
+      }
+    }
+  }
+  m_linkUtilization.publish(std::move(map));
 }
 
 void TopologyManager::printGraph() {
+  auto snapshot = getSnapshot();
+  const Graph& graph = snapshot->graph;
   std::cout << "=== Vertices ===" << std::endl;
-  for (auto [vi, vi_end] = boost::vertices(m_graph); vi != vi_end; ++vi) {
+  for (auto [vi, vi_end] = boost::vertices(graph); vi != vi_end; ++vi) {
     const auto& v = *vi;
-    const auto& prop = m_graph[v];
+    const auto& prop = graph[v];
     std::cout << (prop.vertex_type == VertexType::SWITCH ? "[Switch] " : "[Host] ")
       << "dpid: " << prop.switch_dpid << " addr: " << prop.host_ip_addr << "\n";
     std::cout << std::endl;
   }
   std::cout << "\n=== Edges ===" << std::endl;
-  for (auto [ei, ei_end] = boost::edges(m_graph); ei != ei_end; ++ei) {
-    auto src = boost::source(*ei, m_graph);
-    auto tgt = boost::target(*ei, m_graph);
-    std::cout << m_graph[src].switch_dpid<< " <--> " << m_graph[tgt].switch_dpid << std::endl;
+  for (auto [ei, ei_end] = boost::edges(graph); ei != ei_end; ++ei) {
+    auto src = boost::source(*ei, graph);
+    auto tgt = boost::target(*ei, graph);
+    std::cout << graph[src].switch_dpid<< " <--> " << graph[tgt].switch_dpid << std::endl;
   }
 }
 
-TopologyManager::Graph::vertex_descriptor TopologyManager::findSwitchByDpid(const std::string& dpid) {
-  for (auto [vi, vi_end] = boost::vertices(m_graph); vi != vi_end; ++vi) {
-    if (m_graph[*vi].vertex_type == VertexType::SWITCH and m_graph[*vi].switch_dpid == dpid) {
-      return *vi;
+bool TopologyManager::connectEventFeed() {
+  std::string target = m_config.event_feed;
+  if (target.compare(0, 6, "tcp://") == 0) target = target.substr(6);
+  size_t colon = target.rfind(':');
+  if (colon == std::string::npos) {
+    LOG_ERROR("topology", "Invalid event feed address (expected host:port): %s",
+              m_config.event_feed.c_str());
+    return false;
+  }
+  try {
+    m_eventFd = connectTcp(target.substr(0, colon), target.substr(colon + 1), 2000);
+  }
+  catch (const std::exception& ex) {
+    LOG_WARN("topology", "Event feed unavailable: %s", ex.what());
+    return false;
+  }
+  m_eventBuffer.clear();
+  LOG_INFO("topology", "Connected to topology event feed %s", m_config.event_feed.c_str());
+  return true;
+}
+
+bool TopologyManager::readEvents() {
+  // Everything the feed has buffered is applied before a single commit, so
+  // a burst of events publishes one snapshot instead of one per event. The
+  // pass is bounded so that a flooding feed cannot hold off REST polls.
+  char buffer[16384];
+  bool open = true;
+  for (size_t total = 0; total < TOPOLOGY_EVENT_DRAIN_BYTES;) {
+    ssize_t n = ::recv(m_eventFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n <= 0) {
+      LOG_WARN("topology", "Topology event feed closed: %s", n == 0 ? "end of stream" : strerror(errno));
+      ::close(m_eventFd);
+      m_eventFd = -1;
+      open = false;
+      break;
+    }
+    total += size_t(n);
+    m_eventBuffer.append(buffer, size_t(n));
+    size_t begin = 0;
+    for (size_t nl; (nl = m_eventBuffer.find('\n', begin)) != std::string::npos; begin = nl + 1) {
+      if (nl > begin) applyEvent(m_eventBuffer.substr(begin, nl - begin));
     }
+    m_eventBuffer.erase(0, begin);
+  }
+  commitDelta();
+  return open;
+}
+
+// One event per line, as written by ryu_topology_relay.py:
+//   {"event": "EventLinkDelete", "data": <Link.to_dict()>}
+// `data` has the same shape as one element of the matching REST response.
+void TopologyManager::applyEvent(const std::string& line) {
+  try {
+    auto j = json::parse(line);
+    const std::string event = j.value("event", "");
+    const json& data = j.at("data");
+    if (event == "EventSwitchEnter" || event == "EventSwitchLeave") {
+      std::string dpid = data.value("dpid", "");
+      if (dpid.empty()) return;
+      if (event == "EventSwitchEnter") addSwitch(dpid);
+      else removeSwitch(dpid);
+    }
+    else if (event == "EventLinkAdd" || event == "EventLinkDelete") {
+      LinkKey link;
+      link.src_dpid = data.at("src").value("dpid", "");
+      link.dst_dpid = data.at("dst").value("dpid", "");
+      // Ryu formats port numbers as zero-padded hex strings.
+      link.src_port = uint32_t(strtoul(data.at("src").value("port_no", "0").c_str(), nullptr, 16));
+      link.dst_port = uint32_t(strtoul(data.at("dst").value("port_no", "0").c_str(), nullptr, 16));
+      if (link.src_dpid.empty() || link.dst_dpid.empty()) return;
+      normalizeLink(link);
+      if (event == "EventLinkDelete") removeLink(link);
+      else if (!addLink(link)) {
+        LOG_WARN("topology", "Link event for unknown switch %s or %s",
+                 link.src_dpid.c_str(), link.dst_dpid.c_str());
+      }
+    }
+    else if (event == "EventHostAdd" || event == "EventHostDelete") {
+      const json& ipv4 = data.at("ipv4");
+      if (ipv4.empty()) return;
+      HostInfo host;
+      host.ip = ipv4[0];
+      if (host.ip == "0.0.0.0") return;
+      if (data.contains("port")) host.dpid = data["port"].value("dpid", "");
+      if (event == "EventHostAdd") addHost(host);
+      else removeHost(host.ip);
+    }
+    else {
+      return;
+    }
+    m_eventsApplied = true;
+  }
+  catch (const json::exception& err) {
+    LOG_WARN("topology", "Bad topology event: %s", err.what());
   }
-  throw std::runtime_error("Switch not found: " + dpid);
 }
 
 void TopologyManager::run() {
-  // std::cout << m_running.load() << std::endl;
-  while (true) {
-    fetchAndUpdateTopologyData();
-    // printGraph();
-    // Sleep for a while (e.g., 5 seconds) before fetching topology data again.
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+  using Clock = std::chrono::steady_clock;
+  auto nextPoll = Clock::now();
+  auto nextConnect = Clock::now();
+  while (m_running.load()) {
+    auto now = Clock::now();
+    if (!m_config.event_feed.empty() && m_eventFd < 0 && now >= nextConnect) {
+      if (connectEventFeed()) {
+        // Catch up on whatever changed while the feed was down.
+        nextPoll = now;
+      } else {
+        nextConnect = now + std::chrono::milliseconds(m_config.event_reconnect_ms);
+      }
+    }
+    if (now >= nextPoll) {
+      fetchAndUpdateTopologyData();
+      // printGraph();
+      // Polls stay on their period however long the fetch took; a fetch
+      // that overran skips the polls it missed.
+      uint32_t interval = m_eventFd >= 0 ? m_config.reconcile_interval_ms : m_config.poll_interval_ms;
+      auto period = std::chrono::milliseconds(std::max(1u, interval));
+      nextPoll += period;
+      auto after = Clock::now();
+      if (nextPoll <= after) {
+        nextPoll += ((after - nextPoll) / period + 1) * period;
+      }
+    }
+
+    // Wait for events until the next poll; stop() wakes the wait up.
+    auto wait = nextPoll - Clock::now();
+    int waitMs = int(std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count()));
+    pollfd pfds[2] = { { m_wakeFd, POLLIN, 0 }, { m_eventFd, POLLIN, 0 } };
+    int ready = ::poll(pfds, m_eventFd >= 0 ? 2 : 1, waitMs);
+    if (ready > 0 && m_eventFd >= 0 && (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) && !readEvents()) {
+      nextPoll = Clock::now();
+      nextConnect = Clock::now() + std::chrono::milliseconds(m_config.event_reconnect_ms);
+    }
+  }
+  if (m_eventFd >= 0) {
+    ::close(m_eventFd);
+    m_eventFd = -1;
   }
 }
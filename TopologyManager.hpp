@@ -4,9 +4,32 @@
 #include <atomic>
 #include <thread>
 #include <string>
-#include <mutex>
+#include <chrono>
 #include <array>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <boost/graph/adjacency_list.hpp>
+#include "HttpClient.hpp"
+#include "LinkUtilization.hpp"
+
+class TopologyView;
+
+struct TopologyConfig {
+  // host:port of a topology event feed (see ryu_topology_relay.py); empty
+  // to rely on REST polling alone.
+  std::string event_feed;
+  // REST poll period without an event feed, and while it is disconnected
+  uint32_t poll_interval_ms = 1000;
+  // REST poll period while the event feed is connected; the poll then only
+  // reconciles events that were lost or misapplied
+  uint32_t reconcile_interval_ms = 30000;
+  uint32_t event_reconnect_ms = 5000;
+  // CPUs of the updater thread, see setThreadAffinity(); empty leaves
+  // placement to the kernel
+  std::vector<int> cpus;
+};
 
 class TopologyManager {
 public:
@@ -15,39 +38,211 @@ public:
     VertexType vertex_type;
     std::string switch_dpid;
     std::string host_ip_addr;
+    // hosts: dpid of the switch the host is attached to (may be empty)
+    std::string attached_dpid;
+  };
+  // A switch-to-switch link; normalized so that (src_dpid, src_port) <=
+  // (dst_dpid, dst_port), which makes both directions Ryu reports one key.
+  struct LinkKey {
+    std::string src_dpid;
+    uint32_t src_port = 0;
+    std::string dst_dpid;
+    uint32_t dst_port = 0;
+    bool operator==(const LinkKey&) const = default;
+  };
+  // A host as Ryu reports it: its first IPv4 address and the switch it is
+  // attached to.
+  struct HostInfo {
+    std::string ip;
+    std::string dpid;
+  };
+  struct LinkKeyHash {
+    size_t operator()(const LinkKey& k) const;
+  };
+  struct EdgeProperties {
+    LinkKey link;
+    // Never reused while the manager lives; a link that goes away and comes
+    // back gets a new id. Lets other components refer to links without
+    // holding graph descriptors.
+    uint64_t edge_id = 0;
+    // Recent utilization measured at either end, written by the sFlow
+    // collector without locks; see setInterfaceBindings().
+    std::shared_ptr<sflow::LinkUtilization> utilization;
+  };
+  // listS keeps vertex and edge descriptors valid across removals, so the
+  // indexes below stay correct while the graph is updated incrementally.
+  using Graph = boost::adjacency_list<boost::listS, boost::listS, boost::undirectedS,
+                                      VertexProperties, EdgeProperties>;
+
+  // Immutable topology published after every refresh that changed
+  // something. Readers hold the shared_ptr for as long as they need a
+  // consistent view and compare `version` to skip work when nothing changed.
+  // The indexes refer to descriptors of `graph`.
+  struct Snapshot {
+    uint64_t version = 0;
+    std::chrono::system_clock::time_point timestamp;
+    Graph graph;
+    std::unordered_map<std::string, Graph::vertex_descriptor> switches;
+    std::unordered_map<std::string, Graph::vertex_descriptor> hosts;
+    std::unordered_map<uint64_t, Graph::edge_descriptor> edges;
+    // The same version compiled for path computations (TopologyView.hpp);
+    // null only if it could not be built.
+    std::shared_ptr<const TopologyView> view;
   };
-  using Graph = boost::adjacency_list<boost::vecS, boost::vecS, boost::undirectedS, VertexProperties>;
 
-  TopologyManager(const std::array<std::string, 3>& ryuUrl);
+  TopologyManager(const std::array<std::string, 3>& ryuUrl,
+                  const TopologyConfig& config = TopologyConfig());
   ~TopologyManager();
 
+  // Can be started again after stop(). stop() returns once a REST poll in
+  // progress completes (bounded by the HTTP timeout); waits are cut short.
   void start();
   void stop();
 
-  Graph getGraph();
+  std::shared_ptr<const Snapshot> getSnapshot() const { return m_snapshot.load(); }
+
+  // Copy of the current graph; prefer getSnapshot(), which does not copy.
+  Graph getGraph() const { return getSnapshot()->graph; }
 
   void printGraph();
 
+  // Tells which link end each sFlow (agent, ifIndex) measures. The mapping
+  // is re-resolved against every new topology version and published through
+  // linkUtilization(), which the collector reads for each counter sample.
+  void setInterfaceBindings(std::vector<sflow::InterfaceBinding> bindings);
+
+  sflow::LinkUtilizationIndex& linkUtilization() { return m_linkUtilization; }
+
 private:
   void run();
 
   void fetchAndUpdateTopologyData();
 
-  void updateSwitches(const std::string& topologyData);
+  // One fetch of the controller's view, parsed before the graph is touched.
+  struct TopologyData {
+    std::vector<std::string> switches;
+    std::vector<HostInfo> hosts;
+    std::vector<LinkKey> links;
+  };
+
+  bool parseSwitches(const std::string& topologyData, std::vector<std::string>& dpids);
 
-  void updateHosts(const std::string& topologyData);
+  bool parseHosts(const std::string& topologyData, std::vector<HostInfo>& hosts);
 
-  void updateLinks(const std::string& topologyData);
+  bool parseLinks(const std::string& topologyData, std::vector<LinkKey>& links);
+
+  // Each update marks what is still present with the current generation and
+  // removes what was not seen, so only the delta touches the graph.
+  void updateSwitches(const std::vector<std::string>& dpids);
+
+  void updateHosts(const std::vector<HostInfo>& hosts);
+
+  void updateLinks(const std::vector<LinkKey>& links);
+
+  void removeStaleSwitches();
 
   void updateGraph(const std::string&, const std::string&, const std::string&);
 
+  // Single-element updates shared by the REST diff and the event feed. The
+  // add functions stamp the element with the current generation.
+  void addSwitch(const std::string& dpid);
+
+  void addHost(const HostInfo& host);
+
+  bool addLink(const LinkKey& link);
+
+  void removeSwitch(const std::string& dpid);
+
+  void removeHost(const std::string& ip);
+
+  void removeLink(const LinkKey& link);
+
+  // Logs and publishes m_delta if it is not empty, then resets it.
+  void commitDelta();
+
+  void publishSnapshot();
+
+  void publishInterfaceMap();
+
+  bool connectEventFeed();
+
+  // Reads and applies whatever the feed has buffered, then publishes the
+  // changes as one snapshot; false once the feed closed.
+  bool readEvents();
+
+  void applyEvent(const std::string& line);
+
   std::array<std::string, 3> m_ryuUrl;
 
+  TopologyConfig m_config;
+
+  // One keep-alive connection per REST endpoint, and the buffers their
+  // responses are read into, reused across polls.
+  std::array<std::unique_ptr<HttpClient>, 3> m_clients;
+
+  std::array<std::string, 3> m_responses;
+
+  // Working copy, only touched by the updater thread; readers see the
+  // published snapshots.
   Graph m_graph;
 
-  Graph::vertex_descriptor findSwitchByDpid(const std::string& dpid);
+  struct VertexEntry {
+    Graph::vertex_descriptor vertex;
+    uint64_t generation;
+  };
+  struct EdgeEntry {
+    Graph::edge_descriptor edge;
+    uint64_t generation;
+  };
+
+  std::unordered_map<std::string, VertexEntry> m_switchIndex;
+
+  std::unordered_map<std::string, VertexEntry> m_hostIndex;
+
+  std::unordered_map<LinkKey, EdgeEntry, LinkKeyHash> m_linkIndex;
+
+  uint64_t m_generation = 0;
+
+  uint64_t m_lastEdgeId = 0;
+
+  TopologyData m_parsed;
+
+  // Hash of the last successfully parsed body per endpoint, 0 if none.
+  std::array<size_t, 3> m_responseHash{};
+
+  struct TopologyDelta {
+    size_t switches_added = 0;
+    size_t switches_removed = 0;
+    size_t hosts_added = 0;
+    size_t hosts_removed = 0;
+    size_t hosts_moved = 0;
+    size_t links_added = 0;
+    size_t links_removed = 0;
+  };
+
+  TopologyDelta m_delta;
+
+  // Set when events changed the graph since the last REST diff, which then
+  // runs even if no response body changed.
+  bool m_eventsApplied = false;
+
+  int m_eventFd = -1;
+
+  // eventfd written by stop() to wake the updater thread
+  int m_wakeFd = -1;
+
+  std::string m_eventBuffer;
+
+  std::atomic<std::shared_ptr<const Snapshot>> m_snapshot;
+
+  // Guards m_bindings and serializes interface map rebuilds, which come
+  // from the updater thread and from setInterfaceBindings().
+  std::mutex m_bindingsMutex;
+
+  std::vector<sflow::InterfaceBinding> m_bindings;
+  uint64_t m_bindingsVersion = 0;
 
-  std::mutex m_graphMutex;
+  sflow::LinkUtilizationIndex m_linkUtilization;
 
   std::atomic<bool> m_running{ true };
 
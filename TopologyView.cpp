@@ -0,0 +1,150 @@
+#include "TopologyView.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+using namespace std;
+
+TopologyView::TopologyView(const TopologyManager::Snapshot& snapshot)
+    : m_version(snapshot.version) {
+  auto fabric = make_shared<Fabric>();
+  fabric->dpids.reserve(snapshot.switches.size());
+  for (const auto& [dpid, vertex] : snapshot.switches) {
+    fabric->dpids.push_back(dpid);
+  }
+  if (fabric->dpids.size() >= UNREACHABLE) {
+    throw runtime_error("TopologyView: too many switches (" + to_string(fabric->dpids.size()) + ")");
+  }
+  sort(fabric->dpids.begin(), fabric->dpids.end());
+  fabric->node_index.reserve(fabric->dpids.size());
+  for (uint32_t i = 0; i < fabric->dpids.size(); i++) {
+    fabric->node_index.emplace(fabric->dpids[i], i);
+  }
+  m_fabric = fabric;
+
+  // Links between known, distinct switches, in edge_id order so that the
+  // ids and every ECMP choice derived from arc order are reproducible.
+  vector<pair<uint64_t, const TopologyManager::EdgeProperties*>> links;
+  links.reserve(snapshot.edges.size());
+  for (const auto& [id, edge] : snapshot.edges) {
+    links.emplace_back(id, &snapshot.graph[edge]);
+  }
+  sort(links.begin(), links.end(),
+       [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (const auto& [id, props] : links) {
+    uint32_t src = nodeOf(props->link.src_dpid);
+    uint32_t dst = nodeOf(props->link.dst_dpid);
+    if (src == NO_NODE || dst == NO_NODE || src == dst) continue;
+    fabric->edge_index.emplace(id, uint32_t(fabric->edge_ids.size()));
+    fabric->edge_ids.push_back(id);
+    fabric->edge_nodes.push_back({ src, dst });
+    fabric->edge_ports.push_back({ props->link.src_port, props->link.dst_port });
+    fabric->utilization.push_back(props->utilization);
+  }
+
+  vector<uint32_t>& offset = fabric->adj_offset;
+  offset.assign(fabric->dpids.size() + 1, 0);
+  for (const auto& ends : fabric->edge_nodes) {
+    offset[ends[0] + 1]++;
+    offset[ends[1] + 1]++;
+  }
+  partial_sum(offset.begin(), offset.end(), offset.begin());
+  fabric->adj.resize(offset.back());
+  vector<uint32_t> fillAt(offset.begin(), offset.end() - 1);
+  for (uint32_t e = 0; e < fabric->edge_nodes.size(); e++) {
+    const auto& ends = fabric->edge_nodes[e];
+    fabric->adj[fillAt[ends[0]]++] = Arc{ ends[1], e };
+    fabric->adj[fillAt[ends[1]]++] = Arc{ ends[0], e };
+  }
+
+  fabric->rows = make_unique<Row[]>(fabric->dpids.size());
+  indexHosts(snapshot);
+}
+
+TopologyView::TopologyView(const TopologyManager::Snapshot& snapshot, const TopologyView& previous)
+    : m_version(snapshot.version), m_fabric(previous.m_fabric) {
+  indexHosts(snapshot);
+}
+
+void TopologyView::indexHosts(const TopologyManager::Snapshot& snapshot) {
+  m_hostSwitch.reserve(snapshot.hosts.size());
+  for (const auto& [ip, vertex] : snapshot.hosts) {
+    sflow::IpAddress address;
+    uint32_t node = nodeOf(snapshot.graph[vertex].attached_dpid);
+    if (node != NO_NODE && sflow::IpAddress::parse(ip, address)) {
+      m_hostSwitch.emplace(address, node);
+    }
+  }
+}
+
+uint32_t TopologyView::nodeOf(const string& dpid) const {
+  auto it = m_fabric->node_index.find(dpid);
+  return it == m_fabric->node_index.end() ? NO_NODE : it->second;
+}
+
+uint32_t TopologyView::edgeOf(uint64_t edgeId) const {
+  auto it = m_fabric->edge_index.find(edgeId);
+  return it == m_fabric->edge_index.end() ? NO_EDGE : it->second;
+}
+
+uint32_t TopologyView::hostSwitch(const sflow::IpAddress& ip) const {
+  auto it = m_hostSwitch.find(ip);
+  return it == m_hostSwitch.end() ? NO_NODE : it->second;
+}
+
+void TopologyView::bfs(uint32_t dst, uint16_t* dist) const {
+  thread_local vector<uint32_t> queue;
+  fill(dist, dist + m_fabric->dpids.size(), UNREACHABLE);
+  dist[dst] = 0;
+  queue.clear();
+  queue.push_back(dst);
+  for (size_t head = 0; head < queue.size(); head++) {
+    uint32_t node = queue[head];
+    for (const Arc* arc = arcsBegin(node); arc != arcsEnd(node); arc++) {
+      if (dist[arc->node] == UNREACHABLE) {
+        dist[arc->node] = uint16_t(dist[node] + 1);
+        queue.push_back(arc->node);
+      }
+    }
+  }
+}
+
+const uint16_t* TopologyView::distances(uint32_t dst) const {
+  Row& row = m_fabric->rows[dst];
+  call_once(row.once, [&] {
+    row.dist = make_unique<uint16_t[]>(m_fabric->dpids.size());
+    bfs(dst, row.dist.get());
+  });
+  return row.dist.get();
+}
+
+void TopologyView::warm(const vector<uint32_t>& dsts, WorkStealingPool& pool) const {
+  pool.parallelFor(dsts.size(), [&](size_t i) { distances(dsts[i]); });
+}
+
+void TopologyView::nextHops(uint32_t node, uint32_t dst, vector<Arc>& out) const {
+  out.clear();
+  const uint16_t* dist = distances(dst);
+  if (dist[node] == UNREACHABLE || node == dst) return;
+  for (const Arc* arc = arcsBegin(node); arc != arcsEnd(node); arc++) {
+    if (dist[arc->node] + 1 == dist[node]) {
+      out.push_back(*arc);
+    }
+  }
+}
+
+bool TopologyView::path(uint32_t src, uint32_t dst, uint64_t flowHash, vector<uint32_t>& out) const {
+  thread_local vector<Arc> hops;
+  const uint16_t* dist = distances(dst);
+  if (dist[src] == UNREACHABLE) {
+    return false;
+  }
+  for (uint32_t node = src; node != dst;) {
+    nextHops(node, dst, hops);
+    const Arc& next = hops[hops.size() == 1 ? 0 : ecmpChoice(flowHash, node, hops.size())];
+    out.push_back(next.edge);
+    node = next.node;
+  }
+  return true;
+}
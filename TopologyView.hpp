@@ -0,0 +1,129 @@
+#ifndef TOPOLOGY_VIEW_HPP
+#define TOPOLOGY_VIEW_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IpAddress.hpp"
+#include "LinkUtilization.hpp"
+#include "TopologyManager.hpp"
+#include "WorkStealingPool.hpp"
+
+// One topology version compiled for path computations. Switches and links
+// get dense integer ids (switches in dpid order, links in edge_id order),
+// adjacency is CSR and every property is an array of its own, so walking
+// the fabric touches a few contiguous arrays instead of list nodes and
+// strings. TopologyManager builds one per published Snapshot (see
+// Snapshot::view).
+//
+// Hop counts towards a destination switch are computed by one BFS the
+// first time any reader asks for them and then shared by every reader of
+// the version; warm() fills many in parallel. A shortest path is then a
+// walk down decreasing hop counts, i.e. array reads only.
+//
+// Switches, links and their hop counts make up the fabric. A version whose
+// switches and links are those of the previous one shares its fabric, hop
+// counts computed so far included, and builds only its own host index.
+class TopologyView {
+public:
+  static constexpr uint32_t NO_NODE = UINT32_MAX;
+  static constexpr uint32_t NO_EDGE = UINT32_MAX;
+  static constexpr uint16_t UNREACHABLE = UINT16_MAX;
+
+  struct Arc {
+    uint32_t node;
+    uint32_t edge;
+  };
+
+  // Throws std::runtime_error above 65534 switches (hop counts are 16 bit).
+  explicit TopologyView(const TopologyManager::Snapshot& snapshot);
+  // Shares the fabric of `previous`, which must have the same switches and
+  // links as `snapshot`.
+  TopologyView(const TopologyManager::Snapshot& snapshot, const TopologyView& previous);
+
+  uint64_t version() const { return m_version; }
+
+  size_t switchCount() const { return m_fabric->dpids.size(); }
+  const std::string& dpid(uint32_t node) const { return m_fabric->dpids[node]; }
+  uint32_t nodeOf(const std::string& dpid) const;
+
+  size_t linkCount() const { return m_fabric->edge_ids.size(); }
+  uint64_t edgeId(uint32_t edge) const { return m_fabric->edge_ids[edge]; }
+  uint32_t edgeOf(uint64_t edgeId) const;
+  // end 0 is the link's src switch (TopologyManager::LinkKey), end 1 its dst
+  uint32_t edgeNode(uint32_t edge, int end) const { return m_fabric->edge_nodes[edge][end]; }
+  uint32_t edgePort(uint32_t edge, int end) const { return m_fabric->edge_ports[edge][end]; }
+  const std::shared_ptr<sflow::LinkUtilization>& utilization(uint32_t edge) const {
+    return m_fabric->utilization[edge];
+  }
+
+  const Arc* arcsBegin(uint32_t node) const { return m_fabric->adj.data() + m_fabric->adj_offset[node]; }
+  const Arc* arcsEnd(uint32_t node) const { return m_fabric->adj.data() + m_fabric->adj_offset[node + 1]; }
+
+  // Switch a host is attached to; NO_NODE if the host or its switch is
+  // unknown.
+  uint32_t hostSwitch(const sflow::IpAddress& ip) const;
+
+  // Hop counts from every switch to `dst`, UNREACHABLE where there is no
+  // path. Computed on first use; safe to call from any thread.
+  const uint16_t* distances(uint32_t dst) const;
+  uint32_t hopCount(uint32_t src, uint32_t dst) const { return distances(dst)[src]; }
+
+  // Computes the distances to each of `dsts` not computed yet, in parallel.
+  void warm(const std::vector<uint32_t>& dsts, WorkStealingPool& pool) const;
+
+  // Arcs out of `node` that lie on a shortest path to `dst`.
+  void nextHops(uint32_t node, uint32_t dst, std::vector<Arc>& out) const;
+
+  // Appends the links of the shortest path from `src` to `dst` that ECMP
+  // would pick for a flow hashing to `flowHash`; false if there is none.
+  bool path(uint32_t src, uint32_t dst, uint64_t flowHash, std::vector<uint32_t>& out) const;
+
+  // Index of the next hop among `count` equal-cost ones at `node`. The
+  // switch is mixed in so that flows sharing a choice at one switch still
+  // spread at the next.
+  static uint32_t ecmpChoice(uint64_t flowHash, uint32_t node, size_t count) {
+    uint64_t h = flowHash ^ (uint64_t(node) * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return uint32_t(h % count);
+  }
+
+private:
+  struct Row {
+    std::once_flag once;
+    std::unique_ptr<uint16_t[]> dist;
+  };
+
+  struct Fabric {
+    std::vector<std::string> dpids;
+    std::unordered_map<std::string, uint32_t> node_index;
+
+    std::vector<uint64_t> edge_ids;
+    std::unordered_map<uint64_t, uint32_t> edge_index;
+    std::vector<std::array<uint32_t, 2>> edge_nodes;
+    std::vector<std::array<uint32_t, 2>> edge_ports;
+    std::vector<std::shared_ptr<sflow::LinkUtilization>> utilization;
+
+    std::vector<uint32_t> adj_offset;
+    std::vector<Arc> adj;
+
+    // one per switch, filled on demand
+    std::unique_ptr<Row[]> rows;
+  };
+
+  void indexHosts(const TopologyManager::Snapshot& snapshot);
+  void bfs(uint32_t dst, uint16_t* dist) const;
+
+  uint64_t m_version = 0;
+  std::shared_ptr<const Fabric> m_fabric;
+  std::unordered_map<sflow::IpAddress, uint32_t, sflow::IpAddressHash> m_hostSwitch;
+};
+
+#endif // TOPOLOGY_VIEW_HPP
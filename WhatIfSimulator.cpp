@@ -0,0 +1,720 @@
+#include "WhatIfSimulator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+
+using namespace std;
+
+// Working memory of one run(), kept per thread. Marks are stamps compared
+// against a value taken per use, so nothing is cleared between scenarios
+// and a scenario costs only what it touches. Marks of a run and of a
+// destination repair have counters of their own: a destination stamp
+// wrapping mid-run must not clear the run's failures.
+struct WhatIfSimulator::Scratch {
+  uint32_t run = 0;  // stamp of the current scenario
+  uint32_t dst = 0;  // stamp of the destination being repaired
+
+  // failures (run)
+  vector<uint32_t> nodeDown;
+  vector<uint32_t> edgeDown;
+  vector<uint32_t> downNodes;
+  vector<uint32_t> downEdges;
+
+  // flows crossing a failure and their new paths (run)
+  vector<uint32_t> flowAffected;
+  vector<uint32_t> flowSlot;
+  vector<uint32_t> affected;
+  vector<uint32_t> paths;
+  vector<uint32_t> newBegin;
+  vector<uint32_t> newLength;
+  vector<uint8_t> newRouted;
+
+  // load change against the baseline, per directed link (run)
+  vector<uint32_t> linkTouched;
+  vector<int64_t> loadDelta;
+  vector<uint32_t> touched;
+  vector<uint32_t> linkOverloaded;
+  vector<uint32_t> overloaded;
+
+  // distance repair (dst)
+  vector<uint32_t> nodeQueued;
+  vector<uint32_t> nodeInvalid;
+  vector<uint32_t> nodeDist;
+  vector<uint32_t> invalid;
+  vector<pair<uint32_t, uint32_t>> heap;
+  vector<Arc> candidates;
+
+  // water-filling (run): S are the flows crossing an overloaded directed
+  // link, local links the directed links those flows use
+  vector<uint32_t> flowInS;
+  vector<uint32_t> flowSIndex;
+  vector<uint32_t> sFlow;
+  vector<const uint32_t*> sPath;
+  vector<uint32_t> sLength;
+  vector<double> sAlloc;
+  vector<uint8_t> sFrozen;
+  vector<uint32_t> sOrder;
+  vector<uint32_t> linkLocal;
+  vector<uint32_t> linkLocalIndex;
+  vector<uint32_t> lLink;
+  vector<double> lRemaining;
+  vector<double> lLevel;
+  vector<uint32_t> lCount;
+  vector<uint8_t> lSaturated;
+  vector<uint32_t> lOffset;
+  vector<uint32_t> lCursor;
+  vector<uint32_t> lFlows;
+  vector<pair<double, uint32_t>> fillHeap;
+
+  void prepare(size_t nodes, size_t edges, size_t flows) {
+    // Grow only: stamps left by another simulator are older than any
+    // stamp taken from now on.
+    if (nodeDown.size() < nodes) {
+      for (auto* v : { &nodeDown, &nodeQueued, &nodeInvalid, &nodeDist }) v->resize(nodes);
+    }
+    if (edgeDown.size() < edges) {
+      edgeDown.resize(edges);
+      for (auto* v : { &linkTouched, &linkOverloaded, &linkLocal, &linkLocalIndex }) {
+        v->resize(2 * edges);
+      }
+      loadDelta.resize(2 * edges);
+    }
+    if (flowAffected.size() < flows) {
+      for (auto* v : { &flowAffected, &flowSlot, &flowInS, &flowSIndex }) v->resize(flows);
+    }
+  }
+
+  uint32_t nextRun() {
+    if (++run == 0) {
+      for (auto* v : { &nodeDown, &edgeDown, &flowAffected, &linkTouched, &linkOverloaded,
+                       &linkLocal, &flowInS }) {
+        fill(v->begin(), v->end(), 0);
+      }
+      run = 1;
+    }
+    return run;
+  }
+
+  uint32_t nextDst() {
+    if (++dst == 0) {
+      for (auto* v : { &nodeQueued, &nodeInvalid }) fill(v->begin(), v->end(), 0);
+      dst = 1;
+    }
+    return dst;
+  }
+};
+
+WhatIfSimulator::WhatIfSimulator(shared_ptr<const TopologyView> topology,
+                                 vector<FlowDemand> demands, const SimulationConfig& config,
+                                 WorkStealingPool* pool)
+    : m_view(std::move(topology)), m_config(config) {
+  const TopologyView& view = *m_view;
+
+  // A direction is limited by the port sending it, i.e. the speed its end
+  // reported. If only the other end reported one, that speed is used, and
+  // if neither did, the configured default.
+  m_capacity.assign(2 * view.linkCount(), 0);
+  for (uint32_t e = 0; e < view.linkCount(); e++) {
+    uint64_t speed[2] = { 0, 0 };
+    if (view.utilization(e)) {
+      for (uint32_t end = 0; end < 2; end++) {
+        sflow::UtilizationSample sample;
+        if (view.utilization(e)->ends[end].latest(sample)) {
+          speed[end] = sample.if_speed;
+        }
+      }
+    }
+    for (uint32_t from = 0; from < 2; from++) {
+      uint64_t capacity = speed[from] ? speed[from] : speed[1 - from];
+      m_capacity[directedLink(e, from)] = capacity ? capacity : m_config.default_link_capacity_bps;
+    }
+  }
+
+  sflow::FlowKeyHash hash;
+  m_demands.reserve(demands.size());
+  m_flows.reserve(demands.size());
+  for (FlowDemand& demand : demands) {
+    uint32_t src = view.nodeOf(demand.src_dpid);
+    uint32_t dst = view.nodeOf(demand.dst_dpid);
+    if (src == TopologyView::NO_NODE || dst == TopologyView::NO_NODE) {
+      m_unplaced++;
+      continue;
+    }
+    m_flows.push_back(Flow{ src, dst, demand.rate, hash(demand.key), 0, 0, false });
+    m_offered += demand.rate;
+    m_demands.push_back(std::move(demand));
+  }
+
+  routeBaseline(pool);
+
+  // Baseline indexes: which flows use each link direction and start or end
+  // at each switch, and the load every direction carries at full demand.
+  m_linkFlowOffset.assign(2 * view.linkCount() + 1, 0);
+  m_nodeFlowOffset.assign(view.switchCount() + 1, 0);
+  for (const Flow& flow : m_flows) {
+    for (uint32_t i = 0; i < flow.path_length; i++) {
+      m_linkFlowOffset[m_paths[flow.path_begin + i] + 1]++;
+    }
+    m_nodeFlowOffset[flow.src + 1]++;
+    if (flow.dst != flow.src) {
+      m_nodeFlowOffset[flow.dst + 1]++;
+    }
+  }
+  partial_sum(m_linkFlowOffset.begin(), m_linkFlowOffset.end(), m_linkFlowOffset.begin());
+  partial_sum(m_nodeFlowOffset.begin(), m_nodeFlowOffset.end(), m_nodeFlowOffset.begin());
+  m_linkFlows.resize(m_linkFlowOffset.back());
+  m_nodeFlows.resize(m_nodeFlowOffset.back());
+  m_baseLoad.assign(2 * view.linkCount(), 0);
+  vector<uint32_t> linkAt(m_linkFlowOffset.begin(), m_linkFlowOffset.end() - 1);
+  vector<uint32_t> nodeAt(m_nodeFlowOffset.begin(), m_nodeFlowOffset.end() - 1);
+  for (uint32_t f = 0; f < m_flows.size(); f++) {
+    const Flow& flow = m_flows[f];
+    for (uint32_t i = 0; i < flow.path_length; i++) {
+      uint32_t link = m_paths[flow.path_begin + i];
+      m_linkFlows[linkAt[link]++] = f;
+      m_baseLoad[link] += flow.demand;
+    }
+    m_nodeFlows[nodeAt[flow.src]++] = f;
+    if (flow.dst != flow.src) {
+      m_nodeFlows[nodeAt[flow.dst]++] = f;
+    }
+    if (!flow.routed) {
+      m_unroutable++;
+      m_unroutedDemand += flow.demand;
+    }
+  }
+  m_byDemand.resize(m_flows.size());
+  iota(m_byDemand.begin(), m_byDemand.end(), 0);
+  sort(m_byDemand.begin(), m_byDemand.end(),
+       [&](uint32_t a, uint32_t b) { return m_flows[a].demand < m_flows[b].demand; });
+  for (uint32_t link = 0; link < m_baseLoad.size(); link++) {
+    if (m_baseLoad[link] > m_capacity[link]) {
+      m_baseOverloaded.push_back(link);
+    }
+  }
+
+  m_baseline = run(Scenario());
+}
+
+vector<FlowDemand> WhatIfSimulator::demandsFromRates(const TopologyView& view,
+                                                     const sflow::RateSnapshot& rates) {
+  vector<FlowDemand> demands;
+  demands.reserve(rates.flows.size());
+  for (const sflow::FlowRate& flow : rates.flows) {
+    uint32_t src = view.hostSwitch(flow.key.srcAddress());
+    uint32_t dst = view.hostSwitch(flow.key.dstAddress());
+    if (src == TopologyView::NO_NODE || dst == TopologyView::NO_NODE) continue;
+    demands.push_back(FlowDemand{ flow.key, view.dpid(src), view.dpid(dst), flow.rate });
+  }
+  return demands;
+}
+
+vector<Scenario> WhatIfSimulator::singleLinkFailures(const TopologyView& view) {
+  vector<Scenario> scenarios(view.linkCount());
+  for (uint32_t e = 0; e < view.linkCount(); e++) {
+    scenarios[e].failed_links.push_back(view.edgeId(e));
+  }
+  return scenarios;
+}
+
+vector<Scenario> WhatIfSimulator::singleSwitchFailures(const TopologyView& view) {
+  vector<Scenario> scenarios(view.switchCount());
+  for (uint32_t node = 0; node < view.switchCount(); node++) {
+    scenarios[node].failed_switches.push_back(view.dpid(node));
+  }
+  return scenarios;
+}
+
+uint32_t WhatIfSimulator::distance(uint32_t node, const uint16_t* base, const Scratch& s) const {
+  if (s.nodeDown[node] == s.run) return UNREACHABLE;
+  if (s.nodeInvalid[node] == s.dst) return s.nodeDist[node];
+  return base[node] == TopologyView::UNREACHABLE ? UNREACHABLE : base[node];
+}
+
+void WhatIfSimulator::repairDistances(uint32_t dst, const uint16_t* base, Scratch& s) const {
+  s.nextDst();
+  auto& heap = s.heap;
+  auto later = greater<pair<uint32_t, uint32_t>>();
+  heap.clear();
+  s.invalid.clear();
+  auto queue = [&](uint32_t node) {
+    if (node == dst || base[node] == TopologyView::UNREACHABLE || s.nodeQueued[node] == s.dst) return;
+    s.nodeQueued[node] = s.dst;
+    heap.emplace_back(base[node], node);
+    push_heap(heap.begin(), heap.end(), later);
+  };
+
+  // Only a switch whose shortest-path next hop failed can lose its
+  // distance, and only then the switches that went through it.
+  for (uint32_t e : s.downEdges) {
+    uint32_t u = m_view->edgeNode(e, 0);
+    uint32_t v = m_view->edgeNode(e, 1);
+    if (base[u] == TopologyView::UNREACHABLE || base[v] == TopologyView::UNREACHABLE) continue;
+    if (base[u] == base[v] + 1) queue(u);
+    if (base[v] == base[u] + 1) queue(v);
+  }
+  for (uint32_t node : s.downNodes) {
+    if (base[node] == TopologyView::UNREACHABLE) continue;
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node); arc++) {
+      if (base[arc->node] == base[node] + 1) queue(arc->node);
+    }
+  }
+
+  // In order of baseline distance, so that every possible next hop of a
+  // switch has been settled before the switch is checked.
+  while (!heap.empty()) {
+    pop_heap(heap.begin(), heap.end(), later);
+    uint32_t node = heap.back().second;
+    heap.pop_back();
+    if (s.nodeDown[node] == s.run) continue;
+    bool kept = false;
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node) && !kept; arc++) {
+      kept = s.edgeDown[arc->edge] != s.run && s.nodeDown[arc->node] != s.run &&
+             s.nodeInvalid[arc->node] != s.dst && base[arc->node] + 1 == base[node];
+    }
+    if (kept) continue;
+    s.nodeInvalid[node] = s.dst;
+    s.invalid.push_back(node);
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node); arc++) {
+      if (base[arc->node] == base[node] + 1) queue(arc->node);
+    }
+  }
+  if (s.invalid.empty()) return;
+
+  // New distances of the invalidated switches: seeded from their settled
+  // neighbours, then relaxed among themselves.
+  for (uint32_t node : s.invalid) {
+    uint32_t best = UNREACHABLE;
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node); arc++) {
+      if (s.edgeDown[arc->edge] == s.run || s.nodeDown[arc->node] == s.run ||
+          s.nodeInvalid[arc->node] == s.dst || base[arc->node] == TopologyView::UNREACHABLE) {
+        continue;
+      }
+      best = min<uint32_t>(best, base[arc->node] + 1u);
+    }
+    s.nodeDist[node] = best;
+    if (best != UNREACHABLE) {
+      heap.emplace_back(best, node);
+      push_heap(heap.begin(), heap.end(), later);
+    }
+  }
+  while (!heap.empty()) {
+    pop_heap(heap.begin(), heap.end(), later);
+    auto [dist, node] = heap.back();
+    heap.pop_back();
+    if (dist != s.nodeDist[node]) continue;
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node); arc++) {
+      if (s.edgeDown[arc->edge] == s.run || s.nodeInvalid[arc->node] != s.dst ||
+          s.nodeDown[arc->node] == s.run || s.nodeDist[arc->node] <= dist + 1) {
+        continue;
+      }
+      s.nodeDist[arc->node] = dist + 1;
+      heap.emplace_back(dist + 1, arc->node);
+      push_heap(heap.begin(), heap.end(), later);
+    }
+  }
+}
+
+bool WhatIfSimulator::route(const Flow& flow, const uint16_t* base, const Scratch& s,
+                            vector<uint32_t>& path, vector<Arc>& candidates) const {
+  uint32_t node = flow.src;
+  uint32_t dist = distance(node, base, s);
+  if (dist == UNREACHABLE) {
+    return false;
+  }
+  size_t begin = path.size();
+  while (node != flow.dst) {
+    candidates.clear();
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node); arc++) {
+      if (s.edgeDown[arc->edge] == s.run) continue;
+      if (distance(arc->node, base, s) + 1 == dist) {
+        candidates.push_back(*arc);
+      }
+    }
+    // No next hop only if the repaired distances are inconsistent; better
+    // unroutable than a read past the end.
+    if (candidates.empty()) {
+      path.resize(begin);
+      return false;
+    }
+    const Arc& next = candidates.size() == 1
+        ? candidates[0] : candidates[TopologyView::ecmpChoice(flow.hash, node, candidates.size())];
+    path.push_back(directedLink(next.edge, m_view->edgeNode(next.edge, 0) == node ? 0 : 1));
+    node = next.node;
+    dist--;
+  }
+  return true;
+}
+
+void WhatIfSimulator::routeBaseline(WorkStealingPool* pool) {
+  // Flows grouped by the switch they leave at share its distances, which
+  // are computed up front in parallel when a pool is given.
+  vector<uint32_t> order(m_flows.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(),
+              [&](uint32_t a, uint32_t b) { return m_flows[a].dst < m_flows[b].dst; });
+  vector<uint32_t> groupBegin;
+  vector<uint32_t> dsts;
+  for (uint32_t i = 0; i < order.size(); i++) {
+    if (i == 0 || m_flows[order[i]].dst != m_flows[order[i - 1]].dst) {
+      groupBegin.push_back(i);
+      dsts.push_back(m_flows[order[i]].dst);
+    }
+  }
+  size_t groups = groupBegin.size();
+  groupBegin.push_back(uint32_t(order.size()));
+
+  vector<vector<uint32_t>> groupPaths(groups);
+  auto routeGroup = [&](size_t g) {
+    vector<uint32_t>& paths = groupPaths[g];
+    for (uint32_t i = groupBegin[g]; i < groupBegin[g + 1]; i++) {
+      Flow& flow = m_flows[order[i]];
+      flow.path_begin = uint32_t(paths.size());
+      flow.routed = m_view->path(flow.src, flow.dst, flow.hash, paths);
+      flow.path_length = uint32_t(paths.size()) - flow.path_begin;
+      // The view's paths are links in order; note the direction of each.
+      uint32_t node = flow.src;
+      for (uint32_t k = flow.path_begin; k < paths.size(); k++) {
+        uint32_t e = paths[k];
+        uint32_t from = m_view->edgeNode(e, 0) == node ? 0 : 1;
+        paths[k] = directedLink(e, from);
+        node = m_view->edgeNode(e, 1 - from);
+      }
+    }
+  };
+  if (pool) {
+    m_view->warm(dsts, *pool);
+    pool->parallelFor(groups, routeGroup);
+  } else {
+    for (size_t g = 0; g < groups; g++) routeGroup(g);
+  }
+
+  size_t total = 0;
+  for (const auto& paths : groupPaths) total += paths.size();
+  m_paths.clear();
+  m_paths.reserve(total);
+  for (size_t g = 0; g < groups; g++) {
+    uint32_t offset = uint32_t(m_paths.size());
+    m_paths.insert(m_paths.end(), groupPaths[g].begin(), groupPaths[g].end());
+    for (uint32_t i = groupBegin[g]; i < groupBegin[g + 1]; i++) {
+      m_flows[order[i]].path_begin += offset;
+    }
+  }
+}
+
+int64_t WhatIfSimulator::load(uint32_t link, const Scratch& s) const {
+  int64_t load = int64_t(m_baseLoad[link]);
+  return s.linkTouched[link] == s.run ? load + s.loadDelta[link] : load;
+}
+
+ScenarioResult WhatIfSimulator::run(const Scenario& scenario, bool withFlows) const {
+  thread_local Scratch s;
+  s.prepare(m_view->switchCount(), m_view->linkCount(), m_flows.size());
+  s.nextRun();
+  s.downNodes.clear();
+  s.downEdges.clear();
+  s.affected.clear();
+  s.paths.clear();
+  s.touched.clear();
+  s.overloaded.clear();
+
+  ScenarioResult result;
+  result.scenario = scenario;
+  result.offered_bps = m_offered;
+
+  auto failEdge = [&](uint32_t e) {
+    if (s.edgeDown[e] == s.run) return;
+    s.edgeDown[e] = s.run;
+    s.downEdges.push_back(e);
+  };
+  for (uint64_t id : scenario.failed_links) {
+    uint32_t e = m_view->edgeOf(id);
+    if (e != TopologyView::NO_EDGE) failEdge(e);
+  }
+  for (const string& dpid : scenario.failed_switches) {
+    uint32_t node = m_view->nodeOf(dpid);
+    if (node == TopologyView::NO_NODE || s.nodeDown[node] == s.run) continue;
+    s.nodeDown[node] = s.run;
+    s.downNodes.push_back(node);
+    for (const Arc* arc = m_view->arcsBegin(node); arc != m_view->arcsEnd(node); arc++) {
+      failEdge(arc->edge);
+    }
+  }
+
+  auto affect = [&](uint32_t f) {
+    if (s.flowAffected[f] == s.run) return;
+    s.flowAffected[f] = s.run;
+    s.affected.push_back(f);
+  };
+  for (uint32_t e : s.downEdges) {
+    for (uint32_t link = directedLink(e, 0); link <= directedLink(e, 1); link++) {
+      for (uint32_t i = m_linkFlowOffset[link]; i < m_linkFlowOffset[link + 1]; i++) {
+        affect(m_linkFlows[i]);
+      }
+    }
+  }
+  for (uint32_t node : s.downNodes) {
+    for (uint32_t i = m_nodeFlowOffset[node]; i < m_nodeFlowOffset[node + 1]; i++) affect(m_nodeFlows[i]);
+  }
+  sort(s.affected.begin(), s.affected.end(), [&](uint32_t a, uint32_t b) {
+    return m_flows[a].dst != m_flows[b].dst ? m_flows[a].dst < m_flows[b].dst : a < b;
+  });
+  result.affected_flows = uint32_t(s.affected.size());
+
+  auto addLoad = [&](uint32_t link, int64_t delta) {
+    if (s.linkTouched[link] != s.run) {
+      s.linkTouched[link] = s.run;
+      s.loadDelta[link] = 0;
+      s.touched.push_back(link);
+    }
+    s.loadDelta[link] += delta;
+  };
+
+  // Reroute the affected flows, one distance repair per destination.
+  uint32_t unroutable = m_unroutable;
+  uint64_t unroutedDemand = m_unroutedDemand;
+  s.newBegin.resize(s.affected.size());
+  s.newLength.resize(s.affected.size());
+  s.newRouted.resize(s.affected.size());
+  for (uint32_t i = 0; i < s.affected.size();) {
+    uint32_t dst = m_flows[s.affected[i]].dst;
+    const uint16_t* base = m_view->distances(dst);
+    bool reachable = s.nodeDown[dst] != s.run;
+    if (reachable) {
+      repairDistances(dst, base, s);
+    }
+    for (; i < s.affected.size() && m_flows[s.affected[i]].dst == dst; i++) {
+      uint32_t f = s.affected[i];
+      const Flow& flow = m_flows[f];
+      s.flowSlot[f] = i;
+      if (flow.routed) {
+        for (uint32_t k = 0; k < flow.path_length; k++) {
+          addLoad(m_paths[flow.path_begin + k], -int64_t(flow.demand));
+        }
+      } else {
+        unroutable--;
+        unroutedDemand -= flow.demand;
+      }
+      s.newBegin[i] = uint32_t(s.paths.size());
+      bool routed = reachable && route(flow, base, s, s.paths, s.candidates);
+      s.newLength[i] = uint32_t(s.paths.size()) - s.newBegin[i];
+      s.newRouted[i] = routed;
+      if (routed) {
+        for (uint32_t k = s.newBegin[i]; k < s.paths.size(); k++) {
+          addLoad(s.paths[k], int64_t(flow.demand));
+        }
+      } else {
+        unroutable++;
+        unroutedDemand += flow.demand;
+      }
+    }
+  }
+  result.unroutable_flows = unroutable;
+
+  // Only link directions overloaded in the baseline or whose load changed
+  // can be overloaded now.
+  auto check = [&](uint32_t link) {
+    if (s.edgeDown[link / 2] == s.run || s.linkOverloaded[link] == s.run) return;
+    if (load(link, s) > int64_t(m_capacity[link])) {
+      s.linkOverloaded[link] = s.run;
+      s.overloaded.push_back(link);
+    }
+  };
+  for (uint32_t link : m_baseOverloaded) check(link);
+  for (uint32_t link : s.touched) check(link);
+
+  uint64_t shortfall = s.overloaded.empty() ? 0 : waterFill(s, result);
+  result.delivered_bps = m_offered - unroutedDemand - shortfall;
+
+  if (withFlows) {
+    result.flows.resize(m_flows.size());
+    for (uint32_t f = 0; f < m_flows.size(); f++) {
+      const Flow& flow = m_flows[f];
+      FlowAllocation& out = result.flows[f];
+      out.key = m_demands[f].key;
+      const uint32_t* path = &m_paths[flow.path_begin];
+      uint32_t length = flow.path_length;
+      out.routed = flow.routed;
+      if (s.flowAffected[f] == s.run) {
+        uint32_t i = s.flowSlot[f];
+        path = s.paths.data() + s.newBegin[i];
+        length = s.newLength[i];
+        out.routed = s.newRouted[i];
+      }
+      if (!out.routed) continue;
+      out.rate = s.flowInS[f] == s.run ? uint64_t(llround(s.sAlloc[s.flowSIndex[f]])) : flow.demand;
+      out.path.reserve(length);
+      for (uint32_t k = 0; k < length; k++) {
+        out.path.push_back(m_view->edgeId(path[k] / 2));
+      }
+    }
+  }
+  return result;
+}
+
+uint64_t WhatIfSimulator::waterFill(Scratch& s, ScenarioResult& result) const {
+  s.sFlow.clear();
+  s.sPath.clear();
+  s.sLength.clear();
+  auto addFlow = [&](uint32_t f, const uint32_t* path, uint32_t length) {
+    if (s.flowInS[f] == s.run) return;
+    s.flowInS[f] = s.run;
+    s.flowSIndex[f] = uint32_t(s.sFlow.size());
+    s.sFlow.push_back(f);
+    s.sPath.push_back(path);
+    s.sLength.push_back(length);
+  };
+  for (uint32_t link : s.overloaded) {
+    for (uint32_t i = m_linkFlowOffset[link]; i < m_linkFlowOffset[link + 1]; i++) {
+      uint32_t f = m_linkFlows[i];
+      if (s.flowAffected[f] != s.run) {
+        addFlow(f, &m_paths[m_flows[f].path_begin], m_flows[f].path_length);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < s.affected.size(); i++) {
+    if (!s.newRouted[i]) continue;
+    const uint32_t* path = s.paths.data() + s.newBegin[i];
+    for (uint32_t k = 0; k < s.newLength[i]; k++) {
+      if (s.linkOverloaded[path[k]] == s.run) {
+        addFlow(s.affected[i], path, s.newLength[i]);
+        break;
+      }
+    }
+  }
+
+  // Every directed link those flows use, with the capacity left once the
+  // flows outside the set (which all get their demand) are served.
+  s.lLink.clear();
+  s.lRemaining.clear();
+  s.lCount.clear();
+  for (uint32_t j = 0; j < s.sFlow.size(); j++) {
+    uint64_t demand = m_flows[s.sFlow[j]].demand;
+    for (uint32_t k = 0; k < s.sLength[j]; k++) {
+      uint32_t link = s.sPath[j][k];
+      if (s.linkLocal[link] != s.run) {
+        s.linkLocal[link] = s.run;
+        s.linkLocalIndex[link] = uint32_t(s.lLink.size());
+        s.lLink.push_back(link);
+        s.lRemaining.push_back(double(m_capacity[link]) - double(load(link, s)));
+        s.lCount.push_back(0);
+      }
+      uint32_t l = s.linkLocalIndex[link];
+      s.lRemaining[l] += double(demand);
+      s.lCount[l]++;
+    }
+  }
+  size_t links = s.lLink.size();
+  s.lOffset.assign(links + 1, 0);
+  for (uint32_t l = 0; l < links; l++) {
+    s.lOffset[l + 1] = s.lOffset[l] + s.lCount[l];
+  }
+  s.lFlows.resize(s.lOffset.back());
+  s.lLevel.assign(links, 0.0);
+  s.lSaturated.assign(links, 0);
+  s.lCursor.assign(s.lOffset.begin(), s.lOffset.end() - 1);
+  for (uint32_t j = 0; j < s.sFlow.size(); j++) {
+    for (uint32_t k = 0; k < s.sLength[j]; k++) {
+      s.lFlows[s.lCursor[s.linkLocalIndex[s.sPath[j][k]]]++] = j;
+    }
+  }
+
+  // Progressive filling: all unfrozen flows grow at the same pace. A flow
+  // freezes when it reaches its demand or when a link it crosses fills up.
+  // The level at which a link fills only rises as its flows freeze below
+  // it, so the heap holds lower bounds, refreshed when they reach the top.
+  auto fillLevel = [&](uint32_t l) { return s.lLevel[l] + max(0.0, s.lRemaining[l]) / s.lCount[l]; };
+  auto& heap = s.fillHeap;
+  auto later = greater<pair<double, uint32_t>>();
+  heap.clear();
+  for (uint32_t l = 0; l < links; l++) {
+    heap.emplace_back(fillLevel(l), l);
+  }
+  make_heap(heap.begin(), heap.end(), later);
+
+  size_t flows = s.sFlow.size();
+  s.sAlloc.assign(flows, 0.0);
+  s.sFrozen.assign(flows, 0);
+  s.sOrder.clear();
+  if (flows * 8 > m_flows.size()) {
+    for (uint32_t f : m_byDemand) {
+      if (s.flowInS[f] == s.run) s.sOrder.push_back(s.flowSIndex[f]);
+    }
+  } else {
+    s.sOrder.resize(flows);
+    iota(s.sOrder.begin(), s.sOrder.end(), 0);
+    sort(s.sOrder.begin(), s.sOrder.end(), [&](uint32_t a, uint32_t b) {
+      return m_flows[s.sFlow[a]].demand < m_flows[s.sFlow[b]].demand;
+    });
+  }
+
+  size_t unfrozen = flows;
+  auto freeze = [&](uint32_t j, double level) {
+    s.sFrozen[j] = 1;
+    s.sAlloc[j] = level;
+    unfrozen--;
+    for (uint32_t k = 0; k < s.sLength[j]; k++) {
+      uint32_t l = s.linkLocalIndex[s.sPath[j][k]];
+      s.lRemaining[l] -= s.lCount[l] * (level - s.lLevel[l]);
+      s.lLevel[l] = level;
+      s.lCount[l]--;
+    }
+  };
+
+  size_t next = 0;
+  while (unfrozen > 0) {
+    while (s.sFrozen[s.sOrder[next]]) next++;
+    uint32_t j = s.sOrder[next];
+    double demand = double(m_flows[s.sFlow[j]].demand);
+    while (!heap.empty()) {
+      uint32_t l = heap.front().second;
+      bool done = s.lCount[l] == 0;
+      double level = done ? 0 : fillLevel(l);
+      if (!done && level <= heap.front().first) break;
+      pop_heap(heap.begin(), heap.end(), later);
+      heap.pop_back();
+      if (!done) {
+        heap.emplace_back(level, l);
+        push_heap(heap.begin(), heap.end(), later);
+      }
+    }
+    if (heap.empty() || demand <= heap.front().first) {
+      freeze(j, demand);
+      continue;
+    }
+    auto [level, l] = heap.front();
+    pop_heap(heap.begin(), heap.end(), later);
+    heap.pop_back();
+    s.lSaturated[l] = 1;
+    for (uint32_t i = s.lOffset[l]; i < s.lOffset[l + 1]; i++) {
+      if (!s.sFrozen[s.lFlows[i]]) freeze(s.lFlows[i], level);
+    }
+  }
+
+  double shortfall = 0;
+  for (uint32_t j = 0; j < flows; j++) {
+    shortfall += double(m_flows[s.sFlow[j]].demand) - s.sAlloc[j];
+  }
+  for (uint32_t l = 0; l < links; l++) {
+    if (!s.lSaturated[l]) continue;
+    uint32_t link = s.lLink[l];
+    result.saturated_links.push_back(LinkLoad{ m_view->edgeId(link / 2), uint8_t(link % 2),
+                                               uint64_t(max<int64_t>(0, load(link, s))),
+                                               m_capacity[link] });
+  }
+  sort(result.saturated_links.begin(), result.saturated_links.end(),
+       [](const LinkLoad& a, const LinkLoad& b) {
+         return a.edge_id != b.edge_id ? a.edge_id < b.edge_id : a.from_end < b.from_end;
+       });
+  return uint64_t(llround(max(0.0, shortfall)));
+}
+
+vector<ScenarioResult> WhatIfSimulator::runAll(const vector<Scenario>& scenarios,
+                                               WorkStealingPool& pool) const {
+  vector<ScenarioResult> results(scenarios.size());
+  pool.parallelFor(scenarios.size(), [&](size_t i) { results[i] = run(scenarios[i]); });
+  return results;
+}
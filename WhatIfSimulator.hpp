@@ -0,0 +1,163 @@
+#ifndef WHAT_IF_SIMULATOR_HPP
+#define WHAT_IF_SIMULATOR_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RateSnapshot.hpp"
+#include "TopologyView.hpp"
+#include "WorkStealingPool.hpp"
+
+struct FlowDemand {
+  sflow::FlowKey key;
+  std::string src_dpid;  // switch the flow enters the fabric at
+  std::string dst_dpid;  // switch it leaves the fabric at
+  uint64_t rate = 0;     // bits/s the flow sends when unconstrained
+};
+
+struct Scenario {
+  std::vector<uint64_t> failed_links;  // TopologyManager::EdgeProperties::edge_id
+  std::vector<std::string> failed_switches;
+};
+
+// One direction of a link: the traffic leaving `from_end` for the other end
+// (0 is the link's src switch, see TopologyView::edgeNode).
+struct LinkLoad {
+  uint64_t edge_id = 0;
+  uint8_t from_end = 0;
+  uint64_t load_bps = 0;
+  uint64_t capacity_bps = 0;
+};
+
+struct FlowAllocation {
+  sflow::FlowKey key;
+  uint64_t rate = 0;            // max-min fair share, bits/s
+  bool routed = false;          // false: no path left between its switches
+  std::vector<uint64_t> path;   // edge ids, ingress switch first
+};
+
+struct ScenarioResult {
+  Scenario scenario;
+  // flows whose path crossed a failure (or that start or end at a failed switch)
+  uint32_t affected_flows = 0;
+  uint32_t unroutable_flows = 0;
+  uint64_t offered_bps = 0;    // sum of demands
+  uint64_t delivered_bps = 0;  // sum of allocated rates
+  // link directions the allocation fills to capacity, i.e. the
+  // bottlenecks, with the load they would carry at full demand
+  std::vector<LinkLoad> saturated_links;
+  // every flow, in demand order; only filled on request
+  std::vector<FlowAllocation> flows;
+};
+
+struct SimulationConfig {
+  // used for link directions neither end of which reported an ifSpeed
+  uint64_t default_link_capacity_bps = 10000000000ULL;
+};
+
+// What-if engine on one topology version (TopologyView): fails links
+// and/or switches, reroutes the flows that crossed them over ECMP shortest
+// paths (hop count, next hop among equal-cost ones picked by a hash of the
+// flow key, like switch ECMP does) and computes a max-min fair allocation
+// of link capacity with each flow capped at its demand. Links are full
+// duplex: each direction has a capacity and a load of its own.
+//
+// Flows not touching a failure keep their baseline path. The allocation is
+// exact but only water-fills the flows that cross a link that would be
+// overloaded at full demand; everything else provably gets its demand.
+// run() is const and may be called from many threads; runAll() spreads a
+// batch of scenarios (e.g. singleLinkFailures()) over a WorkStealingPool.
+class WhatIfSimulator {
+public:
+  // Routes the baseline; `pool` (optional) parallelizes that.
+  WhatIfSimulator(std::shared_ptr<const TopologyView> topology,
+                  std::vector<FlowDemand> demands,
+                  const SimulationConfig& config = SimulationConfig(),
+                  WorkStealingPool* pool = nullptr);
+
+  // One demand per flow of `rates` whose source and destination IPs are
+  // known hosts with an attached switch; the flow enters and leaves the
+  // fabric there.
+  static std::vector<FlowDemand> demandsFromRates(const TopologyView& view,
+                                                  const sflow::RateSnapshot& rates);
+
+  static std::vector<Scenario> singleLinkFailures(const TopologyView& view);
+  static std::vector<Scenario> singleSwitchFailures(const TopologyView& view);
+
+  const ScenarioResult& baseline() const { return m_baseline; }
+
+  ScenarioResult run(const Scenario& scenario, bool withFlows = false) const;
+
+  std::vector<ScenarioResult> runAll(const std::vector<Scenario>& scenarios,
+                                     WorkStealingPool& pool) const;
+
+  // Demands left out because a switch of theirs is not in the topology.
+  size_t unplacedDemands() const { return m_unplaced; }
+
+  uint64_t topologyVersion() const { return m_view->version(); }
+
+private:
+  static constexpr uint32_t UNREACHABLE = UINT32_MAX;
+
+  // Paths, loads and capacities are per link direction: 2 * edge + the end
+  // the traffic leaves from. Failures are per link, both directions at once.
+  static uint32_t directedLink(uint32_t edge, uint32_t fromEnd) { return edge * 2 + fromEnd; }
+
+  using Arc = TopologyView::Arc;
+
+  struct Flow {
+    uint32_t src;
+    uint32_t dst;
+    uint64_t demand;
+    uint64_t hash;
+    uint32_t path_begin;  // into m_paths, directed links
+    uint32_t path_length;
+    bool routed;
+  };
+
+  struct Scratch;
+
+  // Hop count from `node` to the destination `base` belongs to, with the
+  // failures and repaired distances of `s` applied.
+  uint32_t distance(uint32_t node, const uint16_t* base, const Scratch& s) const;
+  // Recomputes, into `s`, the distances to `dst` the failures of `s`
+  // changed; usually none do, since another equal-cost next hop is left.
+  void repairDistances(uint32_t dst, const uint16_t* base, Scratch& s) const;
+  // Appends the directed links of the ECMP shortest path left by the
+  // failures of `s` to `path`; false if none is left.
+  bool route(const Flow& flow, const uint16_t* base, const Scratch& s,
+             std::vector<uint32_t>& path, std::vector<Arc>& candidates) const;
+  void routeBaseline(WorkStealingPool* pool);
+  int64_t load(uint32_t link, const Scratch& s) const;
+  // Max-min allocation over the flows crossing an overloaded link
+  // direction; returns the bits/s those flows lose against their demand.
+  uint64_t waterFill(Scratch& s, ScenarioResult& result) const;
+
+  std::shared_ptr<const TopologyView> m_view;
+  SimulationConfig m_config;
+  std::vector<uint64_t> m_capacity;  // per directed link, bits/s
+
+  // placed demands; m_flows[i] is m_demands[i]
+  std::vector<FlowDemand> m_demands;
+  std::vector<Flow> m_flows;
+  std::vector<uint32_t> m_paths;
+  // baseline: flows per directed link and per end switch, CSR
+  std::vector<uint32_t> m_linkFlowOffset;
+  std::vector<uint32_t> m_linkFlows;
+  std::vector<uint32_t> m_nodeFlowOffset;
+  std::vector<uint32_t> m_nodeFlows;
+  std::vector<uint64_t> m_baseLoad;  // per directed link
+  std::vector<uint32_t> m_byDemand;  // flows, smallest demand first
+  std::vector<uint32_t> m_baseOverloaded;
+  uint64_t m_offered = 0;
+  uint32_t m_unroutable = 0;
+  uint64_t m_unroutedDemand = 0;
+  size_t m_unplaced = 0;
+
+  ScenarioResult m_baseline;
+};
+
+#endif // WHAT_IF_SIMULATOR_HPP
@@ -0,0 +1,120 @@
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+  if (threads == 0) {
+    threads = max(1u, thread::hardware_concurrency());
+  }
+  for (unsigned i = 0; i < threads; i++) {
+    m_workers.push_back(make_unique<Worker>());
+  }
+  for (unsigned i = 0; i < threads; i++) {
+    m_threads.emplace_back(&WorkStealingPool::workerLoop, this, size_t(i));
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_wakeup.notify_all();
+  for (auto& t : m_threads) {
+    t.join();
+  }
+}
+
+bool WorkStealingPool::pop(size_t self, Task& task) {
+  Worker& worker = *m_workers[self];
+  lock_guard<mutex> lock(worker.mutex);
+  if (worker.tasks.empty()) return false;
+  task = worker.tasks.back();
+  worker.tasks.pop_back();
+  m_queued.fetch_sub(1, memory_order_relaxed);
+  return true;
+}
+
+bool WorkStealingPool::steal(size_t self, Task& task) {
+  for (size_t i = 1; i <= m_workers.size(); i++) {
+    Worker& victim = *m_workers[(self + i) % m_workers.size()];
+    lock_guard<mutex> lock(victim.mutex);
+    if (victim.tasks.empty()) continue;
+    task = victim.tasks.front();
+    victim.tasks.pop_front();
+    m_queued.fetch_sub(1, memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::execute(const Task& task) {
+  Job& job = *task.job;
+  try {
+    for (size_t i = task.begin; i < task.end; i++) {
+      (*job.fn)(i);
+    }
+  } catch (...) {
+    lock_guard<mutex> lock(job.mutex);
+    if (!job.error) job.error = current_exception();
+  }
+  // The job lives on the stack of parallelFor(), which may return as soon
+  // as it sees the count reach zero under the mutex; do not touch the job
+  // after releasing it.
+  lock_guard<mutex> lock(job.mutex);
+  if (job.remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+    job.done.notify_all();
+  }
+}
+
+void WorkStealingPool::workerLoop(size_t index) {
+  Task task;
+  while (true) {
+    if (pop(index, task) || steal(index, task)) {
+      execute(task);
+      continue;
+    }
+    unique_lock<mutex> lock(m_mutex);
+    m_wakeup.wait(lock, [&] { return m_stopping || m_queued.load(memory_order_relaxed) > 0; });
+    if (m_stopping) return;
+  }
+}
+
+void WorkStealingPool::parallelFor(size_t n, const function<void(size_t)>& fn, size_t grain) {
+  if (n == 0) return;
+  grain = max<size_t>(1, grain);
+  Job job;
+  job.fn = &fn;
+  size_t tasks = (n + grain - 1) / grain;
+  job.remaining.store(tasks, memory_order_relaxed);
+
+  // Contiguous runs per worker keep neighbouring indexes on one core until
+  // someone runs dry and starts stealing.
+  size_t perWorker = (tasks + m_workers.size() - 1) / m_workers.size();
+  for (size_t w = 0, t = 0; w < m_workers.size() && t < tasks; w++) {
+    Worker& worker = *m_workers[w];
+    lock_guard<mutex> lock(worker.mutex);
+    for (size_t k = 0; k < perWorker && t < tasks; k++, t++) {
+      worker.tasks.push_back(Task{ &job, t * grain, min(n, (t + 1) * grain) });
+      m_queued.fetch_add(1, memory_order_relaxed);
+    }
+  }
+  {
+    lock_guard<mutex> lock(m_mutex);
+  }
+  m_wakeup.notify_all();
+
+  // Help until everything queued for this job has been taken.
+  Task task;
+  size_t start = 0;
+  while (job.remaining.load(memory_order_acquire) > 0 && steal(start++ % m_workers.size(), task)) {
+    execute(task);
+  }
+  unique_lock<mutex> lock(job.mutex);
+  job.done.wait(lock, [&] { return job.remaining.load(memory_order_acquire) == 0; });
+  if (job.error) {
+    rethrow_exception(job.error);
+  }
+}
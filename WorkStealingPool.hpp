@@ -0,0 +1,68 @@
+#ifndef WORK_STEALING_POOL_HPP
+#define WORK_STEALING_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker takes
+// work from the back of its own deque and, when that is empty, steals from
+// the front of another's, so uneven tasks (e.g. what-if scenarios that
+// reroute very different numbers of flows) still keep every core busy.
+class WorkStealingPool {
+public:
+  // 0 threads: one per hardware thread.
+  explicit WorkStealingPool(unsigned threads = 0);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  // Runs fn(i) for every i in [0, n), in tasks of `grain` indexes, and
+  // returns when all are done. The calling thread helps. If any call
+  // throws, the first exception is rethrown here once the rest finished.
+  void parallelFor(size_t n, const std::function<void(size_t)>& fn, size_t grain = 1);
+
+  unsigned threadCount() const { return unsigned(m_workers.size()); }
+
+private:
+  struct Job {
+    const std::function<void(size_t)>* fn;
+    std::atomic<size_t> remaining{0};
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+  };
+
+  struct Task {
+    Job* job;
+    size_t begin;
+    size_t end;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool pop(size_t self, Task& task);
+  bool steal(size_t self, Task& task);
+  void execute(const Task& task);
+  void workerLoop(size_t index);
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  std::atomic<size_t> m_queued{0};
+  bool m_stopping = false;
+};
+
+#endif // WORK_STEALING_POOL_HPP
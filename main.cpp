@@ -1,16 +1,193 @@
+#include "FlowPathCorrelator.hpp"
+#include "Logger.hpp"
+#include "PeriodicScheduler.hpp"
+#include "QueryServer.hpp"
 #include "SFlowCollector.hpp"
-// #include "TopologyManager.hpp"
+#include "TopologyManager.hpp"
+
+#include <pthread.h>
+#include <signal.h>
 #include <array>
-int main() {
-  sflow::SFlowCollector collector;
-  collector.start();
-
-  // std::array<std::string,3> ryuUrl;
-  // ryuUrl[0] = "http://localhost:8080/v1.0/topology/switches";
-  // ryuUrl[1] = "http://localhost:8080/v1.0/topology/hosts"; 
-  // ryuUrl[2] = "http://localhost:8080/v1.0/topology/links";
-  
-  // TopologyManager topologyManager(ryuUrl);
-  // topologyManager.start();
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace sflow;
+
+namespace {
+
+struct Options {
+  CollectorConfig collector;
+  TopologyConfig topology;
+  QueryServerConfig query;
+  LoggerConfig logger;
+  // Ryu REST base URL, e.g. http://localhost:8080; empty runs the
+  // collector without topology
+  string ryu;
+  // interface bindings file, see loadInterfaceBindings(); re-read on SIGHUP
+  string bindings;
+  // CPUs of the scheduler thread running roll-up and correlation
+  vector<int> scheduler_cpus;
+};
+
+bool parseArg(const char* arg, const char* name, string& value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+  value = arg + len + 1;
+  return true;
+}
+
+LogFormat parseLogFormat(const string& name) {
+  if (name == "text") return LogFormat::TEXT;
+  if (name == "json") return LogFormat::JSON;
+  if (name == "binary") return LogFormat::BINARY;
+  throw invalid_argument("Invalid log format: " + name);
+}
+
+LogLevel parseLogLevel(const string& name) {
+  if (name == "debug") return LogLevel::DEBUG;
+  if (name == "info") return LogLevel::INFO;
+  if (name == "warn") return LogLevel::WARN;
+  if (name == "error") return LogLevel::ERROR;
+  throw invalid_argument("Invalid log level: " + name);
+}
+
+Options parseArgs(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    string v;
+    if (parseArg(argv[i], "--ryu", v)) options.ryu = v;
+    else if (parseArg(argv[i], "--event-feed", v)) options.topology.event_feed = v;
+    else if (parseArg(argv[i], "--bindings", v)) options.bindings = v;
+    else if (parseArg(argv[i], "--listen", v)) options.query.listen = v;
+    else if (parseArg(argv[i], "--rcv-workers", v)) options.collector.rcv_workers = stoi(v);
+    else if (parseArg(argv[i], "--rcv-cpus", v)) options.collector.rcv_cpus = parseCpuList(v);
+    else if (parseArg(argv[i], "--scheduler-cpus", v)) options.scheduler_cpus = parseCpuList(v);
+    else if (parseArg(argv[i], "--topology-cpus", v)) options.topology.cpus = parseCpuList(v);
+    else if (parseArg(argv[i], "--log-file", v)) options.logger.path = v;
+    else if (parseArg(argv[i], "--log-format", v)) options.logger.format = parseLogFormat(v);
+    else if (parseArg(argv[i], "--log-level", v)) options.logger.level = parseLogLevel(v);
+    else if (parseArg(argv[i], "--aggregation", v)) {
+      options.collector.aggregation = v == "sketch" ? FlowAggregation::SKETCH : FlowAggregation::EXACT;
+    }
+    else {
+      fprintf(stderr, "unknown argument: %s\n", argv[i]);
+      fprintf(stderr, "usage: %s [--ryu=http://host:8080] [--event-feed=host:6654] "
+                      "[--bindings=file] [--listen=host:port|unix:path|''] [--rcv-workers=n] "
+                      "[--rcv-cpus=list] [--scheduler-cpus=list] [--topology-cpus=list] "
+                      "[--aggregation=exact|sketch] [--log-file=path] "
+                      "[--log-format=text|json|binary] [--log-level=debug|info|warn|error]\n",
+              argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  try {
+    options = parseArgs(argc, argv);
+  }
+  catch (const exception& ex) {
+    fprintf(stderr, "invalid argument: %s\n", ex.what());
+    return EXIT_FAILURE;
+  }
+  Logger::instance().configure(options.logger);
+
+  // Signals are taken by sigwait() below. Blocking them before any thread
+  // starts makes every thread inherit the mask, so none is interrupted.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  try {
+    // Declared first so that it outlives everything its tasks touch.
+    PeriodicScheduler scheduler;
+    SFlowCollector collector(options.collector);
+    unique_ptr<TopologyManager> topology;
+    if (!options.ryu.empty()) {
+      array<string, 3> ryuUrl = {
+        options.ryu + "/v1.0/topology/switches",
+        options.ryu + "/v1.0/topology/hosts",
+        options.ryu + "/v1.0/topology/links",
+      };
+      topology = make_unique<TopologyManager>(ryuUrl, options.topology);
+      if (!options.bindings.empty()) {
+        topology->setInterfaceBindings(loadInterfaceBindings(options.bindings));
+      }
+      collector.setLinkUtilization(&topology->linkUtilization());
+    }
+    FlowPathCorrelator correlator([&collector](uint32_t agentId) {
+      return collector.agentAddress(agentId);
+    });
+    unique_ptr<QueryServer> query;
+    if (!options.query.listen.empty()) {
+      query = make_unique<QueryServer>(options.query, &collector, topology.get());
+      if (topology) query->setCorrelator(&correlator);
+    }
+
+    auto shutdown = [&] {
+      if (query) query->stop();
+      collector.stop();
+      scheduler.stop();
+      if (topology) topology->stop();
+    };
+    try {
+      if (topology) {
+        // Part of the roll-up task, so every roll-up is correlated right
+        // after it is published.
+        collector.setRollUpListener([&](const RateSnapshot& rates) {
+          auto interfaces = topology->linkUtilization().current();
+          if (interfaces) correlator.update(rates, *interfaces);
+        });
+      }
+      scheduler.start(options.scheduler_cpus);
+      if (topology) topology->start();
+      collector.start(scheduler);
+      if (query) query->start();
+    }
+    catch (...) {
+      shutdown();
+      throw;
+    }
+
+    while (true) {
+      int sig = 0;
+      sigwait(&signals, &sig);
+      if (sig != SIGHUP) break;
+      if (topology && !options.bindings.empty()) {
+        try {
+          topology->setInterfaceBindings(loadInterfaceBindings(options.bindings));
+          LOG_INFO("runtime", "Reloaded interface bindings from %s", options.bindings.c_str());
+        }
+        catch (const exception& ex) {
+          LOG_WARN("runtime", "Keeping the current interface bindings: %s", ex.what());
+        }
+      }
+    }
+    LOG_INFO("runtime", "Shutting down");
+    for (const PeriodicTaskStats& task : scheduler.stats()) {
+      LOG_INFO("runtime", "%s: %llu runs, %llu missed, max lag %lld us, max run %lld us",
+               task.name.c_str(), (unsigned long long)task.runs, (unsigned long long)task.missed,
+               (long long)task.max_lag_us, (long long)task.max_run_us);
+    }
+    shutdown();
+  }
+  catch (const exception& ex) {
+    fprintf(stderr, "%s\n", ex.what());
+    return EXIT_FAILURE;
+  }
   return 0;
 }
@@ -0,0 +1,71 @@
+# Ryu app that relays topology events to TopologyManager as JSON lines:
+#
+#   {"event": "EventLinkDelete", "data": {"src": {...}, "dst": {...}}}
+#
+# `data` is the event object's to_dict(), the same shape the REST topology
+# API returns. Run it next to the topology app, e.g.
+#
+#   ryu-manager --observe-links ryu.app.rest_topology ryu_topology_relay.py
+#
+# and point TopologyConfig::event_feed at <controller>:6654.
+import json
+
+from ryu.base import app_manager
+from ryu.controller.handler import set_ev_cls
+from ryu.lib import hub
+from ryu.topology import event
+
+RELAY_PORT = 6654
+
+
+class TopologyRelay(app_manager.RyuApp):
+    def __init__(self, *args, **kwargs):
+        super(TopologyRelay, self).__init__(*args, **kwargs)
+        self.clients = set()
+        hub.spawn(self._serve)
+
+    def _serve(self):
+        hub.StreamServer(('0.0.0.0', RELAY_PORT), self._client).serve_forever()
+
+    def _client(self, sock, addr):
+        self.logger.info('topology relay: %s connected', addr)
+        self.clients.add(sock)
+        try:
+            # Nothing is expected from the client; wait for it to go away.
+            while sock.recv(1024):
+                pass
+        finally:
+            self.clients.discard(sock)
+            sock.close()
+
+    def _publish(self, name, obj):
+        line = (json.dumps({'event': name, 'data': obj.to_dict()}) + '\n').encode()
+        for sock in list(self.clients):
+            try:
+                sock.sendall(line)
+            except Exception:
+                self.clients.discard(sock)
+
+    @set_ev_cls(event.EventSwitchEnter)
+    def switch_enter(self, ev):
+        self._publish('EventSwitchEnter', ev.switch)
+
+    @set_ev_cls(event.EventSwitchLeave)
+    def switch_leave(self, ev):
+        self._publish('EventSwitchLeave', ev.switch)
+
+    @set_ev_cls(event.EventLinkAdd)
+    def link_add(self, ev):
+        self._publish('EventLinkAdd', ev.link)
+
+    @set_ev_cls(event.EventLinkDelete)
+    def link_delete(self, ev):
+        self._publish('EventLinkDelete', ev.link)
+
+    @set_ev_cls(event.EventHostAdd)
+    def host_add(self, ev):
+        self._publish('EventHostAdd', ev.host)
+
+    @set_ev_cls(event.EventHostDelete)
+    def host_delete(self, ev):
+        self._publish('EventHostDelete', ev.host)
@@ -0,0 +1,139 @@
+// FlowPathCorrelator fed by a TopologyManager's interface maps: flows are
+// charged to the links their sampling interfaces are bound to, rates move,
+// idle flows leave, and reloading the bindings on an unchanged topology
+// moves the flows to their new links.
+//
+//   g++ -std=c++20 -O1 -I/root/miniconda/include test_flow_path_correlator.cpp FlowPathCorrelator.cpp TopologyManager.cpp HttpClient.cpp TopologyView.cpp WorkStealingPool.cpp LinkUtilization.cpp RateEstimator.cpp PeriodicScheduler.cpp Logger.cpp FlowTable.cpp FlowSketch.cpp SFlowDecoder.cpp -pthread -o test_flow_path_correlator
+//   ./test_flow_path_correlator
+
+#include "FlowPathCorrelator.hpp"
+#include "Logger.hpp"
+#include "TestSupport.hpp"
+#include "TopologyManager.hpp"
+
+#include <string>
+
+using namespace std;
+using namespace sflow;
+
+namespace {
+
+const string S1 = "0000000000000001";
+const string S2 = "0000000000000002";
+
+// Two switches joined by two parallel links, S1:1 -> S2:2 and S1:3 -> S2:4.
+void serveTopology(StubServer& server) {
+  server.serve([](StubConnection& conn) {
+    string target;
+    while (conn.readRequest(target)) {
+      string body = "[]";
+      if (target == "/switches") {
+        body = "[{\"dpid\":\"" + S1 + "\",\"ports\":[]},{\"dpid\":\"" + S2 + "\",\"ports\":[]}]";
+      } else if (target == "/links") {
+        body = "[{\"src\":{\"dpid\":\"" + S1 + "\",\"port_no\":\"00000001\"},"
+               "\"dst\":{\"dpid\":\"" + S2 + "\",\"port_no\":\"00000002\"}},"
+               "{\"src\":{\"dpid\":\"" + S1 + "\",\"port_no\":\"00000003\"},"
+               "\"dst\":{\"dpid\":\"" + S2 + "\",\"port_no\":\"00000004\"}}]";
+      }
+      conn.send(httpResponse(body));
+    }
+  });
+}
+
+IpAddress agentAddress() {
+  IpAddress agent;
+  IpAddress::parse("192.0.2.1", agent);
+  return agent;
+}
+
+// edge_id of the link leaving S1 at `port`; 0 if there is none.
+uint64_t edgeAt(const TopologyManager::Snapshot& snapshot, uint32_t port) {
+  for (const auto& [id, edge] : snapshot.edges) {
+    const auto& link = snapshot.graph[edge].link;
+    if (link.src_dpid == S1 && link.src_port == port) return id;
+  }
+  return 0;
+}
+
+FlowRate flowRate(uint16_t srcPort, uint64_t rate, uint32_t ifIndex) {
+  FlowRate flow;
+  flow.key.src_port = srcPort;
+  flow.key.protocol = 6;
+  flow.rate = rate;
+  flow.hop_count = 1;
+  flow.hops[0].id = makeHopId(1, ifIndex);
+  flow.hops[0].rate = rate;
+  return flow;
+}
+
+vector<uint64_t> edgesOf(const FlowPathCorrelator& correlator, const FlowKey& key) {
+  vector<uint64_t> edges;
+  correlator.edgesOfFlow(key, edges);
+  return edges;
+}
+
+}  // namespace
+
+int main() {
+  Logger::instance().setLevel(LogLevel::ERROR);
+  StubServer rest;
+  serveTopology(rest);
+  TopologyConfig config;
+  config.poll_interval_ms = 100;
+  TopologyManager topology({ rest.url("/switches"), rest.url("/hosts"), rest.url("/links") }, config);
+  topology.start();
+  CHECK(waitFor([&] { return topology.getSnapshot()->edges.size() == 2; }));
+  auto snapshot = topology.getSnapshot();
+  uint64_t first = edgeAt(*snapshot, 1);
+  uint64_t second = edgeAt(*snapshot, 3);
+  CHECK(first != 0 && second != 0 && first != second);
+
+  // ifIndex 10 measures S1 port 1, ifIndex 11 is not bound.
+  IpAddress agent = agentAddress();
+  topology.setInterfaceBindings({ InterfaceBinding{ agent, 10, S1, 1 } });
+  auto interfaces = topology.linkUtilization().current();
+  CHECK(interfaces && interfaces->topology_version == snapshot->version);
+
+  FlowPathCorrelator correlator([&](uint32_t) { return agent; });
+  RateSnapshot rates;
+  rates.version = 1;
+  rates.flows = { flowRate(1, 1000, 10), flowRate(2, 500, 10), flowRate(3, 700, 11) };
+  correlator.update(rates, *interfaces);
+  CHECK(correlator.edgeLoad(first).rate == 1500);
+  CHECK(correlator.edgeLoad(first).flows == 2);
+  CHECK(correlator.edgeLoad(second).flows == 0);
+  CHECK(edgesOf(correlator, rates.flows[0].key) == vector<uint64_t>{ first });
+  CHECK(edgesOf(correlator, rates.flows[2].key).empty());  // active, on no known link
+  vector<FlowOnEdge> flows;
+  CHECK(correlator.flowsOnEdge(first, flows, 1));
+  CHECK(flows.size() == 1 && flows[0].rate == 1000);
+
+  // Rates move; a flow missing from the next roll-up leaves its link.
+  rates.version = 2;
+  rates.flows = { flowRate(1, 4000, 10), flowRate(3, 700, 11) };
+  correlator.update(rates, *interfaces);
+  CHECK(correlator.edgeLoad(first).rate == 4000);
+  CHECK(correlator.edgeLoad(first).flows == 1);
+  vector<uint64_t> gone;
+  CHECK(!correlator.edgesOfFlow(flowRate(2, 0, 10).key, gone));
+
+  // The same flows, topology and roll-up, but ifIndex 10 rebound to port 3.
+  topology.setInterfaceBindings({ InterfaceBinding{ agent, 10, S1, 3 } });
+  auto rebound = topology.linkUtilization().current();
+  CHECK(rebound->topology_version == interfaces->topology_version);
+  CHECK(rebound->bindings_version != interfaces->bindings_version);
+  correlator.update(rates, *rebound);
+  CHECK(correlator.edgeLoad(first).flows == 0);
+  CHECK(correlator.edgeLoad(first).rate == 0);
+  CHECK(correlator.edgeLoad(second).rate == 4000);
+  CHECK(edgesOf(correlator, rates.flows[0].key) == vector<uint64_t>{ second });
+  CHECK(!correlator.flowsOnEdge(first, flows));
+
+  // Applying the same map and roll-up again changes nothing.
+  correlator.update(rates, *rebound);
+  CHECK(correlator.edgeLoad(second).rate == 4000);
+  CHECK(correlator.edgeLoad(second).flows == 1);
+
+  topology.stop();
+  return testResult("test_flow_path_correlator");
+}
@@ -0,0 +1,188 @@
+// HttpClient against a loopback stub server: body framings, pipelining and
+// reconnecting after the server dropped a connection.
+//
+//   g++ -std=c++20 -O1 test_http_client.cpp HttpClient.cpp -pthread -o test_http_client
+//   ./test_http_client
+
+#include "HttpClient.hpp"
+#include "TestSupport.hpp"
+
+#include <string>
+
+using namespace std;
+
+namespace {
+
+void testContentLength() {
+  StubServer server;
+  server.serve([](StubConnection& conn) {
+    string target;
+    while (conn.readRequest(target)) {
+      conn.send(httpResponse(target == "/empty" ? "" : "[1,2,3]"));
+    }
+  });
+  HttpClient client(server.url("/switches"));
+  string body;
+  CHECK(client.get(body) == 200);
+  CHECK(body == "[1,2,3]");
+  CHECK(client.get(body) == 200);
+  CHECK(body == "[1,2,3]");
+  CHECK(server.accepted() == 1);  // kept alive
+
+  HttpClient empty(server.url("/empty"));
+  CHECK(empty.get(body) == 200);
+  CHECK(body.empty());
+}
+
+void testChunked() {
+  StubServer server;
+  server.serve([](StubConnection& conn) {
+    string target;
+    while (conn.readRequest(target)) {
+      conn.send("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                "5\r\nhello\r\n"
+                "6;ext=1\r\n world\r\n"
+                "0\r\nX-Trailer: 1\r\n\r\n");
+    }
+  });
+  HttpClient client(server.url("/"));
+  string body;
+  CHECK(client.get(body) == 200);
+  CHECK(body == "hello world");
+  // The trailer must have been consumed: the next response parses cleanly
+  // on the same connection.
+  CHECK(client.get(body) == 200);
+  CHECK(body == "hello world");
+  CHECK(server.accepted() == 1);
+}
+
+void testCloseDelimited() {
+  StubServer server;
+  server.serve([](StubConnection& conn) {
+    string target;
+    if (conn.readRequest(target)) {
+      conn.send("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+      conn.send(string(100000, 'x'));
+    }
+    conn.close();
+  });
+  HttpClient client(server.url("/"));
+  string body;
+  CHECK(client.get(body) == 200);
+  CHECK(body == string(100000, 'x'));
+  CHECK(client.get(body) == 200);
+  CHECK(body.size() == 100000);
+  CHECK(server.accepted() == 2);
+}
+
+void testPipelined() {
+  StubServer server;
+  server.serve([](StubConnection& conn) {
+    string target;
+    for (int n = 1; conn.readRequest(target); n++) {
+      // A large first body makes the next response start inside the
+      // client's buffer.
+      conn.send(httpResponse(n == 1 ? string(40000, 'a') : to_string(n)));
+    }
+  });
+  HttpClient client(server.url("/"));
+  client.sendGet();
+  client.sendGet();
+  client.sendGet();
+  string body;
+  CHECK(client.readResponse(body) == 200);
+  CHECK(body == string(40000, 'a'));
+  CHECK(client.readResponse(body) == 200);
+  CHECK(body == "2");
+  CHECK(client.readResponse(body) == 200);
+  CHECK(body == "3");
+  CHECK(server.accepted() == 1);
+
+  bool threw = false;
+  try {
+    client.readResponse(body);
+  } catch (const runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);  // no request left in flight
+}
+
+// The server answers one request per connection, then drops it without
+// announcing it, like a keep-alive timeout.
+void testIdleClose() {
+  StubServer server;
+  server.serve([](StubConnection& conn) {
+    string target;
+    if (conn.readRequest(target)) {
+      conn.send(httpResponse("ok"));
+    }
+    conn.close();
+  });
+  HttpClient client(server.url("/"));
+  string body;
+  CHECK(client.get(body) == 200);
+  this_thread::sleep_for(chrono::milliseconds(50));
+  CHECK(client.get(body) == 200);
+  CHECK(body == "ok");
+  CHECK(server.accepted() == 2);
+
+  // Both pipelined requests must be sent again, not just the first.
+  this_thread::sleep_for(chrono::milliseconds(50));
+  client.sendGet();
+  client.sendGet();
+  CHECK(client.readResponse(body) == 200);
+  CHECK(body == "ok");
+  CHECK(client.readResponse(body) == 200);
+  CHECK(body == "ok");
+  CHECK(server.accepted() == 4);
+}
+
+// A fresh connection closed before any response is an error, not a retry.
+void testClosedBeforeResponse() {
+  StubServer server;
+  server.serve([](StubConnection& conn) {
+    string target;
+    conn.readRequest(target);
+    conn.close();
+  });
+  HttpClient client(server.url("/"), 500);
+  string body;
+  bool threw = false;
+  try {
+    client.get(body);
+  } catch (const runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(server.accepted() == 1);
+}
+
+void testConnectRefused() {
+  string url;
+  {
+    StubServer server;
+    url = server.url("/");
+  }
+  HttpClient client(url, 500);
+  string body;
+  bool threw = false;
+  try {
+    client.get(body);
+  } catch (const runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+}  // namespace
+
+int main() {
+  testContentLength();
+  testChunked();
+  testCloseDelimited();
+  testPipelined();
+  testIdleClose();
+  testClosedBeforeResponse();
+  testConnectRefused();
+  return testResult("test_http_client");
+}
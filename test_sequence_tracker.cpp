@@ -0,0 +1,152 @@
+// SequenceTracker on hand-made datagram sequences: gaps, late arrivals,
+// duplicates, restarts and sequence number wrap-around.
+//
+//   g++ -std=c++20 -O1 test_sequence_tracker.cpp IngestHealth.cpp -pthread -o test_sequence_tracker
+//   ./test_sequence_tracker
+
+#include "IngestHealth.hpp"
+#include "TestSupport.hpp"
+
+using namespace std;
+using namespace sflow;
+
+namespace {
+
+IpAddress agentAddress() {
+  IpAddress agent;
+  IpAddress::parse("192.0.2.1", agent);
+  return agent;
+}
+
+void testInOrder() {
+  SequenceTracker tracker(agentAddress(), 3);
+  for (uint32_t seq = 1; seq <= 10; seq++) {
+    tracker.observe(seq, 1000 + seq, seq);
+  }
+  SubAgentHealth health = tracker.read();
+  CHECK(health.sub_agent_id == 3);
+  CHECK(health.datagrams == 10);
+  CHECK(health.lost == 0 && health.reordered == 0 && health.duplicates == 0);
+  CHECK(health.restarts == 0);
+  CHECK(health.last_sequence == 10);
+  CHECK(health.uptime_ms == 1010);
+  CHECK(health.last_seen_ns == 10);
+}
+
+// One sub-agent's datagrams over its lifetime: a gap, a late arrival
+// filling part of it, duplicates, a restart detected by sequence number,
+// one detected by uptime, then sequence number wrap-around.
+void testSequence() {
+  SequenceTracker tracker(agentAddress(), 0);
+  uint32_t uptime = 50000;
+  tracker.observe(100, uptime, 0);
+  tracker.observe(101, uptime += 10, 0);
+
+  // 102 and 103 go missing.
+  tracker.observe(104, uptime += 10, 0);
+  SubAgentHealth health = tracker.read();
+  CHECK(health.lost == 2);
+  CHECK(health.last_sequence == 104);
+
+  // 103 turns up late: no longer lost, counted as reordered.
+  tracker.observe(103, uptime, 0);
+  health = tracker.read();
+  CHECK(health.lost == 1);
+  CHECK(health.reordered == 1);
+  CHECK(health.last_sequence == 104);  // the newest stays the newest
+
+  // 103 again, and the newest again, are duplicates; lost is untouched.
+  tracker.observe(103, uptime, 0);
+  tracker.observe(104, uptime, 0);
+  health = tracker.read();
+  CHECK(health.duplicates == 2);
+  CHECK(health.lost == 1);
+  CHECK(health.reordered == 1);
+
+  // Older than the window: the agent restarted its numbering.
+  tracker.observe(104 - SEQUENCE_WINDOW, uptime += 10, 0);
+  health = tracker.read();
+  CHECK(health.restarts == 1);
+  CHECK(health.last_sequence == 104 - SEQUENCE_WINDOW);
+  CHECK(health.lost == 1 && health.duplicates == 2);
+  // Numbering goes on from the restart without a gap.
+  tracker.observe(105 - SEQUENCE_WINDOW, uptime += 10, 0);
+  CHECK(tracker.read().lost == 1);
+
+  // An uptime that went back by at most the slack is jitter between the
+  // agent's clocks, not a restart.
+  tracker.observe(106 - SEQUENCE_WINDOW, uptime - UPTIME_RESTART_SLACK_MS, 0);
+  CHECK(tracker.read().restarts == 1);
+  // Further back it is a restart, whatever the sequence number; this one
+  // starts close to the top of the range.
+  uptime = 10;
+  tracker.observe(0xfffffffdu, uptime, 0);
+  health = tracker.read();
+  CHECK(health.restarts == 2);
+  CHECK(health.last_sequence == 0xfffffffdu);
+  CHECK(health.uptime_ms == 10);
+  uint64_t lostBefore = health.lost;
+
+  // Wrap-around is not a restart: 0xfffffffe, 0xffffffff, 1 loses only 0,
+  // which may still arrive late.
+  tracker.observe(0xfffffffeu, uptime += 10, 0);
+  tracker.observe(0xffffffffu, uptime += 10, 0);
+  tracker.observe(1, uptime += 10, 0);
+  health = tracker.read();
+  CHECK(health.restarts == 2);
+  CHECK(health.lost == lostBefore + 1);
+  CHECK(health.last_sequence == 1);
+  tracker.observe(0, uptime, 0);
+  health = tracker.read();
+  CHECK(health.lost == lostBefore);
+  CHECK(health.reordered == 2);
+  CHECK(health.restarts == 2);
+}
+
+// The uptime counter wraps after ~49.7 days; that is not a restart either.
+void testUptimeWrap() {
+  SequenceTracker tracker(agentAddress(), 0);
+  tracker.observe(1, 0xffffff00u, 0);
+  tracker.observe(2, 0x100, 0);
+  SubAgentHealth health = tracker.read();
+  CHECK(health.restarts == 0);
+  CHECK(health.lost == 0);
+  CHECK(health.uptime_ms == 0x100);
+}
+
+// Far enough ahead, the window is reset rather than shifted.
+void testLargeGap() {
+  SequenceTracker tracker(agentAddress(), 0);
+  tracker.observe(10, 1000, 0);
+  tracker.observe(10 + 2 * SEQUENCE_WINDOW, 1010, 0);
+  SubAgentHealth health = tracker.read();
+  CHECK(health.lost == 2 * SEQUENCE_WINDOW - 1);
+  // Still within the window of the new newest: late, not a duplicate.
+  tracker.observe(11 + SEQUENCE_WINDOW + 1, 1010, 0);
+  health = tracker.read();
+  CHECK(health.reordered == 1 && health.duplicates == 0);
+  CHECK(health.lost == 2 * SEQUENCE_WINDOW - 2);
+}
+
+void testRegistry() {
+  SubAgentRegistry registry;
+  IpAddress agent = agentAddress();
+  SequenceTracker& a = registry.tracker(agent, 0);
+  SequenceTracker& b = registry.tracker(agent, 1);
+  CHECK(&a != &b);
+  CHECK(&registry.tracker(agent, 0) == &a);
+  CHECK(registry.size() == 2);
+  a.observe(1, 1000, 0);
+  CHECK(registry.read().size() == 2);
+}
+
+}  // namespace
+
+int main() {
+  testInOrder();
+  testSequence();
+  testUptimeWrap();
+  testLargeGap();
+  testRegistry();
+  return testResult("test_sequence_tracker");
+}
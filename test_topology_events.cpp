@@ -0,0 +1,171 @@
+// TopologyManager's event path against a stand-in Ryu REST API and a
+// stand-in ryu_topology_relay.py feed: add, move and remove events, a
+// burst published as one snapshot, host-only changes reusing the fabric,
+// malformed lines, and the fall-back to REST polling once the feed drops.
+//
+//   g++ -std=c++20 -O1 test_topology_events.cpp TopologyManager.cpp HttpClient.cpp TopologyView.cpp WorkStealingPool.cpp LinkUtilization.cpp RateEstimator.cpp PeriodicScheduler.cpp Logger.cpp -pthread -o test_topology_events
+//   ./test_topology_events
+
+#include "Logger.hpp"
+#include "TestSupport.hpp"
+#include "TopologyManager.hpp"
+#include "TopologyView.hpp"
+
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+const string S1 = "0000000000000001";
+const string S2 = "0000000000000002";
+const string S3 = "0000000000000003";
+const string S4 = "0000000000000004";
+
+// Ryu's REST topology API with two switches and nothing else.
+class StandInRest {
+public:
+  StandInRest() {
+    m_server.serve([this](StubConnection& conn) {
+      string target;
+      while (conn.readRequest(target)) {
+        m_requests++;
+        string body = "[]";
+        if (target == "/switches") {
+          body = "[{\"dpid\":\"" + S1 + "\",\"ports\":[]},{\"dpid\":\"" + S2 + "\",\"ports\":[]}]";
+        }
+        conn.send(httpResponse(body));
+      }
+    });
+  }
+
+  array<string, 3> urls() const {
+    return { m_server.url("/switches"), m_server.url("/hosts"), m_server.url("/links") };
+  }
+  size_t requests() const { return m_requests.load(); }
+
+private:
+  StubServer m_server;
+  atomic<size_t> m_requests{0};
+};
+
+// What ryu_topology_relay.py writes: one {"event", "data"} object per line.
+string switchEvent(const string& name, const string& dpid) {
+  return "{\"event\":\"" + name + "\",\"data\":{\"dpid\":\"" + dpid + "\",\"ports\":[]}}\n";
+}
+
+string linkEvent(const string& name, const string& src, const string& dst) {
+  return "{\"event\":\"" + name + "\",\"data\":{\"src\":{\"dpid\":\"" + src +
+         "\",\"port_no\":\"00000001\"},\"dst\":{\"dpid\":\"" + dst + "\",\"port_no\":\"00000002\"}}}\n";
+}
+
+string hostEvent(const string& name, const string& ip, const string& dpid) {
+  return "{\"event\":\"" + name + "\",\"data\":{\"mac\":\"00:00:00:00:00:01\",\"ipv4\":[\"" + ip +
+         "\"],\"ipv6\":[],\"port\":{\"dpid\":\"" + dpid + "\",\"port_no\":\"00000003\"}}}\n";
+}
+
+sflow::IpAddress ipAddress(const string& text) {
+  sflow::IpAddress address;
+  sflow::IpAddress::parse(text, address);
+  return address;
+}
+
+string attachedSwitch(const TopologyManager::Snapshot& snapshot, const string& ip) {
+  auto it = snapshot.hosts.find(ip);
+  return it == snapshot.hosts.end() ? "" : snapshot.graph[it->second].attached_dpid;
+}
+
+}  // namespace
+
+int main() {
+  Logger::instance().setLevel(LogLevel::ERROR);
+  StandInRest rest;
+  StubServer feedServer;
+
+  TopologyConfig config;
+  config.event_feed = feedServer.address();
+  config.poll_interval_ms = 100;
+  config.reconcile_interval_ms = 60000;
+  config.event_reconnect_ms = 100;
+  TopologyManager manager(rest.urls(), config);
+  manager.start();
+
+  auto feed = feedServer.accept();
+  CHECK(feed != nullptr);
+  if (!feed) return testResult("test_topology_events");
+  // Connecting triggers one REST poll to catch up.
+  CHECK(waitFor([&] { return manager.getSnapshot()->switches.size() == 2; }));
+  uint64_t version = manager.getSnapshot()->version;
+  size_t restRequests = rest.requests();
+
+  // A burst of events is published as one snapshot.
+  feed->send(switchEvent("EventSwitchEnter", S3) + linkEvent("EventLinkAdd", S1, S3) +
+             hostEvent("EventHostAdd", "10.0.0.1", S1));
+  CHECK(waitFor([&] { return manager.getSnapshot()->version != version; }));
+  this_thread::sleep_for(chrono::milliseconds(100));
+  auto snapshot = manager.getSnapshot();
+  CHECK(snapshot->version == version + 1);
+  CHECK(snapshot->switches.size() == 3);
+  CHECK(snapshot->edges.size() == 1);
+  CHECK(attachedSwitch(*snapshot, "10.0.0.1") == S1);
+
+  // A host seen at another switch moves. Switches and links are unchanged,
+  // so the new version keeps the hop counts already computed and the
+  // interface map stays.
+  const uint16_t* hops = snapshot->view->distances(0);
+  auto interfaces = manager.linkUtilization().current();
+  feed->send(hostEvent("EventHostAdd", "10.0.0.1", S3));
+  CHECK(waitFor([&] { return manager.getSnapshot()->version == version + 2; }));
+  auto moved = manager.getSnapshot();
+  CHECK(attachedSwitch(*moved, "10.0.0.1") == S3);
+  CHECK(moved->view->distances(0) == hops);
+  CHECK(moved->view->hostSwitch(ipAddress("10.0.0.1")) == moved->view->nodeOf(S3));
+  CHECK(manager.linkUtilization().current() == interfaces);
+
+  feed->send(linkEvent("EventLinkDelete", S1, S3) + hostEvent("EventHostDelete", "10.0.0.1", S3) +
+             switchEvent("EventSwitchLeave", S3));
+  CHECK(waitFor([&] { return manager.getSnapshot()->version == version + 3; }));
+  snapshot = manager.getSnapshot();
+  CHECK(snapshot->edges.empty());
+  CHECK(snapshot->hosts.empty());
+  CHECK(snapshot->switches.size() == 2 && snapshot->switches.count(S3) == 0);
+  CHECK(snapshot->view->linkCount() == 0);
+  CHECK(manager.linkUtilization().current()->topology_version == snapshot->version);
+
+  // Malformed and meaningless lines are skipped without publishing, and a
+  // line split across reads is applied once complete.
+  feed->send("not json\n"
+             "[1,2]\n"
+             "{\"event\":\"EventLinkAdd\"}\n"
+             "{\"event\":\"EventSwitchEnter\",\"data\":{}}\n"
+             "{\"event\":\"EventPortAdd\",\"data\":{\"dpid\":\"" + S4 + "\"}}\n" +
+             linkEvent("EventLinkAdd", S1, "00000000000000ff") +
+             "{\"event\":\"EventSwitchEn");
+  this_thread::sleep_for(chrono::milliseconds(300));
+  CHECK(manager.getSnapshot()->version == version + 3);
+  feed->send("ter\",\"data\":{\"dpid\":\"" + S4 + "\"}}\n");
+  CHECK(waitFor([&] { return manager.getSnapshot()->version == version + 4; }));
+  CHECK(manager.getSnapshot()->switches.count(S4) == 1);
+  CHECK(manager.getSnapshot()->switches.size() == 3);
+
+  // While the feed is up, REST only reconciles (every 60 s here).
+  CHECK(rest.requests() == restRequests);
+
+  // Dropping the feed, with reconnects refused, falls back to polling:
+  // the first poll reconciles away what only the events had added.
+  feedServer.stop();
+  feed->close();
+  CHECK(waitFor([&] { return manager.getSnapshot()->version == version + 5; }));
+  snapshot = manager.getSnapshot();
+  CHECK(snapshot->switches.size() == 2);
+  CHECK(snapshot->switches.count(S4) == 0);
+  size_t afterDrop = rest.requests();
+  // Three requests per poll, every 100 ms.
+  CHECK(waitFor([&] { return rest.requests() >= afterDrop + 3 * 4; }, 1500));
+  // Unchanged responses publish nothing.
+  CHECK(manager.getSnapshot()->version == version + 5);
+
+  manager.stop();
+  return testResult("test_topology_events");
+}